@@ -0,0 +1,650 @@
+#include "../cparse.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/* corpus generator */
+
+struct bench_options {
+	int structs;
+	int enums;
+	int fields; /* per struct, the actual count varies between half and one and a half times this */
+	int identifier_length;
+	int depth; /* longest chain of structs embedded by value */
+	int macros; /* percentage of array extents spelled through a macro */
+	int typedefs; /* percentage of primitive fields spelled through a typedef */
+	int functions; /* static inline functions with bodies, each followed by an initialized table */
+	unsigned seed;
+	int iterations;
+	int threads;
+	const char* output; /* where the corpus is written, cparse_file reads it back */
+	const char* cache_dir;
+};
+
+struct bench_corpus {
+	char* data;
+	size_t size;
+	size_t capacity;
+	size_t tokens; /* as seen by the parser, after macro replacement and not counting the skipped bodies */
+	int decls; /* enums and structs, the typedefs, functions and tables are not reported to the stream callbacks */
+	int edit_offset; /* first field name of the last struct, no other declaration refers to it so updates splice */
+};
+
+static unsigned bench_random(unsigned* state)
+{
+	/* xorshift32, deterministic across platforms */
+	unsigned x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static int bench_random_range(unsigned* state, int n)
+{
+	return n > 0 ? (int)(bench_random(state) % (unsigned)n) : 0;
+}
+
+static void bench_append(struct bench_corpus* corpus, const char* format, ...)
+{
+	for (;;) {
+		va_list args;
+		va_start(args, format);
+		int length = vsnprintf(corpus->data + corpus->size, corpus->capacity - corpus->size, format, args);
+		va_end(args);
+
+		if (length >= 0 && corpus->size + (size_t)length < corpus->capacity) {
+			corpus->size += (size_t)length;
+			return;
+		}
+
+		corpus->capacity = corpus->capacity ? corpus->capacity * 2 : 1 << 16;
+		corpus->data = realloc(corpus->data, corpus->capacity);
+		if (!corpus->data) {
+			fprintf(stderr, "out of memory.\n");
+			exit(1);
+		}
+	}
+}
+
+/* unique identifier of exactly length characters (or longer if length cannot hold the index), the same for the same
+   prefix and index so that declarations can be referred to */
+static void bench_identifier(char* out, char prefix, int index, int length)
+{
+	unsigned filler = (unsigned)index * 2654435761u + (unsigned char)prefix + 1;
+	char* p = out;
+	*p++ = prefix;
+	do {
+		*p++ = (char)('a' + index % 26);
+		index /= 26;
+	} while (index);
+	*p++ = '_';
+	while (p - out < length)
+		*p++ = (char)('a' + bench_random(&filler) % 26);
+	*p = 0;
+}
+
+static void bench_generate(struct bench_options const* options, struct bench_corpus* corpus)
+{
+	static const struct { const char* spelling; int tokens; } primitives[] = {
+		{ "char", 1 }, { "unsigned char", 2 }, { "short", 1 }, { "unsigned short", 2 }, { "int", 1 }, { "unsigned int", 2 },
+		{ "long", 1 }, { "unsigned long", 2 }, { "long long", 2 }, { "float", 1 }, { "double", 1 }, { "const char*", 3 },
+	};
+
+	unsigned state = options->seed ? options->seed : 1;
+	int* depths = calloc((size_t)options->structs + 1, sizeof(int));
+	char name[256], type[256];
+
+	memset(corpus, 0, sizeof(*corpus));
+	bench_append(corpus, "/* generated by cparse_bench, seed %u */\n\n", options->seed);
+
+	/* only if used, a unit with directives cannot be updated incrementally */
+	if (options->macros > 0) {
+		for (int i = 0; i < 16; ++i)
+			bench_append(corpus, "#define BENCH_EXTENT_%d %d\n", i, i + 1);
+		bench_append(corpus, "\n");
+	}
+
+	/* one typedef per primitive, fields pick either spelling */
+	if (options->typedefs > 0) {
+		for (int p = 0; p < (int)(sizeof(primitives) / sizeof(primitives[0])); ++p) {
+			bench_identifier(name, 't', p, options->identifier_length);
+			bench_append(corpus, "typedef %s %s;\n", primitives[p].spelling, name);
+			corpus->tokens += 3 + (size_t)primitives[p].tokens;
+		}
+		bench_append(corpus, "\n");
+	}
+
+	/* enums first so that any struct can use them */
+	for (int e = 0; e < options->enums; ++e) {
+		bench_identifier(name, 'e', e, options->identifier_length);
+		bench_append(corpus, "enum %s {\n", name);
+		corpus->tokens += 3;
+
+		const int constants = 1 + bench_random_range(&state, 2 * options->fields);
+		for (int c = 0; c < constants; ++c) {
+			bench_identifier(name, 'k', e * 1024 + c, options->identifier_length);
+			if (bench_random_range(&state, 4) == 0) {
+				bench_append(corpus, "\t%s_%d = %d,\n", name, e, c * 2);
+				corpus->tokens += 4;
+			}
+			else {
+				bench_append(corpus, "\t%s_%d,\n", name, e);
+				corpus->tokens += 2;
+			}
+		}
+		bench_append(corpus, "};\n\n");
+		corpus->tokens += 2;
+		++corpus->decls;
+	}
+
+	for (int s = 0; s < options->structs; ++s) {
+		bench_identifier(name, 's', s, options->identifier_length);
+		bench_append(corpus, "struct %s {\n", name);
+		corpus->tokens += 3;
+
+		const int fields = 1 + (options->fields - 1) / 2 + bench_random_range(&state, options->fields);
+		for (int f = 0; f < fields; ++f) {
+			int tokens = 0;
+			const int kind = bench_random_range(&state, 8);
+
+			if (kind == 0 && s > 0) {
+				/* pointer to any struct before this one, or to itself */
+				bench_identifier(type, 's', bench_random_range(&state, s + 1), options->identifier_length);
+				memmove(type + 7, type, strlen(type) + 1);
+				memcpy(type, "struct ", 7);
+				strcat(type, "*");
+				tokens = 3;
+			}
+			else if (kind == 1 && s > 0) {
+				/* embedded by value, within the nesting limit */
+				int embedded = bench_random_range(&state, s);
+				if (depths[embedded] + 1 < options->depth) {
+					bench_identifier(type, 's', embedded, options->identifier_length);
+					memmove(type + 7, type, strlen(type) + 1);
+					memcpy(type, "struct ", 7);
+					tokens = 2;
+					if (depths[embedded] + 1 > depths[s])
+						depths[s] = depths[embedded] + 1;
+				}
+			}
+			else if (kind == 2 && options->enums > 0) {
+				bench_identifier(type, 'e', bench_random_range(&state, options->enums), options->identifier_length);
+				memmove(type + 5, type, strlen(type) + 1);
+				memcpy(type, "enum ", 5);
+				tokens = 2;
+			}
+
+			if (!tokens) {
+				const int primitive = bench_random_range(&state, (int)(sizeof(primitives) / sizeof(primitives[0])));
+				if (options->typedefs > 0 && bench_random_range(&state, 100) < options->typedefs) {
+					bench_identifier(type, 't', primitive, options->identifier_length);
+					tokens = 1;
+				}
+				else {
+					strcpy(type, primitives[primitive].spelling);
+					tokens = primitives[primitive].tokens;
+				}
+			}
+
+			bench_identifier(name, 'f', f, options->identifier_length);
+			if (s == options->structs - 1 && f == 0)
+				corpus->edit_offset = (int)corpus->size + 1 + (int)strlen(type) + 1;
+			bench_append(corpus, "\t%s %s", type, name);
+			tokens += 2;
+
+			if (bench_random_range(&state, 6) == 0) {
+				const int extent = 1 + bench_random_range(&state, 16);
+				if (bench_random_range(&state, 100) < options->macros)
+					bench_append(corpus, "[BENCH_EXTENT_%d]", extent - 1);
+				else
+					bench_append(corpus, "[%d]", extent);
+				tokens += 3;
+			}
+
+			bench_append(corpus, ";\n");
+			corpus->tokens += (size_t)tokens;
+		}
+
+		bench_append(corpus, "};\n\n");
+		corpus->tokens += 2;
+		++corpus->decls;
+	}
+
+	/* after the structs so that the update benchmark still splices, the bodies and tables are skipped unread */
+	for (int f = 0; f < options->functions; ++f) {
+		const int primitive = bench_random_range(&state, (int)(sizeof(primitives) / sizeof(primitives[0])));
+		bench_identifier(name, 'g', f, options->identifier_length);
+		bench_identifier(type, 's', bench_random_range(&state, options->structs), options->identifier_length);
+		bench_append(corpus, "static inline %s %s(struct %s* self, int count)\n{\n", primitives[primitive].spelling, name, type);
+		corpus->tokens += 7 + (size_t)primitives[primitive].tokens;
+
+		const int statements = 1 + bench_random_range(&state, 2 * options->fields);
+		for (int i = 0; i < statements; ++i) {
+			switch (bench_random_range(&state, 4)) {
+				case 0: bench_append(corpus, "\tif (count > %d) { count -= %d; } /* } */\n", i, i + 1); break;
+				case 1: bench_append(corpus, "\tfor (int i = 0; i < count; ++i) { self += (\"{\"[0] == '{'); }\n"); break;
+				case 2: bench_append(corpus, "\tcount = (count << 1) ^ %d; // }\n", bench_random_range(&state, 1 << 16)); break;
+				default: bench_append(corpus, "\t{ int table[] = { %d, %d }; count += table[count & 1]; }\n", i, i * 3); break;
+			}
+		}
+		bench_append(corpus, "\treturn (%s)count;\n}\n\n", primitives[primitive].spelling);
+
+		bench_identifier(name, 'v', f, options->identifier_length);
+		bench_append(corpus, "static const int %s[] = {", name);
+		for (int i = 0; i < 16; ++i)
+			bench_append(corpus, " %d,", bench_random_range(&state, 1 << 16));
+		bench_append(corpus, " };\n\n");
+		corpus->tokens += 9;
+	}
+
+	free(depths);
+}
+
+/* timing */
+
+static double bench_now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#elif defined(TIME_UTC)
+	/* strict iso c, as in cparse_wall_clock */
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* allocator that tracks the bytes in use so that streaming can report its peak, not thread safe */
+
+static size_t bench_live_bytes, bench_peak_bytes;
+
+static void* bench_allocate(void* user_data, cparse_size_t size)
+{
+	(void)user_data;
+	size_t* block = malloc(sizeof(size_t) * 2 + size);
+	if (!block)
+		return NULL;
+	block[0] = size;
+	bench_live_bytes += size;
+	if (bench_live_bytes > bench_peak_bytes)
+		bench_peak_bytes = bench_live_bytes;
+	return block + 2;
+}
+
+static void bench_deallocate(void* user_data, void* ptr)
+{
+	(void)user_data;
+	size_t* block = (size_t*)ptr - 2;
+	bench_live_bytes -= block[0];
+	free(block);
+}
+
+/* entry points */
+
+struct bench_context {
+	struct bench_options const* options;
+	struct bench_corpus const* corpus;
+	struct cparse_info info;
+	int streamed;
+};
+
+static void bench_fail(struct bench_context const* context, const char* entry_point, enum cparse_result result)
+{
+	fprintf(stderr, "%s failed (%d): %s\n", entry_point, (int)result, context->info.buffer);
+	exit(1);
+}
+
+static void bench_on_enum(void* user_data, struct cparse_decl_enum const* enum_decl)
+{
+	(void)enum_decl;
+	++((struct bench_context*)user_data)->streamed;
+}
+
+static void bench_on_struct(void* user_data, struct cparse_decl_struct const* struct_decl)
+{
+	(void)struct_decl;
+	++((struct bench_context*)user_data)->streamed;
+}
+
+/* runs one parse, returns the number of times the corpus was parsed */
+typedef int (*bench_run)(struct bench_context* context);
+
+static int bench_run_file(struct bench_context* context)
+{
+	struct cparse_unit* unit;
+	enum cparse_result result = cparse_file(context->options->output, &context->info, &unit);
+	if (result)
+		bench_fail(context, "cparse_file", result);
+	cparse_unit_release(unit, &context->info);
+	return 1;
+}
+
+static int bench_run_buffer(struct bench_context* context)
+{
+	struct cparse_unit* unit;
+	enum cparse_result result = cparse_buffer(context->corpus->data, context->corpus->size, context->options->output, &context->info, &unit);
+	if (result)
+		bench_fail(context, "cparse_buffer", result);
+	cparse_unit_release(unit, &context->info);
+	return 1;
+}
+
+static int bench_run_stream(struct bench_context* context)
+{
+	context->streamed = 0;
+	bench_run_buffer(context);
+	if (context->streamed != context->corpus->decls) {
+		fprintf(stderr, "streamed %d declarations out of %d.\n", context->streamed, context->corpus->decls);
+		exit(1);
+	}
+	return 1;
+}
+
+static int bench_run_files(struct bench_context* context)
+{
+	struct cparse_info info = context->info;
+	info.allocate = NULL;
+	info.deallocate = NULL;
+
+	const int count = context->options->threads * 2;
+	const char** filenames = malloc(sizeof(const char*) * (size_t)count);
+	struct cparse_file_result* results = malloc(sizeof(struct cparse_file_result) * (size_t)count);
+	for (int i = 0; i < count; ++i)
+		filenames[i] = context->options->output;
+
+	enum cparse_result result = cparse_files(filenames, count, context->options->threads, &info, results);
+	if (result) {
+		fprintf(stderr, "cparse_files failed (%d)\n", (int)result);
+		exit(1);
+	}
+
+	for (int i = 0; i < count; ++i)
+		cparse_unit_release(results[i].unit, &info);
+	free(results);
+	free((void*)filenames);
+	return count;
+}
+
+/* parses the corpus once, then times updates that rename a field of the last struct back and forth */
+static int bench_run_update(struct bench_context* context)
+{
+	struct bench_corpus const* corpus = context->corpus;
+	char* edited = malloc(corpus->size);
+	memcpy(edited, corpus->data, corpus->size);
+	edited[corpus->edit_offset] = edited[corpus->edit_offset] == 'f' ? 'g' : 'f';
+
+	struct cparse_unit* unit;
+	enum cparse_result result = cparse_buffer(corpus->data, corpus->size, context->options->output, &context->info, &unit);
+	if (result)
+		bench_fail(context, "cparse_buffer", result);
+
+	const int updates = 16;
+	for (int i = 0; i < updates; ++i) {
+		const char* from = i % 2 ? edited : corpus->data;
+		const char* to = i % 2 ? corpus->data : edited;
+		result = cparse_unit_update(&unit, from, corpus->size, to, corpus->size, context->options->output, &context->info);
+		if (result)
+			bench_fail(context, "cparse_unit_update", result);
+	}
+
+	cparse_unit_release(unit, &context->info);
+	free(edited);
+	return updates;
+}
+
+/* best of the iterations, the first parse warms the caches and is not counted */
+static void bench_measure(struct bench_context* context, const char* entry_point, bench_run run, size_t arena_bytes)
+{
+	struct bench_corpus const* corpus = context->corpus;
+	double best = 0.0;
+
+	run(context);
+	for (int i = 0; i < context->options->iterations; ++i) {
+		const double start = bench_now();
+		const int count = run(context);
+		const double elapsed = (bench_now() - start) / count;
+		if (i == 0 || elapsed < best)
+			best = elapsed;
+	}
+
+	if (best <= 0.0)
+		best = 1e-9;
+
+	printf("%-24s %10.1f %14.0f %14.0f %14.1f\n", entry_point, (double)corpus->size / best / (1024.0 * 1024.0),
+		corpus->decls / best, (double)corpus->tokens / best, (double)arena_bytes / corpus->decls);
+}
+
+static size_t bench_measure_arena(struct bench_context const* context)
+{
+	cparse_size_t size = 0, alignment = 0;
+	enum cparse_result result = cparse_measure_buffer(context->corpus->data, context->corpus->size, context->options->output, &context->info, &size, &alignment);
+	if (result)
+		bench_fail(context, "cparse_measure_buffer", result);
+	return size;
+}
+
+/* writing the unit of the corpus in each dump format, the output is counted and discarded */
+static int bench_discard(void* user_data, const char* data, cparse_size_t size)
+{
+	(void)data;
+	*(size_t*)user_data += size;
+	return 1;
+}
+
+static void bench_measure_dump(struct bench_context const* context, struct cparse_unit const* unit, const char* format_name, enum cparse_dump_format format)
+{
+	static char buffer[1 << 16];
+	size_t written = 0;
+	struct cparse_dump_writer writer = { buffer, sizeof(buffer), bench_discard, &written };
+	double best = 0.0;
+
+	cparse_unit_write(unit, format, &writer);
+	for (int i = 0; i < context->options->iterations; ++i) {
+		written = 0;
+		const double start = bench_now();
+		cparse_unit_write(unit, format, &writer);
+		const double elapsed = bench_now() - start;
+		if (i == 0 || elapsed < best)
+			best = elapsed;
+	}
+
+	if (best <= 0.0)
+		best = 1e-9;
+
+	printf("%-24s %10.1f %14.0f %14.1f\n", format_name, (double)written / best / (1024.0 * 1024.0), context->corpus->decls / best,
+		(double)written / context->corpus->decls);
+}
+
+/* the most frequent token kinds of a parse, in decreasing order */
+static void bench_print_token_kinds(struct cparse_stats const* stats, int count)
+{
+	char printed[CPARSE_TOKEN_KIND_COUNT] = { 0 };
+	for (int i = 0; i < count; ++i) {
+		int most = -1;
+		for (int kind = 0; kind < CPARSE_TOKEN_KIND_COUNT; ++kind) {
+			if (!printed[kind] && stats->tokens_by_kind[kind] && (most < 0 || stats->tokens_by_kind[kind] > stats->tokens_by_kind[most]))
+				most = kind;
+		}
+		if (most < 0)
+			break;
+		printed[most] = 1;
+		printf("%s%s %zu", i ? ", " : "", cparse_token_kind_spelling(most), (size_t)stats->tokens_by_kind[most]);
+	}
+}
+
+/* command line */
+
+static void bench_usage(void)
+{
+	printf(
+		"usage: cparse_bench [options]\n"
+		"  --structs N       structs in the corpus (default 20000)\n"
+		"  --enums N         enums in the corpus (default 2000)\n"
+		"  --fields N        average fields per struct and constants per enum (default 8)\n"
+		"  --identifiers N   identifier length (default 12)\n"
+		"  --depth N         longest chain of structs embedded by value (default 4)\n"
+		"  --macros N        percentage of array extents spelled through a macro, the update\n"
+		"                    benchmark reparses everything if not 0 (default 0)\n"
+		"  --typedefs N      percentage of primitive fields spelled through a typedef (default 0)\n"
+		"  --functions N     static inline functions and constant tables after the structs, their\n"
+		"                    bodies and initializers are skipped (default 0)\n"
+		"  --seed N          generator seed (default 1)\n"
+		"  --iterations N    timed runs per entry point, the best is reported (default 5)\n"
+		"  --threads N       cparse_files threads (default 4)\n"
+		"  --output FILE     where the corpus is written (default bench_corpus.h)\n"
+		"  --cache DIR       also time cparse_file with a warm cache in DIR, which must exist\n"
+		"  --generate        only write the corpus\n");
+}
+
+int main(int argc, char** argv)
+{
+	struct bench_options options = { 20000, 2000, 8, 12, 4, 0, 0, 0, 1, 5, 4, "bench_corpus.h", NULL };
+	int generate_only = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+		int* number = NULL;
+
+		if (strcmp(arg, "--structs") == 0) number = &options.structs;
+		else if (strcmp(arg, "--enums") == 0) number = &options.enums;
+		else if (strcmp(arg, "--fields") == 0) number = &options.fields;
+		else if (strcmp(arg, "--identifiers") == 0) number = &options.identifier_length;
+		else if (strcmp(arg, "--depth") == 0) number = &options.depth;
+		else if (strcmp(arg, "--macros") == 0) number = &options.macros;
+		else if (strcmp(arg, "--typedefs") == 0) number = &options.typedefs;
+		else if (strcmp(arg, "--functions") == 0) number = &options.functions;
+		else if (strcmp(arg, "--seed") == 0) number = (int*)&options.seed;
+		else if (strcmp(arg, "--iterations") == 0) number = &options.iterations;
+		else if (strcmp(arg, "--threads") == 0) number = &options.threads;
+		else if (strcmp(arg, "--output") == 0 && value) { options.output = value; ++i; continue; }
+		else if (strcmp(arg, "--cache") == 0 && value) { options.cache_dir = value; ++i; continue; }
+		else if (strcmp(arg, "--generate") == 0) { generate_only = 1; continue; }
+		else { bench_usage(); return arg[2] == 'h' ? 0 : 1; }
+
+		if (!value) {
+			bench_usage();
+			return 1;
+		}
+		*number = atoi(value);
+		++i;
+	}
+
+	if (options.structs < 1 || options.fields < 1 || options.identifier_length < 1 || options.identifier_length > 200 ||
+		options.depth < 1 || options.iterations < 1 || options.threads < 1) {
+		bench_usage();
+		return 1;
+	}
+
+	struct bench_corpus corpus;
+	bench_generate(&options, &corpus);
+
+	FILE* file = fopen(options.output, "wb");
+	if (!file || fwrite(corpus.data, 1, corpus.size, file) != corpus.size) {
+		fprintf(stderr, "cannot write %s.\n", options.output);
+		return 1;
+	}
+	fclose(file);
+
+	printf("corpus %s: %.2f MB, %d declarations, %zu tokens\n", options.output, (double)corpus.size / (1024.0 * 1024.0), corpus.decls, corpus.tokens);
+	if (generate_only) {
+		free(corpus.data);
+		return 0;
+	}
+
+	struct bench_context context;
+	memset(&context, 0, sizeof(context));
+	context.options = &options;
+	context.corpus = &corpus;
+	context.info.buffer_size = 1 << 20;
+	context.info.buffer = malloc(context.info.buffer_size);
+	context.info.allocate = bench_allocate;
+	context.info.deallocate = bench_deallocate;
+	context.info.callback_user_data = &context;
+
+	printf("\n%-24s %10s %14s %14s %14s\n", "entry point", "MB/s", "decls/s", "tokens/s", "arena B/decl");
+
+	const size_t arena_bytes = bench_measure_arena(&context);
+	bench_measure(&context, "cparse_file", bench_run_file, arena_bytes);
+	bench_measure(&context, "cparse_buffer", bench_run_buffer, arena_bytes);
+
+	context.info.flags = CPARSE_FLAG_SPELLING_SLICES;
+	bench_measure(&context, "cparse_buffer (slices)", bench_run_buffer, bench_measure_arena(&context));
+	context.info.flags = 0;
+
+	/* streaming keeps no decls, what matters is the peak of the arena, the caller buffer and the blocks chained */
+	context.info.on_enum = bench_on_enum;
+	context.info.on_struct = bench_on_struct;
+	bench_peak_bytes = bench_live_bytes;
+	bench_run_stream(&context);
+	bench_measure(&context, "cparse_buffer (stream)", bench_run_stream, bench_peak_bytes - bench_live_bytes + context.info.buffer_size);
+	context.info.on_enum = NULL;
+	context.info.on_struct = NULL;
+
+	bench_measure(&context, "cparse_files", bench_run_files, arena_bytes);
+
+	/* the same with the spellings shared through a context, which allocates with malloc as the parses are concurrent */
+	struct cparse_info context_info;
+	memset(&context_info, 0, sizeof(context_info));
+	context.info.context = cparse_context_create(&context_info);
+	bench_measure(&context, "cparse_files (context)", bench_run_files, bench_measure_arena(&context));
+	cparse_context_destroy(context.info.context);
+	context.info.context = NULL;
+	bench_measure(&context, "cparse_unit_update", bench_run_update, arena_bytes);
+
+	if (options.cache_dir) {
+		context.info.cache_dir = options.cache_dir;
+		bench_measure(&context, "cparse_file (cache)", bench_run_file, arena_bytes);
+		context.info.cache_dir = NULL;
+	}
+
+	/* where the time of one cparse_file goes */
+	struct cparse_stats stats;
+	context.info.stats = &stats;
+	bench_run_file(&context);
+	context.info.stats = NULL;
+
+	const double total = stats.open_seconds + stats.lex_seconds + stats.parse_seconds;
+	printf("\ncparse_file: %zu tokens (", (size_t)stats.tokens);
+	bench_print_token_kinds(&stats, 8);
+	printf("), %zu declarations\n", (size_t)stats.decls);
+	printf("arena high water %.2f MB, token arrays %.2f MB, %.2f MB of bodies and initializers skipped\n", (double)stats.arena_high_water / (1024.0 * 1024.0),
+		(double)stats.token_array_bytes / (1024.0 * 1024.0), (double)stats.bytes_skipped / (1024.0 * 1024.0));
+	printf("open %.1f%%, lex %.1f%%, parse %.1f%% of %.3f s\n", 100.0 * stats.open_seconds / total, 100.0 * stats.lex_seconds / total,
+		100.0 * stats.parse_seconds / total, total);
+
+	struct cparse_unit* unit;
+	enum cparse_result result = cparse_buffer(corpus.data, corpus.size, options.output, &context.info, &unit);
+	if (result)
+		bench_fail(&context, "cparse_buffer", result);
+	printf("\n%-24s %10s %14s %14s\n", "dump format", "MB/s", "decls/s", "B/decl");
+	bench_measure_dump(&context, unit, "text", CPARSE_DUMP_TEXT);
+	bench_measure_dump(&context, unit, "json", CPARSE_DUMP_JSON);
+	bench_measure_dump(&context, unit, "binary", CPARSE_DUMP_BINARY);
+	cparse_unit_release(unit, &context.info);
+
+	free(context.info.buffer);
+	free(corpus.data);
+	return 0;
+}
+
+#define CPARSE_IMPLEMENTATION
+#include "../cparse.h"
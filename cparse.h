@@ -49,6 +49,8 @@ enum cparse_type_primitive_kind {
 	CPARSE_PRIMITIVE_TYPE_FLOAT,
 	CPARSE_PRIMITIVE_TYPE_DOUBLE,
 	CPARSE_PRIMITIVE_TYPE_LONG_DOUBLE,
+	CPARSE_PRIMITIVE_TYPE_BOOL,
+	CPARSE_PRIMITIVE_TYPE_VOID,
 	CPARSE_PRIMITIVE_TYPE_COUNT_,
 };
 
@@ -59,6 +61,8 @@ enum cparse_decl_kind {
 	CPARSE_DECL_VARIABLE,
 	CPARSE_DECL_FIELD,
 	CPARSE_DECL_STRUCT,
+	CPARSE_DECL_TYPEDEF,
+	CPARSE_DECL_FUNCTION,
 };
 
 enum cparse_storage_class {
@@ -66,17 +70,22 @@ enum cparse_storage_class {
 	CPARSE_STORAGE_CLASS_EXTERN = 1,
 	CPARSE_STORAGE_CLASS_STATIC = 2,
 	CPARSE_STORAGE_CLASS_INLINE = 4,
+	CPARSE_STORAGE_CLASS_NORETURN = 8,
+	CPARSE_STORAGE_CLASS_THREAD_LOCAL = 16,
 };
 
 enum cparse_type_qualifier {
 	CPARSE_TYPE_QUAL_NONE = 0, 
 	CPARSE_TYPE_QUAL_CONST = 1,
 	CPARSE_TYPE_QUAL_VOLATILE = 2,
+	CPARSE_TYPE_QUAL_RESTRICT = 4,
 };
 
 struct cparse_type {
 	enum cparse_type_kind kind;
 	enum cparse_type_qualifier qualifiers;
+	int size; /* in bytes for cparse_info::abi, size and alignment are 0 for void and incomplete structs */
+	int alignment;
 };
 
 struct cparse_type_primitive {
@@ -105,10 +114,24 @@ struct cparse_type_enum {
 	struct cparse_decl_enum* enum_type;
 };
 
+/* open-addressing hash index of decls by spelling, allocated in the buffer */
+struct cparse_symbol {
+	unsigned hash;
+	struct cparse_decl* decl;
+};
+
+struct cparse_symbol_table {
+	struct cparse_symbol* symbols;
+	int capacity; /* zero or a power of two */
+	int count;
+};
+
 struct cparse_decl {
 	enum cparse_decl_kind kind;
 	struct cparse_decl* next;
-	const char* spelling;
+	const char* spelling; /* not null terminated if CPARSE_FLAG_SPELLING_SLICES is set */
+	int spelling_length;
+	int referenced; /* enums, structs and typedefs, a type in another declaration refers to this one */
 };
 
 struct cparse_decl_enum_constant {
@@ -120,6 +143,7 @@ struct cparse_decl_enum {
 	struct cparse_decl decl;
 	int num_constants;
 	struct cparse_decl_enum_constant* constants;
+	struct cparse_symbol_table symbols; /* constants by spelling */
 };
 
 struct cparse_decl_variable {
@@ -129,37 +153,356 @@ struct cparse_decl_variable {
 
 struct cparse_decl_variable_field {
 	struct cparse_decl_variable variable;
-	int offset;
+	int offset; /* in bytes from the beginning of the struct */
 };
 
 struct cparse_decl_struct {
 	struct cparse_decl decl;
+	int size; /* both 0 until defined if only forward declared so far */
+	int alignment;
 	int num_fields;
 	struct cparse_decl_variable_field* fields;
+	struct cparse_symbol_table symbols; /* fields by spelling */
+};
+
+/* functions and variables declared at file scope, in cparse_unit::decls only. parameter lists, bodies and initializers
+   are skipped without being parsed, their begin and end are byte offsets in the source like cparse_unit_span so that
+   they can be parsed on demand, or both 0 if the text was not read from the source as written (it was included or
+   a macro expanded to it). */
+struct cparse_decl_function {
+	struct cparse_decl decl;
+	struct cparse_type* return_type;
+	enum cparse_storage_class storage_class;
+	int defined; /* has a body, not only a prototype */
+	cparse_size_t parameters_begin; /* from the '(' to past the ')' */
+	cparse_size_t parameters_end;
+	cparse_size_t body_begin; /* from the '{' to past the '}' */
+	cparse_size_t body_end;
+};
+
+/* arrays declared with [] have extent 0, their size is not taken from the initializer */
+struct cparse_decl_variable_global {
+	struct cparse_decl_variable variable;
+	enum cparse_storage_class storage_class;
+	int initialized;
+	cparse_size_t initializer_begin; /* from the first token after the '=' to the end of the last one */
+	cparse_size_t initializer_end;
+};
+
+/* typedef names are not types of their own, the types declared with one are the type it names (with the qualifiers
+   added, so that const T is T const) */
+struct cparse_decl_typedef {
+	struct cparse_decl decl;
+	struct cparse_type* type;
+};
+
+/* source range of a top-level declaration, see cparse_unit_update */
+struct cparse_unit_span {
+	struct cparse_unit_span* next;
+	cparse_size_t begin; /* byte offsets in the source, end is past the ';' */
+	cparse_size_t end;
+	struct cparse_decl* decl; /* the first of the decls the declaration added to the unit, or null */
+	int num_decls; /* decl and those chained after it, more than one for typedef struct foo {...} foo_t, *foo_ptr; */
+};
+
+/* an error the parse recovered from, see CPARSE_FLAG_RECOVER */
+struct cparse_diagnostic {
+	struct cparse_diagnostic* next;
+	enum cparse_result code; /* CPARSE_RESULT_SYNTAX_ERROR or CPARSE_RESULT_SEMANTIC_ERROR */
+	const char* filename;
+	int line;
+	int column;
+	const char* token; /* null terminated spelling of the token the error was found at, empty at the end of file */
+	int token_length;
+	const char* message; /* without the position, e.g. "missing ';' before 'int'." */
 };
 
 struct cparse_unit {
-	struct cparse_decl* decls;
+	struct cparse_decl* decls; /* named enums and structs, typedefs, functions, variables and the anonymous enums and structs they are declared with */
+	struct cparse_symbol_table symbols; /* named enums and structs by tag */
+	struct cparse_symbol_table typedefs; /* typedefs by name, their own namespace */
+	struct cparse_block* blocks; /* blocks chained through cparse_info::allocate, see cparse_unit_release */
+
+	/* top-level declarations in source order. only recorded if incremental is set, that is if no directive
+	   ran and no macro was expanded so that every token still sits where it is in the source. */
+	struct cparse_unit_span* spans;
+	int incremental;
+	const char* source; /* CPARSE_FLAG_SPELLING_SLICES only, the text spellings point into */
+	char* alloc_cursor; /* free space left in the last block, cparse_unit_update allocates from there */
+	char* alloc_end;
+	struct cparse_diagnostic* diagnostics; /* CPARSE_FLAG_RECOVER only, in source order */
+};
+
+/* data models struct layouts are computed for */
+enum cparse_abi {
+	CPARSE_ABI_X86_64_SYSV, /* LP64, 16 byte long double */
+	CPARSE_ABI_I386, /* ILP32, long long and double aligned to 4 bytes, 12 byte long double */
+	CPARSE_ABI_AARCH64, /* LP64, 16 byte long double */
+	CPARSE_ABI_LLP64, /* 64-bit windows, 4 byte long, 8 byte long double */
+	CPARSE_ABI_COUNT_,
+};
+
+enum cparse_flag {
+	CPARSE_FLAG_NONE = 0,
+
+	/* decl spellings point straight into the source instead of being copied into the buffer, so they
+	   are not null terminated (use spelling_length). cparse_buffer requires the caller to keep the
+	   data alive as long as the unit, cparse_file copies the whole file into the buffer instead. */
+	CPARSE_FLAG_SPELLING_SLICES = 1,
+
+	/* syntax and semantic errors in declarations do not stop the parse: each one is appended to
+	   cparse_unit::diagnostics and the parser skips to the next ';' or '}', so that a single parse reports them
+	   all. the parse then succeeds with the declarations that could be parsed, and the unit is neither cached nor
+	   incremental. a struct with a field skipped keeps the others but stays incomplete, with alignment 0. errors of
+	   the preprocessor and the lexer, missing files and running out of memory are still fatal and written to the
+	   buffer. */
+	CPARSE_FLAG_RECOVER = 2,
+};
+
+/* kinds of tokens counted in cparse_stats::tokens_by_kind, cparse_token_kind_spelling names them */
+#define CPARSE_TOKEN_KIND_COUNT 98
+
+/* what a parse did and where its time went, see cparse_info::stats */
+struct cparse_stats {
+	cparse_size_t bytes_read; /* the source and the files it includes */
+	cparse_size_t files_read;
+	cparse_size_t tokens; /* lexed from the source before macro replacement, directives and skipped groups included */
+	cparse_size_t tokens_by_kind[CPARSE_TOKEN_KIND_COUNT];
+	cparse_size_t decls; /* created, enum constants and fields included */
+	cparse_size_t bytes_skipped; /* of function bodies, parameter lists and initializers, passed over without lexing */
+	cparse_size_t arena_high_water; /* most bytes of the buffer and the chained blocks in use at once */
+	cparse_size_t token_array_bytes; /* allocated for macro expansions, arguments and directive lines */
+	double open_seconds; /* finding, mapping or reading files */
+	double lex_seconds; /* lexing and preprocessing */
+	double parse_seconds; /* everything else */
 };
 
 struct cparse_info {
-	char* buffer;
+	char* buffer; /* first block, errors are reported here */
 	cparse_size_t buffer_size;
+	unsigned flags; /* combination of cparse_flag */
+	enum cparse_abi abi; /* field offsets, sizes and alignments follow this ABI */
+
+	/* optional, when set the buffer grows by chaining new blocks of at least size bytes instead of failing
+	   with CPARSE_RESULT_OUT_OF_MEMORY. allocate returns null on failure. */
+	void* (*allocate)(void* user_data, cparse_size_t size);
+	void (*deallocate)(void* user_data, void* block);
+	void* allocator_user_data;
+
+	/* the source is preprocessed. quoted #include names are looked up next to the including file first,
+	   then in include_dirs. defines are "NAME" or "NAME=VALUE", as with -D. */
 	const char** include_dirs; /* null or null terminated */
 	const char** defines; /* null or null terminated */
+
+	/* optional directory where cparse_file keeps a binary image of each parsed unit, keyed by the path and
+	   content of the file, the defines and the include dirs (relative paths with the working directory). on a
+	   hit (and if no included file changed) the image is copied into the buffer and relocated instead of
+	   parsing the file again. */
+	const char* cache_dir;
+
+	/* optional, when either is set the unit is streamed: each top-level enum and struct definition is handed to
+	   its callback as soon as its declaration is parsed, then the memory it took is reused for the next one. the
+	   buffer is split in halves, one for the declaration being parsed (which has to fit the largest declaration,
+	   or the declarations one macro expands to) and one for what outlives it: the macros, the includes, a copy of
+	   every typedef and a stub of every tag, about 130 bytes per tag with its symbol table slot. memory still
+	   grows with the number of tags then, only no longer with their fields and constants: both halves grow as
+	   usual with an allocator, without one the parse runs out of memory once the stubs fill their half. the decls
+	   are only valid during the callback, later types that refer to their tags point to the stubs, which keep the
+	   spelling, size and alignment but no fields or constants. the unit produced has no decls and is not cached,
+	   it still has to be released. */
+	void (*on_enum)(void* user_data, struct cparse_decl_enum const*);
+	void (*on_struct)(void* user_data, struct cparse_decl_struct const*);
+	void* callback_user_data;
+
+	/* optional, overwritten by each parse with its stats (an incremental cparse_unit_update only counts what it
+	   parsed again). cparse_files does not fill it in, and it is not touched at all if the implementation is
+	   compiled with CPARSE_NO_STATS. */
+	struct cparse_stats* stats;
+
+	/* optional, see cparse_context_create */
+	struct cparse_context* context;
 };
 
 CPARSE_API const char*        cparse_primitive_type_spelling(enum cparse_type_primitive_kind);
+CPARSE_API const char*        cparse_token_kind_spelling(int kind); /* null if not below CPARSE_TOKEN_KIND_COUNT */
 CPARSE_API enum cparse_result cparse_file(const char* filename, struct cparse_info const*, struct cparse_unit** out);
 
+/* parses [data, data + size) in place, the data is not copied and must stay alive during the call.
+   filename is only used to report errors and can be null. */
+CPARSE_API enum cparse_result cparse_buffer(const char* data, cparse_size_t size, const char* filename, struct cparse_info const*, struct cparse_unit** out);
+
+struct cparse_file_result {
+	enum cparse_result result;
+	struct cparse_unit* unit; /* null on failure */
+	char error[256];
+};
+
+/* parses count files on num_threads threads (the number of processors if <= 0) including the calling one and
+   writes the outcome of filenames[i] to results[i], the same unit cparse_file would produce. info->buffer is
+   not used, each unit chains its own blocks through info->allocate (malloc if null), which is then called
+   concurrently and must be thread safe; release each unit with cparse_unit_release. returns the first
+   failure in file order or CPARSE_RESULT_OK. */
+CPARSE_API enum cparse_result cparse_files(const char** filenames, int count, int num_threads, struct cparse_info const*, struct cparse_file_result* results);
+
+/* runs the same parse as cparse_file/cparse_buffer but only reports the exact buffer size and alignment
+   the parse needs, so that a fixed buffer can be allocated once. info->buffer and info->allocate are used as
+   scratch memory (falling back to malloc), the size does not include the error message. */
+CPARSE_API enum cparse_result cparse_measure(const char* filename, struct cparse_info const*, cparse_size_t* size, cparse_size_t* alignment);
+CPARSE_API enum cparse_result cparse_measure_buffer(const char* data, cparse_size_t data_size, const char* filename, struct cparse_info const*, cparse_size_t* size, cparse_size_t* alignment);
+
+/* a context is shared by any number of parses that set it in cparse_info, also running concurrently. it keeps one null
+   terminated copy of each spelling of the decls they produce, so that across the units parsed with the same context
+   two spellings are equal if and only if their pointers are (spellings are never slices then). the copies are
+   allocated through info->allocate (malloc if null), which must be thread safe if parses run concurrently, and live
+   until the context is destroyed, which must happen after the units are released. returns null if out of memory. */
+CPARSE_API struct cparse_context* cparse_context_create(struct cparse_info const*);
+CPARSE_API void                   cparse_context_destroy(struct cparse_context*);
+
+/* returns the copy of [spelling, spelling + length) kept by the context, adding it if needed, or null if out of memory */
+CPARSE_API const char*            cparse_context_intern(struct cparse_context*, const char* spelling, int length);
+
+/* hands the blocks chained during the parse of unit back to info->deallocate, the caller buffer is not touched */
+CPARSE_API void cparse_unit_release(struct cparse_unit*, struct cparse_info const*);
+
+/* updates *unit, parsed from [old_data, old_data + old_size), to [data, data + size). only the top-level
+   declarations touched by the edit are parsed again and spliced in, the others keep their identity. falls back
+   to a full parse, which replaces *unit, if the unit is not incremental or the edited text has directives or
+   macro expansions, or with CPARSE_FLAG_RECOVER if the edit has errors. info must be the one the unit was parsed
+   with and the data is handled as by cparse_buffer. on failure the unit is left as it was, unless the full parse
+   failed in which case *unit is null. */
+CPARSE_API enum cparse_result cparse_unit_update(struct cparse_unit** unit, const char* old_data, cparse_size_t old_size, const char* data, cparse_size_t size, const char* filename, struct cparse_info const*);
+
+/* constant time lookups by spelling, return null if not found */
+CPARSE_API struct cparse_decl*                cparse_unit_find(struct cparse_unit const*, const char* spelling, int length);
+CPARSE_API struct cparse_decl_typedef*        cparse_unit_find_typedef(struct cparse_unit const*, const char* spelling, int length);
+CPARSE_API struct cparse_decl_variable_field* cparse_struct_find_field(struct cparse_decl_struct const*, const char* spelling, int length);
+CPARSE_API struct cparse_decl_enum_constant*  cparse_enum_find_constant(struct cparse_decl_enum const*, const char* spelling, int length);
+
+/* compact copy of a unit for traversals: nodes refer to each other by 32-bit index, spellings are offsets into one
+   pool of null terminated strings, and the fields of each struct and the constants of each enum are contiguous, so
+   that decl->first + i is the i-th of decl->count. types are shared as in the unit and each one comes after the type
+   it targets. everything is in a single block. */
+#define CPARSE_COMPACT_NONE 0xffffffffu
+
+struct cparse_compact_type {
+	unsigned char kind; /* cparse_type_kind */
+	unsigned char qualifiers; /* cparse_type_qualifier */
+	unsigned char primitive; /* cparse_type_primitive_kind of CPARSE_TYPE_PRIMITIVE */
+	unsigned target; /* type pointed to or of the elements, or decl of the struct or enum */
+	int extent; /* CPARSE_TYPE_ARRAY */
+	int size;
+	int alignment;
+};
+
+struct cparse_compact_decl {
+	unsigned char kind; /* CPARSE_DECL_ENUM, CPARSE_DECL_STRUCT, CPARSE_DECL_TYPEDEF, CPARSE_DECL_FUNCTION or CPARSE_DECL_VARIABLE */
+	unsigned char storage_class; /* functions and variables only */
+	unsigned char defined; /* functions with a body and initialized variables */
+	unsigned spelling;
+	unsigned spelling_length;
+	unsigned first; /* first field or constant */
+	unsigned count;
+	unsigned type; /* the type a typedef names, a function returns or of a variable */
+	int size; /* structs only */
+	int alignment;
+	cparse_size_t body_begin; /* the body of a function or the initializer of a variable, see cparse_decl_function */
+	cparse_size_t body_end;
+};
+
+struct cparse_compact_field {
+	unsigned spelling;
+	unsigned spelling_length;
+	unsigned type;
+	int offset;
+};
+
+struct cparse_compact_constant {
+	long long value;
+	unsigned spelling;
+	unsigned spelling_length;
+};
+
+struct cparse_compact_unit {
+	struct cparse_compact_decl* decls; /* as cparse_unit::decls, in source order */
+	struct cparse_compact_field* fields;
+	struct cparse_compact_constant* constants;
+	struct cparse_compact_type* types;
+	const char* strings;
+	unsigned num_decls;
+	unsigned num_fields;
+	unsigned num_constants;
+	unsigned num_types;
+	cparse_size_t strings_size;
+};
+
+/* copies unit into one block allocated through info->allocate (malloc if null), release it with
+   cparse_compact_release. the unit is not needed afterwards. */
+CPARSE_API enum cparse_result cparse_unit_compact(struct cparse_unit const*, struct cparse_info const*, struct cparse_compact_unit** out);
+CPARSE_API void               cparse_compact_release(struct cparse_compact_unit*, struct cparse_info const*);
+
 #ifndef CPARSE_NO_DUMP
 #include <stdio.h>
 
+enum cparse_dump_format {
+	CPARSE_DUMP_TEXT, /* what cparse_unit_dump writes */
+	CPARSE_DUMP_JSON, /* an array with an object per decl */
+	CPARSE_DUMP_BINARY, /* see below */
+};
+
+/* the dump is collected in [buffer, buffer + buffer_size) and handed to flush whenever the buffer fills up and
+   once at the end, nothing is allocated. flush returns zero to stop the dump.
+
+   the binary format is little endian, with strings as an u32 length followed by the characters:
+
+	   unit     u32 magic 0x75647063 ("cpdu"), u32 version 3, u32 decl count, decls
+	   decl     u8 cparse_decl_kind, string spelling (empty if anonymous), then
+	            enum     u32 count, count * (string spelling, i64 value)
+	            struct   i32 size, i32 alignment, u32 count, count * (string spelling, i32 offset, type)
+	            typedef  type
+	            function u8 cparse_storage_class, u8 defined, u64 parameters begin, u64 parameters end,
+	                     u64 body begin, u64 body end, type returned
+	            variable u8 cparse_storage_class, u8 initialized, u64 initializer begin, u64 initializer end, type
+	   type     u8 cparse_type_kind, u8 qualifiers (cparse_type_qualifier), then
+	            primitive     u8 cparse_type_primitive_kind
+	            pointer       type pointed to
+	            array         i32 extent, element type
+	            struct, enum  string tag */
+struct cparse_dump_writer {
+	char* buffer;
+	cparse_size_t buffer_size;
+	int (*flush)(void* user_data, const char* data, cparse_size_t size);
+	void* user_data;
+};
+
 CPARSE_API void cparse_unit_dump(struct cparse_unit*, FILE* output);
 
+/* returns zero if a flush failed. */
+CPARSE_API int  cparse_unit_write(struct cparse_unit const*, enum cparse_dump_format, struct cparse_dump_writer const*);
+
+/* writes C source with a serialize_<tag>/deserialize_<tag> pair for every struct of the unit, to be compiled
+   where the structs are declared. the data is the memory layout of the compiling target: runs of adjacent
+   fields without pointers are copied with a single memcpy, pointers are followed (char pointers as null
+   terminated strings, other pointers to a single object, void pointers are skipped) so the data must be a tree.
+   the generated functions are
+
+	   size_t serialize_<tag>(struct <tag> const* value, unsigned char* out); returns the size, out can be null
+	   int deserialize_<tag>(struct <tag>* value, struct cparse_reader* reader); returns 0 on invalid data
+
+   where the reader allocates the pointed objects through its allocate callback. */
+CPARSE_API void cparse_unit_emit_serializers(struct cparse_unit*, FILE* output);
+
+/* writes C source with a static read-only table of the fields of every struct of the unit, with the offsets and
+   sizes computed for cparse_info::abi, and a perfect hash to look fields up by name:
+
+	   static const struct cparse_field fields_<tag>[]; in declaration order, terminated by a null name
+	   int find_field_<tag>(const char* name, size_t length); index in fields_<tag> or -1
+
+   returns zero if it ran out of memory building a hash, the output then stops before that struct. */
+CPARSE_API int  cparse_unit_emit_reflection(struct cparse_unit*, FILE* output);
+
 #endif // CPARSE_NO_DUMP
 
-#endif CPARSE_H_
+#endif // CPARSE_H_
 
 
 /**************************************************************************************************/
@@ -168,43 +511,148 @@ CPARSE_API void cparse_unit_dump(struct cparse_unit*, FILE* output);
 #ifdef CPARSE_IMPLEMENTATION
 #undef CPARSE_IMPLEMENTATION
 
-#ifndef uint
-#define uint unsigned int
-#endif
-
 #include <setjmp.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
 #include <assert.h>
 
-static int cparse_min(int a, int b) { return a < b ? a : b;}
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <alloca.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#ifndef uint
+#define uint unsigned int
+#endif
+
+#if !defined(CPARSE_NO_STATS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#elif !defined(CPARSE_NO_STATS) && defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+#if !defined(CPARSE_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+typedef __m256i cparse_vec;
+#define CPARSE_VEC_SIZE 32
+#define CPARSE_VEC_MASK 0xffffffffu
+#define cparse_vec_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define cparse_vec_set1(c) _mm256_set1_epi8((char)(c))
+#define cparse_vec_eq(a, b) _mm256_cmpeq_epi8(a, b)
+#define cparse_vec_gt(a, b) _mm256_cmpgt_epi8(a, b)
+#define cparse_vec_or(a, b) _mm256_or_si256(a, b)
+#define cparse_vec_and(a, b) _mm256_and_si256(a, b)
+#define cparse_vec_mask(a) ((uint)_mm256_movemask_epi8(a))
+#elif !defined(CPARSE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+typedef __m128i cparse_vec;
+#define CPARSE_VEC_SIZE 16
+#define CPARSE_VEC_MASK 0xffffu
+#define cparse_vec_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define cparse_vec_set1(c) _mm_set1_epi8((char)(c))
+#define cparse_vec_eq(a, b) _mm_cmpeq_epi8(a, b)
+#define cparse_vec_gt(a, b) _mm_cmpgt_epi8(a, b)
+#define cparse_vec_or(a, b) _mm_or_si128(a, b)
+#define cparse_vec_and(a, b) _mm_and_si128(a, b)
+#define cparse_vec_mask(a) ((uint)_mm_movemask_epi8(a))
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #define CPARSE_TOKENS(_)\
 	_(TOK_FLOAT, "floating point literal")\
 	_(TOK_INTEGER, "integer literal")\
 	_(TOK_IDENTIFIER, "identifier")\
+	_(TOK_STRING, "string literal")\
+	_(TOK_CHAR, "character literal")\
+	_(TOK_MACRO_PARAM, "macro parameter")\
+	_(TOK_ELLIPSIS, "...")\
+	_(TOK_ARROW, "->")\
+	_(TOK_INC, "++")\
+	_(TOK_DEC, "--")\
+	_(TOK_SHL, "<<")\
+	_(TOK_SHR, ">>")\
+	_(TOK_LE, "<=")\
+	_(TOK_GE, ">=")\
+	_(TOK_EQ, "==")\
+	_(TOK_NE, "!=")\
+	_(TOK_AND, "&&")\
+	_(TOK_OR, "||")\
+	_(TOK_MUL_ASSIGN, "*=")\
+	_(TOK_DIV_ASSIGN, "/=")\
+	_(TOK_MOD_ASSIGN, "%=")\
+	_(TOK_ADD_ASSIGN, "+=")\
+	_(TOK_SUB_ASSIGN, "-=")\
+	_(TOK_SHL_ASSIGN, "<<=")\
+	_(TOK_SHR_ASSIGN, ">>=")\
+	_(TOK_AND_ASSIGN, "&=")\
+	_(TOK_XOR_ASSIGN, "^=")\
+	_(TOK_OR_ASSIGN, "|=")\
+	_(TOK_HASHHASH, "##")\
+	_(KW_AUTO, "auto")\
+	_(KW_BREAK, "break")\
+	_(KW_CASE, "case")\
 	_(KW_CHAR, "char")\
 	_(KW_CONST, "const")\
+	_(KW_CONTINUE, "continue")\
+	_(KW_DEFAULT, "default")\
 	_(KW_DO, "do")\
 	_(KW_DOUBLE, "double")\
 	_(KW_ELSE, "else")\
 	_(KW_ENUM, "enum")\
+	_(KW_EXTERN, "extern")\
 	_(KW_FLOAT, "float")\
 	_(KW_FOR, "for")\
+	_(KW_GOTO, "goto")\
 	_(KW_IF, "if")\
+	_(KW_INLINE, "inline")\
 	_(KW_INT, "int")\
 	_(KW_LONG, "long")\
+	_(KW_REGISTER, "register")\
+	_(KW_RESTRICT, "restrict")\
+	_(KW_RETURN, "return")\
 	_(KW_SHORT, "short")\
 	_(KW_SIGNED, "signed")\
+	_(KW_SIZEOF, "sizeof")\
 	_(KW_STATIC, "static")\
 	_(KW_STRUCT, "struct")\
+	_(KW_SWITCH, "switch")\
 	_(KW_TYPEDEF, "typedef")\
+	_(KW_UNION, "union")\
 	_(KW_UNSIGNED, "unsigned")\
+	_(KW_VOID, "void")\
 	_(KW_VOLATILE, "volatile")\
 	_(KW_WHILE, "while")\
+	_(KW_ALIGNAS, "_Alignas")\
+	_(KW_ALIGNOF, "_Alignof")\
+	_(KW_ATOMIC, "_Atomic")\
+	_(KW_BOOL, "_Bool")\
+	_(KW_COMPLEX, "_Complex")\
+	_(KW_GENERIC, "_Generic")\
+	_(KW_IMAGINARY, "_Imaginary")\
+	_(KW_NORETURN, "_Noreturn")\
+	_(KW_STATIC_ASSERT, "_Static_assert")\
+	_(KW_THREAD_LOCAL, "_Thread_local")\
 
 #define CPARSE_MAKE_TOKEN_ENUM(id, str) CPARSE_##id,
 
@@ -219,30 +667,206 @@ typedef int cparse_token_t;
 #undef CPARSE_MAKE_TOKEN_ENUM
 #define CPARSE_MAKE_TOKEN_STR(id, str) case CPARSE_##id: return str;
 
+/* state flags, on top of the cparse_flag bits */
+#define CPARSE_STATE_TRANSIENT_SOURCE (1u << 30) /* the source does not outlive the parse */
+#define CPARSE_STATE_MEASURE (1u << 31) /* track the size of a single buffer parse */
+#define CPARSE_STATE_CACHE (1u << 29) /* look the unit up in and store it to info->cache_dir */
+#define CPARSE_STATE_ERROR_BUFFER (1u << 28) /* the caller set error_buffer, errors do not go to info->buffer */
+#define CPARSE_STATE_STREAM (1u << 27) /* info has callbacks, the arena is rewound after each declaration */
+
 
 struct cparse_lexer {
-	FILE* file;
 	const char* filename;
+	const char* source_end;
+	const char* cursor;
+	const char* line_begin;
 	uint line;
-	uint column;
-	char* token_buffer;
-	uint  token_buffer_capacity;
+	const char* token; /* points to the source, not null terminated */
 	uint  token_size;
-	enum cparse_token lookahead;
+	cparse_token_t lookahead;
 	int curr;
+	bool line_start; /* a newline was crossed since the last token */
+};
+
+/* preprocessing token */
+struct cparse_token {
+	cparse_token_t kind;
+	uint flags; /* CPARSE_TOKEN_* */
+	const char* text; /* not null terminated */
+	uint length;
+	uint param; /* CPARSE_TOK_MACRO_PARAM: parameter index */
+};
+
+#define CPARSE_TOKEN_LINE_START 1u /* first token on its line */
+#define CPARSE_TOKEN_SPACE 2u /* preceded by whitespace */
+#define CPARSE_TOKEN_NO_EXPAND 4u /* names a macro that was being expanded, never expand it again */
+
+struct cparse_macro {
+	const char* name;
+	uint name_length;
+	uint hash;
+	bool defined; /* #undef only clears this, the entry stays in the table */
+	bool function_like;
+	bool variadic; /* the last parameter is __VA_ARGS__ */
+	bool expanding; /* disabled while its expansion is being read */
+	int builtin; /* CPARSE_MACRO_* */
+	uint num_params;
+	uint num_tokens;
+	struct cparse_token* tokens; /* parameters are CPARSE_TOK_MACRO_PARAM tokens */
+};
+
+enum {
+	CPARSE_MACRO_USER,
+	CPARSE_MACRO_FILE,
+	CPARSE_MACRO_LINE,
+};
+
+/* token list being read instead of the file, either a macro expansion or an unread token */
+struct cparse_pp_context {
+	struct cparse_pp_context* prev;
+	struct cparse_token const* tokens;
+	uint count;
+	uint index;
+	struct cparse_macro* macro; /* re-enabled once the context is exhausted */
+	bool boundary; /* reads past the end return end-of-file, used to expand token lists in isolation */
+	struct cparse_token single;
+};
+
+struct cparse_pp_conditional {
+	struct cparse_pp_conditional* prev;
+	bool taken; /* one of the groups was included */
+	bool has_else;
+};
+
+/* state of an includer while an included file is read */
+struct cparse_pp_include {
+	struct cparse_pp_include* prev;
+	struct cparse_lexer lex;
+	struct cparse_pp_conditional* conditionals;
+	int dir_index;
+};
+
+/* an included file, recorded to validate cached units */
+struct cparse_pp_dependency {
+	struct cparse_pp_dependency* next;
+	const char* path;
+	uint64_t hash;
+};
+
+struct cparse_pp_once {
+	struct cparse_pp_once* next;
+	const char* path;
+	uint hash;
+};
+
+struct cparse_preprocessor {
+	struct cparse_macro** macros; /* open-addressing hash table */
+	uint macros_capacity; /* zero or a power of two */
+	uint macros_count;
+	struct cparse_pp_context* context;
+	struct cparse_pp_context* free_contexts;
+	struct cparse_pp_include* include;
+	uint include_depth;
+	int dir_index; /* include_dirs entry the current file was found in, or -1 */
+	struct cparse_pp_conditional* conditionals;
+	struct cparse_pp_source* sources;
+	struct cparse_pp_once* once;
+	struct cparse_pp_dependency* dependencies; /* CPARSE_STATE_CACHE only */
+	bool rewritten; /* a directive ran or a macro was expanded, tokens no longer map to the source */
+};
+
+/* size and alignment of the primitive types and of pointers */
+struct cparse_abi_layout {
+	unsigned char primitives[CPARSE_PRIMITIVE_TYPE_COUNT_][2];
+	unsigned char pointer[2];
+};
+
+static const struct cparse_abi_layout cparse_abi_layouts[CPARSE_ABI_COUNT_] = {
+	/* char, signed char, unsigned char, short, unsigned short, int, unsigned int, long, unsigned long, long long,
+	   unsigned long long, float, double, long double, bool, void */
+	{ { {1,1}, {1,1}, {1,1}, {2,2}, {2,2}, {4,4}, {4,4}, {8,8}, {8,8}, {8,8}, {8,8}, {4,4}, {8,8}, {16,16}, {1,1}, {0,0} }, {8,8} },
+	{ { {1,1}, {1,1}, {1,1}, {2,2}, {2,2}, {4,4}, {4,4}, {4,4}, {4,4}, {8,4}, {8,4}, {4,4}, {8,4}, {12,4}, {1,1}, {0,0} }, {4,4} },
+	{ { {1,1}, {1,1}, {1,1}, {2,2}, {2,2}, {4,4}, {4,4}, {8,8}, {8,8}, {8,8}, {8,8}, {4,4}, {8,8}, {16,16}, {1,1}, {0,0} }, {8,8} },
+	{ { {1,1}, {1,1}, {1,1}, {2,2}, {2,2}, {4,4}, {4,4}, {4,4}, {4,4}, {8,8}, {8,8}, {4,4}, {8,8}, {8,8}, {1,1}, {0,0} }, {8,8} },
+};
+
+struct cparse_incomplete_type {
+	struct cparse_incomplete_type* next;
+	struct cparse_type_struct* type;
+};
+
+/* what makes two types the same, see cparse_type_table */
+struct cparse_type_key {
+	enum cparse_type_kind kind;
+	enum cparse_type_qualifier qualifiers;
+	const void* target; /* pointee or element type, struct or enum decl */
+	int value; /* primitive kind or array extent */
+};
+
+struct cparse_type_slot {
+	uint hash;
+	struct cparse_type* type;
+};
+
+/* open-addressing hash-consing table of the types of a parse, identical types are a single node */
+struct cparse_type_table {
+	struct cparse_type_slot* slots;
+	uint capacity; /* zero or a power of two */
+	uint count;
+};
+
+/* header of a block chained to the buffer */
+struct cparse_block {
+	struct cparse_block* next;
+	cparse_size_t size;
+};
+
+/* allocation position, the fields of the same name in cparse_state */
+struct cparse_arena {
+	char* alloc_begin;
+	char* alloc_end;
+	char* alloc_cursor;
+	cparse_size_t alloc_retired;
+	struct cparse_block* blocks;
 };
 
 struct cparse_state {
 	struct cparse_context* context;
+	struct cparse_info const* info;
 	jmp_buf error_handler;
-	char* alloc_begin;
+	char* alloc_begin; /* current block */
 	char* alloc_end;
 	char* alloc_cursor;
-	char const* error;
+	cparse_size_t alloc_retired; /* bytes used in the buffer and blocks before the current one */
+	struct cparse_block* blocks; /* chained blocks, most recent first */
+	struct cparse_arena stream_arena; /* CPARSE_STATE_STREAM: the arena that is not in use, see cparse_arena_swap */
+	cparse_size_t measured_size; /* CPARSE_STATE_MEASURE: size a single buffer would need */
+	uint measured_alignment;
+	char* error_buffer; /* where cparse_error writes the message, info->buffer unless CPARSE_STATE_ERROR_BUFFER */
+	cparse_size_t error_buffer_size;
+	uint flags;
 	struct cparse_lexer lex;
+	const char* source; /* main file, span offsets are relative to it */
+	struct cparse_preprocessor pp;
+	struct cparse_unit* unit;
+	uint64_t cache_key; /* CPARSE_STATE_CACHE only */
+	struct cparse_abi_layout const* abi;
+	struct cparse_decl_struct* defining; /* struct whose fields are being parsed */
+	struct cparse_incomplete_type* incomplete_types; /* struct types to lay out once their struct is defined */
+	struct cparse_incomplete_type* stream_incomplete_types; /* CPARSE_STATE_STREAM: those of the typedefs kept */
+	struct cparse_type_table types;
+	bool linked; /* a definition completed a forward declaration made by another top-level declaration */
+	bool typedefs_changed; /* a typedef was parsed, the declarations after it may read differently */
+	jmp_buf* recover_handler; /* CPARSE_FLAG_RECOVER: where cparse_error resumes, null outside declarations */
+	bool lexing; /* errors while reading a token cannot be recovered from */
+	struct cparse_diagnostic** last_diagnostic;
+	struct cparse_decl_struct* completing; /* CPARSE_STATE_STREAM: stub of the struct whose definition is being parsed */
+	struct cparse_stats* stats; /* info->stats, see cparse_stats_enabled */
+	uint64_t lex_ticks; /* stats only, spent in cparse_lex minus opening included files */
+	uint64_t open_ticks;
 };
 
-static const char* cparse_strtok(cparse_token_t tok)
+static const char* cparse_strtok(cparse_token_t tok, char buffer[2])
 {
 	switch (tok)
 	{
@@ -250,33 +874,14 @@ static const char* cparse_strtok(cparse_token_t tok)
 			CPARSE_TOKENS(CPARSE_MAKE_TOKEN_STR)
 
 		default:
-			{
-				static union
-				{
-					int tok;
-					char chars[8];
-				} helper;
-				helper.tok = tok;
-				return helper.chars;
-			}
+			/* single character tokens are their own code, spelled in the caller buffer so that parses on
+			   different threads do not share it */
+			buffer[0] = (char)tok;
+			buffer[1] = 0;
+			return buffer;
 	}
 }
 
-static struct cparse_decl* cparse_decl_find(struct cparse_decl* first, const char* spelling)
-{
-	for (struct cparse_decl* decl = first; decl; decl = decl->next)
-		if (strcmp(decl->spelling, spelling) == 0)
-			return decl;
-	return NULL;
-}
-
-static struct cparse_decl_variable_field* cparse_struct_find_field(struct cparse_decl_struct* s, const char* spelling)
-{
-	struct cparse_decl* decl = cparse_decl_find((struct cparse_decl*)s->fields, spelling);
-	assert(!decl || decl->kind == CPARSE_DECL_FIELD);
-	return (struct cparse_decl_variable_field*)decl;
-}
-
 static size_t cparse_formatv(char* buffer, size_t buffer_size, const char* format, va_list args)
 {
 	--buffer_size;
@@ -293,10 +898,22 @@ static size_t cparse_formatv(char* buffer, size_t buffer_size, const char* forma
 					break;
 
 				case 'c':
-					buffer[cur] = va_arg(args, char);
+					buffer[cur] = (char)va_arg(args, int);
 					increment_cur();
 					break;
 
+				case '.': { /* only "%.*s" */
+					assert(format[1] == '*' && format[2] == 's');
+					format += 2;
+					int n = va_arg(args, int);
+					const char* str = va_arg(args, const char*);
+					for (int i = 0; i < n; ++i) {
+						buffer[cur] = str[i];
+						increment_cur();
+					}
+					break;
+				}
+
 				case 's': {
 					const char* str = va_arg(args, const char*);
 					for (const char* ch = str; *ch; ++ch) {
@@ -344,27 +961,44 @@ static size_t cparse_format(char* buffer, size_t buffer_size, const char* format
 	return result;
 }
 
+static uint cparse_lex_column(struct cparse_lexer const* l)
+{
+	const char* position = l->curr < 0 ? l->cursor : l->cursor - 1;
+	return (uint)(position - l->line_begin) + 1;
+}
+
+static void cparse_diagnostic_add(struct cparse_state* s, enum cparse_result code, const char* message, size_t length);
+
 static void cparse_error(struct cparse_state* s, enum cparse_result result, const char* format, ...)
 {
 	va_list args;
-	
-	int buffer_size = 1;
-	char* buffer = alloca(buffer_size);
+	char dummy;
 
-retry:
+	/* measure first, arguments might point into the buffer the message is written to */
 	va_start(args, format);
-	int written = cparse_format(buffer, buffer_size, "at %s:%u:%u: error: ", s->lex.filename, s->lex.line, s->lex.column);
-	written += cparse_formatv(buffer + written, buffer_size - written, format, args);
+	const size_t message_length = cparse_formatv(&dummy, 1, format, args);
 	va_end(args);
 
-	if (written >= buffer_size)
-	{
-		buffer = alloca(written + 1);
-		buffer_size = written + 1;
-		goto retry;
+	char* message = alloca(message_length + 1);
+	va_start(args, format);
+	cparse_formatv(message, message_length + 1, format, args);
+	va_end(args);
+
+	if (s->recover_handler && !s->lexing && (result == CPARSE_RESULT_SYNTAX_ERROR || result == CPARSE_RESULT_SEMANTIC_ERROR)) {
+		cparse_diagnostic_add(s, result, message, message_length);
+		longjmp(*s->recover_handler, 1);
 	}
 
-	memcpy(s->alloc_begin, buffer, cparse_min(s->alloc_end - s->alloc_begin, written + 1));
+	const size_t length = cparse_format(&dummy, 1, "at %s:%u:%u: error: %s", s->lex.filename, s->lex.line, cparse_lex_column(&s->lex), message);
+	char* buffer = alloca(length + 1);
+	cparse_format(buffer, length + 1, "at %s:%u:%u: error: %s", s->lex.filename, s->lex.line, cparse_lex_column(&s->lex), message);
+
+	size_t capacity = s->error_buffer ? s->error_buffer_size : 0;
+	if (capacity) {
+		size_t n = length + 1 < capacity ? length + 1 : capacity;
+		memcpy(s->error_buffer, buffer, n);
+		s->error_buffer[n - 1] = 0;
+	}
 
 	longjmp(s->error_handler, result);
 }
@@ -374,736 +1008,6596 @@ static void cparse_error_out_of_memory(struct cparse_state* s)
 	cparse_error(s, CPARSE_RESULT_OUT_OF_MEMORY, "Out of memory.");
 }
 
-static void* cparse_alloc(struct cparse_state* s, cparse_size_t size, uint alignment)
+static char* cparse_align(char* ptr, uint alignment)
+{
+	return (char*)(((uintptr_t)ptr + (alignment - 1)) & ~(uintptr_t)(alignment - 1));
+}
+
+/* chains a new block big enough for the allocation, or fails if the buffer cannot grow */
+static void* cparse_alloc_grow(struct cparse_state* s, cparse_size_t size, uint alignment)
 {
-	const uint alignment_minus_one = alignment - 1;
-	char* ptr = (char*)(((uintptr_t)s->alloc_cursor + alignment_minus_one) & ~alignment_minus_one);
-	char* end = ptr + size;
-	if (end > s->alloc_end) {
+	struct cparse_info const* info = s->info;
+	if (!info->allocate)
 		cparse_error_out_of_memory(s);
-	}
-	s->alloc_cursor = end;
+
+	/* grow geometrically so that the number of blocks stays logarithmic */
+	cparse_size_t block_size = s->blocks ? s->blocks->size * 2 : info->buffer_size;
+	cparse_size_t min_size = sizeof(struct cparse_block) + size + alignment;
+	if (block_size < min_size)
+		block_size = min_size;
+	if (block_size < 4096)
+		block_size = 4096;
+
+	struct cparse_block* block = info->allocate(info->allocator_user_data, block_size);
+	if (!block)
+		cparse_error_out_of_memory(s);
+
+	block->next = s->blocks;
+	block->size = block_size;
+	s->blocks = block;
+
+	s->alloc_retired += (cparse_size_t)(s->alloc_cursor - s->alloc_begin);
+	s->alloc_begin = (char*)block;
+	s->alloc_end = s->alloc_begin + block_size;
+	s->alloc_cursor = s->alloc_begin + sizeof(struct cparse_block);
+
+	char* ptr = cparse_align(s->alloc_cursor, alignment);
+	s->alloc_cursor = ptr + size;
 	return ptr;
 }
 
-#define cparse_alloc_type(s, type) ((type*)cparse_alloc(s, sizeof(type), __alignof(type)))
+static void* cparse_default_allocate(void* user_data, cparse_size_t size)
+{
+	(void)user_data;
+	return malloc(size);
+}
 
-/* lexer */
-static int cparse_lex_skip(struct cparse_state* s)
+static void cparse_default_deallocate(void* user_data, void* block)
 {
-	struct cparse_lexer* l = &s->lex;
-	++l->column; 
-	if (l->curr == '\n') {
-		l->column = 0;
-		++l->line;
-	}
-	l->curr = fgetc(l->file);
-	return l->curr;
+	(void)user_data;
+	free(block);
 }
 
-static int cparse_lex_push(struct cparse_state* s)
+static void cparse_release_blocks(struct cparse_block* block, struct cparse_info const* info)
 {
-	struct cparse_lexer* l = &s->lex;
-	if (l->token_buffer + l->token_size + 1 == s->alloc_end) {
-		char* newbuf = s->alloc_end - l->token_size * 2 + 1;
-		if (newbuf <= s->alloc_cursor) {
-			cparse_error_out_of_memory(s);
-		}
-		memmove(newbuf, l->token_buffer, l->token_size + 1);
+	/* scratch and cparse_files blocks come from malloc when the caller has no allocator */
+	void (*deallocate)(void*, void*) = info->deallocate ? info->deallocate : cparse_default_deallocate;
+	while (block) {
+		struct cparse_block* next = block->next;
+		deallocate(info->allocator_user_data, block);
+		block = next;
 	}
-	l->token_buffer[l->token_size++] = (char)l->curr;
-	l->token_buffer[l->token_size] = 0;
-	return cparse_lex_skip(s);
 }
 
-static bool cparse_lex_accept(struct cparse_state* s, const char* keyword)
+static void* cparse_alloc(struct cparse_state* s, cparse_size_t size, uint alignment)
 {
-	struct cparse_lexer* l = &s->lex;
-	while (*keyword && l->curr == *keyword) {
-		cparse_lex_push(s);
-		++keyword;
+	if (s->flags & CPARSE_STATE_MEASURE) {
+		s->measured_size = ((s->measured_size + (alignment - 1)) & ~(cparse_size_t)(alignment - 1)) + size;
+		s->measured_alignment = alignment > s->measured_alignment ? alignment : s->measured_alignment;
+	}
+
+	char* ptr = cparse_align(s->alloc_cursor, alignment);
+	if (ptr + size > s->alloc_end || ptr < s->alloc_cursor) {
+		return cparse_alloc_grow(s, size, alignment);
 	}
-	return *keyword == 0;
+	s->alloc_cursor = ptr + size;
+	return ptr;
 }
 
-static bool cparse_lex_accept_c(struct cparse_state* s, char ch)
+#define cparse_alloc_type(s, type) ((type*)cparse_alloc(s, sizeof(type), __alignof(type)))
+
+static struct cparse_arena cparse_arena_mark(struct cparse_state const* s)
 {
-	if (s->lex.curr == ch)
-	{
-		cparse_lex_push(s);
-		return true;
-	}
-	return false;
+	struct cparse_arena mark;
+	mark.alloc_begin = s->alloc_begin;
+	mark.alloc_end = s->alloc_end;
+	mark.alloc_cursor = s->alloc_cursor;
+	mark.alloc_retired = s->alloc_retired;
+	mark.blocks = s->blocks;
+	return mark;
 }
 
-static bool cparse_lex_is_identifier_char(int ch, bool first)
+static void cparse_arena_set(struct cparse_state* s, struct cparse_arena const* arena)
 {
-	return	(ch >= 'a' && ch <= 'z') ||
-			(ch >= 'A' && ch <= 'Z') ||
-			(ch == '_') ||
-			(!first && ch >= '0' && ch <= '9');
+	s->alloc_begin = arena->alloc_begin;
+	s->alloc_end = arena->alloc_end;
+	s->alloc_cursor = arena->alloc_cursor;
+	s->alloc_retired = arena->alloc_retired;
+	s->blocks = arena->blocks;
 }
 
-static cparse_token_t cparse_lex(struct cparse_state* s)
+/* frees everything allocated since mark, handing back the blocks chained in the meantime */
+static void cparse_arena_rewind(struct cparse_state* s, struct cparse_arena const* mark)
 {
-	struct cparse_lexer* l = &s->lex;
-	l->lookahead = CPARSE_TOK_EOF;
-	l->token_size = 0;
+	struct cparse_block* blocks = s->blocks;
+	while (blocks != mark->blocks) {
+		struct cparse_block* next = blocks->next;
+		blocks->next = NULL;
+		cparse_release_blocks(blocks, s->info);
+		blocks = next;
+	}
+	cparse_arena_set(s, mark);
+}
 
-	for (;;) {
-		switch (l->curr)
-		{
-			case -1:
-				return CPARSE_TOK_EOF;
+/* CPARSE_STATE_STREAM: exchanges the arena rewound after each declaration with the one the state that outlives
+   declarations (macros, includes, tags) is allocated from. called in pairs around such allocations. */
+static void cparse_arena_swap(struct cparse_state* s)
+{
+	if (!(s->flags & CPARSE_STATE_STREAM))
+		return;
 
-			case '\n': case '\r': case ' ': case '\t':
-				cparse_lex_skip(s);
-				continue;
+	struct cparse_arena other = s->stream_arena;
+	s->stream_arena = cparse_arena_mark(s);
+	cparse_arena_set(s, &other);
+}
 
-			case ',': case ';': case '(': case ')': case '[': case ']': case '{': case '}': case ':':
-			case '*': case '&':
-				l->lookahead = l->curr;
-				cparse_lex_push(s);
-				return l->lookahead;
+/* stats */
 
-			case '.':
-				l->lookahead = l->curr;
-				cparse_lex_push(s);
-				if (l->curr < '0' || l->curr > '9')
-					return l->lookahead;
-				goto parse_exponent;
+#ifndef CPARSE_NO_STATS
+#define cparse_stats_enabled(s) ((s)->stats != NULL)
+#else
+#define cparse_stats_enabled(s) false
+#endif
 
-			case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
-				cparse_lex_push(s);
-				for (;;) {
-					if (l->curr == '.') {
-						cparse_lex_push(s);
-						goto parse_exponent;
-					}
-					else if (l->curr >= '0' && l->curr <= '9') {
-						cparse_lex_push(s);
-					}
-					else {
-						break;
-					}
-				}
-				return l->lookahead = CPARSE_TOK_INTEGER;
+static double cparse_wall_clock(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#elif defined(TIME_UTC)
+	/* strict iso c hides the posix clocks, the c11 one is not monotonic but the stats only take differences */
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
 
-			parse_exponent:
-				while (l->curr >= '0' && l->curr <= '9') {
-					cparse_lex_push(s);
-				}
-				return l->lookahead = CPARSE_TOK_FLOAT;
+/* cheap enough to read around every token, scaled to seconds against the wall clock once the parse is over */
+static uint64_t cparse_ticks(void)
+{
+#if !defined(CPARSE_NO_STATS) && (defined(__x86_64__) || defined(__i386__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))))
+	return __rdtsc();
+#else
+	return (uint64_t)(cparse_wall_clock() * 1e9);
+#endif
+}
 
-			case 'c':
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
-				if (cparse_lex_accept_c(s, 'h'))
-				{
-					if (cparse_lex_accept(s, "ar"))
-					{
-						l->lookahead = CPARSE_KW_CHAR;
-					}
-				}
-				else if (cparse_lex_accept(s, "onst"))
-				{
-					l->lookahead = CPARSE_KW_CONST;
-				}
-				goto parse_identifier;
+#ifndef CPARSE_NO_STATS
+static void cparse_stats_begin(struct cparse_state* s)
+{
+	memset(s->stats, 0, sizeof(struct cparse_stats));
+	s->lex_ticks = 0;
+	s->open_ticks = 0;
+}
+#else
+static inline void cparse_stats_begin(struct cparse_state* s) { (void)s; }
+#endif
 
-			case 'd':
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
-				if (cparse_lex_accept_c(s, 'o')) {
-					l->lookahead = CPARSE_KW_DO;
-					if (cparse_lex_accept_c(s, 'o'))
-					{
-						l->lookahead = CPARSE_KW_DOUBLE;
-					}
-				}
-				goto parse_identifier;
+/* cparse_stats::tokens_by_kind is indexed by the token codes from CPARSE_TOK_FLOAT on, then by the single character
+   tokens in this order */
+static const char cparse_single_char_tokens[] = "!#%&()*+,-./:;<=>?[]^{|}~";
 
-			case 'e':
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
-				if (cparse_lex_accept_c(s, 'l'))
-				{
-					if (cparse_lex_accept(s, "se"))
-					{
-						l->lookahead = CPARSE_KW_ELSE;
-					}
-				}
-				else if (cparse_lex_accept_c(s, 'n'))
-				{
-					if (cparse_lex_accept(s, "um"))
-					{
-						l->lookahead = CPARSE_KW_ENUM;
-					}
-				}
-				goto parse_identifier;
+#define CPARSE_NUM_CODED_TOKENS (CPARSE_KW_THREAD_LOCAL - CPARSE_TOK_FLOAT + 1)
 
-			case 'f':
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
-				if (cparse_lex_accept_c(s, 'o'))
-				{
-					if (cparse_lex_accept_c(s, 'r'))
-					{
-						l->lookahead = CPARSE_KW_FOR;
-					}
-				}
-				else if (cparse_lex_accept_c(s, 'l'))
-				{
-					if (cparse_lex_accept(s, "oat"))
-					{
-						l->lookahead = CPARSE_KW_FLOAT;
-					}
-				}
-				goto parse_identifier;
+typedef char cparse_token_kind_count_check[CPARSE_TOKEN_KIND_COUNT == CPARSE_NUM_CODED_TOKENS + sizeof(cparse_single_char_tokens) - 1 ? 1 : -1];
 
-			case 'i':
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
-				if (cparse_lex_accept_c(s, 'f'))
-				{
-					l->lookahead = CPARSE_KW_IF;
-				}
-				else if (cparse_lex_accept_c(s, 'n'))
-				{
-					if (cparse_lex_accept_c(s, 't'))
-					{
-						l->lookahead = CPARSE_KW_INT;
-					}
-				}
-				goto parse_identifier;
+static uint cparse_token_kind(cparse_token_t tok)
+{
+	if (tok >= CPARSE_TOK_FLOAT && tok <= CPARSE_KW_THREAD_LOCAL)
+		return (uint)(tok - CPARSE_TOK_FLOAT);
+	const char* single = memchr(cparse_single_char_tokens, tok, sizeof(cparse_single_char_tokens) - 1);
+	assert(single);
+	return CPARSE_NUM_CODED_TOKENS + (uint)(single - cparse_single_char_tokens);
+}
 
-			case 'l':
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
-				if (cparse_lex_accept(s, "ong"))
-				{
-					l->lookahead = CPARSE_KW_LONG;
-				}
-				goto parse_identifier;
+CPARSE_API const char* cparse_token_kind_spelling(int kind)
+{
+	static const char single_char_spellings[][2] = {
+		"!", "#", "%", "&", "(", ")", "*", "+", ",", "-", ".", "/", ":", ";", "<", "=", ">", "?", "[", "]", "^", "{", "|", "}", "~",
+	};
+
+	if (kind < 0 || kind >= CPARSE_TOKEN_KIND_COUNT)
+		return NULL;
+	if (kind >= CPARSE_NUM_CODED_TOKENS)
+		return single_char_spellings[kind - CPARSE_NUM_CODED_TOKENS];
+	char buffer[2];
+	return cparse_strtok(CPARSE_TOK_FLOAT + kind, buffer);
+}
 
-			case 's':
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
-				if (cparse_lex_accept_c(s, 't')) {
-					if (cparse_lex_accept_c(s, 'r')) {
-						if (cparse_lex_accept(s, "uct"))
-						{
-							l->lookahead = CPARSE_KW_STRUCT;
-						}
-					}
-					else if (cparse_lex_accept(s, "atic"))
-					{
-						l->lookahead = CPARSE_KW_STATIC;
-					}
-				}
-				else if (cparse_lex_accept_c(s, 'h'))
-				{
-					if (cparse_lex_accept(s, "ort"))
-					{
-						l->lookahead = CPARSE_KW_SHORT;
-					}
-				}
-				else if (cparse_lex_accept(s, "igned"))
-				{
-					l->lookahead = CPARSE_KW_SIGNED;
+/* the arena used by both sides of a streamed parse */
+static void cparse_stats_high_water(struct cparse_state* s)
+{
+	cparse_size_t in_use = s->alloc_retired + (cparse_size_t)(s->alloc_cursor - s->alloc_begin);
+	in_use += s->stream_arena.alloc_retired + (cparse_size_t)(s->stream_arena.alloc_cursor - s->stream_arena.alloc_begin);
+	if (in_use > s->stats->arena_high_water)
+		s->stats->arena_high_water = in_use;
+}
+
+static void cparse_stats_end(struct cparse_state* s, double wall_begin, uint64_t ticks_begin)
+{
+	const double wall = cparse_wall_clock() - wall_begin;
+	const uint64_t ticks = cparse_ticks() - ticks_begin;
+	const double seconds_per_tick = ticks ? wall / (double)ticks : 0.0;
+
+	cparse_stats_high_water(s);
+
+	s->stats->lex_seconds = (double)s->lex_ticks * seconds_per_tick;
+	s->stats->open_seconds = (double)s->open_ticks * seconds_per_tick;
+	s->stats->parse_seconds = wall - s->stats->lex_seconds - s->stats->open_seconds;
+	if (s->stats->parse_seconds < 0.0)
+		s->stats->parse_seconds = 0.0;
+}
+
+/* symbol tables */
+
+static uint cparse_hash(const char* str, uint length)
+{
+	/* FNV-1a */
+	uint hash = 2166136261u;
+	for (uint i = 0; i < length; ++i)
+		hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+	return hash;
+}
+
+#define CPARSE_CACHE_MAGIC 0x31435043u /* "CPC1", also seeds the content hashes */
+
+/* fast non-cryptographic 64-bit hash, 8 bytes per step */
+static uint64_t cparse_hash64(uint64_t hash, const void* data, size_t size)
+{
+	const unsigned char* p = data;
+	for (; size >= 8; p += 8, size -= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+		hash ^= hash >> 29;
+	}
+	for (; size; ++p, --size)
+		hash = (hash ^ *p) * 0x100000001b3ull;
+	return hash;
+}
+
+static void cparse_symbol_table_init(struct cparse_symbol_table* table)
+{
+	table->symbols = NULL;
+	table->capacity = 0;
+	table->count = 0;
+}
+
+static struct cparse_symbol* cparse_symbol_table_probe(struct cparse_symbol_table const* table, uint hash, const char* spelling, int length)
+{
+	const uint mask = table->capacity - 1;
+	for (uint i = hash & mask;; i = (i + 1) & mask) {
+		struct cparse_symbol* symbol = table->symbols + i;
+		if (!symbol->decl)
+			return symbol;
+		if (symbol->hash == hash && symbol->decl->spelling_length == length && memcmp(symbol->decl->spelling, spelling, length) == 0)
+			return symbol;
+	}
+}
+
+static struct cparse_decl* cparse_symbol_table_find(struct cparse_symbol_table const* table, const char* spelling, int length)
+{
+	if (!table->count)
+		return NULL;
+	return cparse_symbol_table_probe(table, cparse_hash(spelling, length), spelling, length)->decl;
+}
+
+/* removes decl if it is in the table, shifting back the entries that probed past it */
+static void cparse_symbol_table_remove(struct cparse_symbol_table* table, struct cparse_decl const* decl)
+{
+	if (!table->count)
+		return;
+
+	struct cparse_symbol* symbol = cparse_symbol_table_probe(table, cparse_hash(decl->spelling, decl->spelling_length), decl->spelling, decl->spelling_length);
+	if (symbol->decl != decl)
+		return;
+
+	const uint mask = table->capacity - 1;
+	uint hole = (uint)(symbol - table->symbols);
+	for (uint i = (hole + 1) & mask; table->symbols[i].decl; i = (i + 1) & mask) {
+		/* an entry can fill the hole unless its home slot lies between the hole and itself */
+		const uint home = table->symbols[i].hash & mask;
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			table->symbols[hole] = table->symbols[i];
+			hole = i;
+		}
+	}
+
+	table->symbols[hole].hash = 0;
+	table->symbols[hole].decl = NULL;
+	--table->count;
+}
+
+/* inserts decl and returns null, or returns the decl with the same spelling already in the table */
+static struct cparse_decl* cparse_symbol_table_insert(struct cparse_state* s, struct cparse_symbol_table* table, struct cparse_decl* decl)
+{
+	/* keep the load factor under 3/4, the old array is simply left behind in the buffer */
+	if ((table->count + 1) * 4 > table->capacity * 3) {
+		struct cparse_symbol_table grown;
+		grown.capacity = table->capacity ? table->capacity * 2 : 8;
+		grown.count = table->count;
+		grown.symbols = cparse_alloc(s, grown.capacity * sizeof(struct cparse_symbol), __alignof(struct cparse_symbol));
+		memset(grown.symbols, 0, grown.capacity * sizeof(struct cparse_symbol));
+
+		for (int i = 0; i < table->capacity; ++i) {
+			struct cparse_symbol* symbol = table->symbols + i;
+			if (symbol->decl)
+				*cparse_symbol_table_probe(&grown, symbol->hash, symbol->decl->spelling, symbol->decl->spelling_length) = *symbol;
+		}
+
+		*table = grown;
+	}
+
+	const uint hash = cparse_hash(decl->spelling, decl->spelling_length);
+	struct cparse_symbol* symbol = cparse_symbol_table_probe(table, hash, decl->spelling, decl->spelling_length);
+	if (symbol->decl)
+		return symbol->decl;
+
+	symbol->hash = hash;
+	symbol->decl = decl;
+	++table->count;
+	return NULL;
+}
+
+/* type tables */
+
+static void cparse_type_table_init(struct cparse_type_table* table)
+{
+	table->slots = NULL;
+	table->capacity = 0;
+	table->count = 0;
+}
+
+static uint cparse_type_key_hash(struct cparse_type_key const* key)
+{
+	uint64_t hash = ((uint64_t)(uintptr_t)key->target >> 3) ^ ((uint64_t)key->kind << 56) ^ ((uint64_t)key->qualifiers << 48) ^ (uint)key->value;
+	hash *= 0x9e3779b97f4a7c15ull;
+	return (uint)(hash >> 32);
+}
+
+static bool cparse_type_matches(struct cparse_type const* type, struct cparse_type_key const* key)
+{
+	if (type->kind != key->kind || type->qualifiers != key->qualifiers)
+		return false;
+
+	switch (type->kind) {
+		case CPARSE_TYPE_PRIMITIVE: return (int)((struct cparse_type_primitive const*)type)->kind == key->value;
+		case CPARSE_TYPE_POINTER: return ((struct cparse_type_pointer const*)type)->pointee_type == key->target;
+		case CPARSE_TYPE_ARRAY: return ((struct cparse_type_array const*)type)->element_type == key->target && ((struct cparse_type_array const*)type)->extent == key->value;
+		case CPARSE_TYPE_STRUCT: return ((struct cparse_type_struct const*)type)->struct_type == key->target;
+		case CPARSE_TYPE_ENUM: return ((struct cparse_type_enum const*)type)->enum_type == key->target;
+	}
+	return false;
+}
+
+static struct cparse_type_slot* cparse_type_table_probe(struct cparse_type_table const* table, uint hash, struct cparse_type_key const* key)
+{
+	const uint mask = table->capacity - 1;
+	for (uint i = hash & mask;; i = (i + 1) & mask) {
+		struct cparse_type_slot* slot = table->slots + i;
+		if (!slot->type || (slot->hash == hash && cparse_type_matches(slot->type, key)))
+			return slot;
+	}
+}
+
+/* returns the slot of the type identical to key: either it holds the type already, or the new node is to be stored
+   in it before the next lookup */
+static struct cparse_type_slot* cparse_type_table_intern(struct cparse_state* s, struct cparse_type_key const* key)
+{
+	struct cparse_type_table* table = &s->types;
+
+	/* keep the load factor under 3/4, the old array is simply left behind in the buffer */
+	if ((table->count + 1) * 4 > table->capacity * 3) {
+		struct cparse_type_table grown;
+		grown.capacity = table->capacity ? table->capacity * 2 : 16;
+		grown.count = table->count;
+		grown.slots = cparse_alloc(s, grown.capacity * sizeof(struct cparse_type_slot), __alignof(struct cparse_type_slot));
+		memset(grown.slots, 0, grown.capacity * sizeof(struct cparse_type_slot));
+
+		const uint mask = grown.capacity - 1;
+		for (uint i = 0; i < table->capacity; ++i) {
+			struct cparse_type_slot* slot = table->slots + i;
+			if (!slot->type)
+				continue;
+			uint j = slot->hash & mask;
+			while (grown.slots[j].type)
+				j = (j + 1) & mask;
+			grown.slots[j] = *slot;
+		}
+
+		*table = grown;
+	}
+
+	const uint hash = cparse_type_key_hash(key);
+	struct cparse_type_slot* slot = cparse_type_table_probe(table, hash, key);
+	if (!slot->type) {
+		slot->hash = hash;
+		++table->count;
+	}
+	return slot;
+}
+
+/* contexts */
+
+#ifdef _MSC_VER
+#define cparse_atomic_fetch_add(value, n) InterlockedExchangeAdd(value, n)
+#define cparse_atomic_load_ptr(ptr) (*(void* volatile*)(ptr))
+#define cparse_atomic_cas_ptr(ptr, expected, desired) (InterlockedCompareExchangePointer((void* volatile*)(ptr), desired, expected) == (void*)(expected))
+#else
+#define cparse_atomic_fetch_add(value, n) __atomic_fetch_add(value, n, __ATOMIC_RELAXED)
+#define cparse_atomic_load_ptr(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define cparse_atomic_cas_ptr(ptr, expected, desired) __sync_bool_compare_and_swap(ptr, expected, desired)
+#endif
+
+#define CPARSE_CONTEXT_BUCKETS (1 << 16)
+#define CPARSE_CONTEXT_CHUNK_SIZE (1 << 16)
+
+/* an interned string, followed by its null terminated characters. never changes once published in its bucket. */
+struct cparse_context_string {
+	struct cparse_context_string* next; /* same bucket, most recent first */
+	uint hash;
+	int length;
+};
+
+struct cparse_context_chunk {
+	struct cparse_context_chunk* next;
+	long size;
+	volatile long used;
+};
+
+/* buckets are only ever prepended to with a compare and swap, so lookups take no lock and a string that loses a race
+   to an equal one is just left unused in its chunk */
+struct cparse_context {
+	void* (*allocate)(void* user_data, cparse_size_t size);
+	void (*deallocate)(void* user_data, void* block);
+	void* allocator_user_data;
+	struct cparse_context_chunk* volatile chunks; /* most recent first, strings are bumped from the first one */
+	struct cparse_context_string* volatile buckets[CPARSE_CONTEXT_BUCKETS];
+};
+
+CPARSE_API struct cparse_context* cparse_context_create(struct cparse_info const* info)
+{
+	void* (*allocate)(void*, cparse_size_t) = info && info->allocate ? info->allocate : cparse_default_allocate;
+	struct cparse_context* c = allocate(info ? info->allocator_user_data : NULL, sizeof(struct cparse_context));
+	if (!c)
+		return NULL;
+
+	c->allocate = allocate;
+	c->deallocate = info && info->allocate ? info->deallocate : cparse_default_deallocate;
+	c->allocator_user_data = info ? info->allocator_user_data : NULL;
+	c->chunks = NULL;
+	memset((void*)c->buckets, 0, sizeof(c->buckets));
+	return c;
+}
+
+CPARSE_API void cparse_context_destroy(struct cparse_context* c)
+{
+	if (!c)
+		return;
+
+	struct cparse_context_chunk* chunk = c->chunks;
+	while (chunk) {
+		struct cparse_context_chunk* next = chunk->next;
+		c->deallocate(c->allocator_user_data, chunk);
+		chunk = next;
+	}
+	c->deallocate(c->allocator_user_data, c);
+}
+
+static void* cparse_context_alloc(struct cparse_context* c, long size)
+{
+	size = (size + 7) & ~7L;
+	for (;;) {
+		struct cparse_context_chunk* chunk = cparse_atomic_load_ptr(&c->chunks);
+		if (chunk) {
+			const long offset = cparse_atomic_fetch_add(&chunk->used, size);
+			if (offset + size <= chunk->size)
+				return (char*)(chunk + 1) + offset;
+		}
+
+		/* the chunk is full, chain a new one unless another thread did in the meantime */
+		const long chunk_size = size > CPARSE_CONTEXT_CHUNK_SIZE ? size : CPARSE_CONTEXT_CHUNK_SIZE;
+		struct cparse_context_chunk* fresh = c->allocate(c->allocator_user_data, sizeof(struct cparse_context_chunk) + (cparse_size_t)chunk_size);
+		if (!fresh)
+			return NULL;
+		fresh->next = chunk;
+		fresh->size = chunk_size;
+		fresh->used = size;
+		if (cparse_atomic_cas_ptr(&c->chunks, chunk, fresh))
+			return fresh + 1;
+		c->deallocate(c->allocator_user_data, fresh);
+	}
+}
+
+CPARSE_API const char* cparse_context_intern(struct cparse_context* c, const char* spelling, int length)
+{
+	const uint hash = cparse_hash(spelling, (uint)length);
+	struct cparse_context_string* volatile* bucket = &c->buckets[hash & (CPARSE_CONTEXT_BUCKETS - 1)];
+	struct cparse_context_string* head = cparse_atomic_load_ptr(bucket);
+	struct cparse_context_string* checked = NULL;
+	struct cparse_context_string* string = NULL;
+
+	for (;;) {
+		for (struct cparse_context_string* other = head; other != checked; other = other->next) {
+			if (other->hash == hash && other->length == length && memcmp(other + 1, spelling, (size_t)length) == 0)
+				return (const char*)(other + 1);
+		}
+
+		if (!string) {
+			string = cparse_context_alloc(c, (long)sizeof(struct cparse_context_string) + length + 1);
+			if (!string)
+				return NULL;
+			string->hash = hash;
+			string->length = length;
+			memcpy(string + 1, spelling, (size_t)length);
+			((char*)(string + 1))[length] = 0;
+		}
+
+		string->next = head;
+		if (cparse_atomic_cas_ptr(bucket, head, string))
+			return (const char*)(string + 1);
+
+		/* other strings got in first, only those need to be compared */
+		checked = head;
+		head = cparse_atomic_load_ptr(bucket);
+	}
+}
+
+/* source files */
+
+/* a file mapped (or, if mapping is not possible, read in one go) into memory */
+struct cparse_source_file {
+	const char* data; /* null if the file could not be opened */
+	cparse_size_t size;
+	bool mapped;
+};
+
+static void cparse_source_file_read(struct cparse_source_file* f, int (*read_fn)(void*, char*, cparse_size_t), void* handle)
+{
+	char* data = malloc(f->size);
+	if (!data)
+		return;
+
+	cparse_size_t total = 0;
+	while (total < f->size) {
+		int read = read_fn(handle, data + total, f->size - total);
+		if (read <= 0) {
+			free(data);
+			return;
+		}
+		total += read;
+	}
+
+	f->data = data;
+}
+
+#ifdef _WIN32
+
+static int cparse_source_file_read_win32(void* handle, char* dest, cparse_size_t size)
+{
+	DWORD read = 0;
+	DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+	return ReadFile((HANDLE)handle, dest, chunk, &read, NULL) ? (int)read : -1;
+}
+
+static void cparse_source_file_open(struct cparse_source_file* f, const char* filename)
+{
+	f->data = NULL;
+	f->size = 0;
+	f->mapped = false;
+
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) && (unsigned long long)size.QuadPart <= (cparse_size_t)-1) {
+		if (size.QuadPart == 0) {
+			f->data = "";
+		}
+		else {
+			f->size = (cparse_size_t)size.QuadPart;
+			HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping) {
+				f->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				f->mapped = f->data != NULL;
+				CloseHandle(mapping);
+			}
+
+			/* mapping failed, fall back to a single bulk read */
+			if (!f->data)
+				cparse_source_file_read(f, cparse_source_file_read_win32, file);
+		}
+	}
+
+	CloseHandle(file);
+}
+
+static void cparse_source_file_close(struct cparse_source_file* f)
+{
+	if (f->mapped)
+		UnmapViewOfFile(f->data);
+	else if (f->data && f->size)
+		free((void*)f->data);
+}
+
+#else
+
+static int cparse_source_file_read_posix(void* handle, char* dest, cparse_size_t size)
+{
+	ssize_t result;
+	do result = read(*(int*)handle, dest, size > 0x40000000 ? 0x40000000 : size);
+	while (result < 0 && errno == EINTR);
+	return (int)result;
+}
+
+static void cparse_source_file_open(struct cparse_source_file* f, const char* filename)
+{
+	f->data = NULL;
+	f->size = 0;
+	f->mapped = false;
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		if (st.st_size == 0) {
+			f->data = "";
+		}
+		else {
+			f->size = (cparse_size_t)st.st_size;
+			void* data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data != MAP_FAILED) {
+				f->data = data;
+				f->mapped = true;
+			}
+			else {
+				/* mapping failed, fall back to a single bulk read */
+				cparse_source_file_read(f, cparse_source_file_read_posix, &fd);
+			}
+		}
+	}
+
+	close(fd);
+}
+
+static void cparse_source_file_close(struct cparse_source_file* f)
+{
+	if (f->mapped)
+		munmap((void*)f->data, f->size);
+	else if (f->data && f->size)
+		free((void*)f->data);
+}
+
+#endif
+
+/* a file opened by #include, kept alive until the end of the parse */
+struct cparse_pp_source {
+	struct cparse_pp_source* next;
+	struct cparse_source_file file;
+};
+
+/* lexer */
+static const char* cparse_lex_position(struct cparse_lexer const* l)
+{
+	return l->curr < 0 ? l->cursor : l->cursor - 1;
+}
+
+static int cparse_lex_skip(struct cparse_state* s)
+{
+	struct cparse_lexer* l = &s->lex;
+	if (l->curr == '\n') {
+		++l->line;
+		l->line_begin = l->cursor;
+	}
+	l->curr = l->cursor < l->source_end ? (unsigned char)*l->cursor++ : -1;
+	return l->curr;
+}
+
+/* makes p the current position, p must not skip any newline that is not accounted for */
+static void cparse_lex_seek(struct cparse_state* s, const char* p)
+{
+	struct cparse_lexer* l = &s->lex;
+	l->cursor = p;
+	l->curr = p < l->source_end ? (unsigned char)*l->cursor++ : -1;
+}
+
+static int cparse_lex_push(struct cparse_state* s)
+{
+	++s->lex.token_size;
+	return cparse_lex_skip(s);
+}
+
+/* appends everything up to p to the token */
+static void cparse_lex_push_to(struct cparse_state* s, const char* p)
+{
+	s->lex.token_size += (uint)(p - cparse_lex_position(&s->lex));
+	cparse_lex_seek(s, p);
+}
+
+/* character classes driving cparse_lex_token */
+enum {
+	CPARSE_CHAR_INVALID,
+	CPARSE_CHAR_SPACE,
+	CPARSE_CHAR_ALPHA, /* letters and underscore */
+	CPARSE_CHAR_DIGIT,
+	CPARSE_CHAR_PUNCT, /* single character tokens */
+	CPARSE_CHAR_OPERATOR, /* may start a multi-character punctuator */
+	CPARSE_CHAR_DOT,
+	CPARSE_CHAR_SLASH,
+	CPARSE_CHAR_QUOTE,
+	CPARSE_CHAR_BACKSLASH,
+};
+
+#define X CPARSE_CHAR_INVALID
+#define S CPARSE_CHAR_SPACE
+#define A CPARSE_CHAR_ALPHA
+#define D CPARSE_CHAR_DIGIT
+#define P CPARSE_CHAR_PUNCT
+#define M CPARSE_CHAR_OPERATOR
+#define O CPARSE_CHAR_DOT
+#define C CPARSE_CHAR_SLASH
+#define Q CPARSE_CHAR_QUOTE
+#define B CPARSE_CHAR_BACKSLASH
+
+static const unsigned char cparse_char_class[256] = {
+	X, X, X, X, X, X, X, X, X, S, S, X, X, S, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	S, M, Q, M, X, M, M, Q, P, P, M, M, P, M, O, C,
+	D, D, D, D, D, D, D, D, D, D, P, P, M, M, M, P,
+	X, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+	A, A, A, A, A, A, A, A, A, A, A, P, B, P, M, A,
+	X, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+	A, A, A, A, A, A, A, A, A, A, A, P, M, P, P, X,
+};
+
+#undef X
+#undef S
+#undef A
+#undef D
+#undef P
+#undef M
+#undef O
+#undef C
+#undef Q
+#undef B
+
+static bool cparse_lex_is_identifier_char(int ch, bool first)
+{
+	return cparse_char_class[ch] == CPARSE_CHAR_ALPHA || (!first && cparse_char_class[ch] == CPARSE_CHAR_DIGIT);
+}
+
+/* keywords by perfect hash of the first two characters, the last character and the length. the
+   multiplier is the first of 0x9e3779b1 * m, for m = 1, 3, 5..., that maps the C11 keywords to
+   distinct slots (m = 12569), redo the search when adding a keyword. debug builds check the table
+   in cparse_keywords_check. */
+#define CPARSE_KEYWORD_HASH_MULTIPLIER 0x11b5c349u
+#define CPARSE_KEYWORD_HASH_BITS 7
+#define CPARSE_KEYWORD_MIN_LENGTH 2
+#define CPARSE_KEYWORD_MAX_LENGTH 14
+
+static const struct {
+	const char* spelling;
+	unsigned char length;
+	short token;
+} cparse_keywords[1 << CPARSE_KEYWORD_HASH_BITS] = {
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "sizeof", 6, CPARSE_KW_SIZEOF },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "if", 2, CPARSE_KW_IF },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "default", 7, CPARSE_KW_DEFAULT },
+	{ "inline", 6, CPARSE_KW_INLINE },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "return", 6, CPARSE_KW_RETURN },
+	{ 0 },
+	{ "_Atomic", 7, CPARSE_KW_ATOMIC },
+	{ "_Bool", 5, CPARSE_KW_BOOL },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "volatile", 8, CPARSE_KW_VOLATILE },
+	{ "_Thread_local", 13, CPARSE_KW_THREAD_LOCAL },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "restrict", 8, CPARSE_KW_RESTRICT },
+	{ "enum", 4, CPARSE_KW_ENUM },
+	{ 0 },
+	{ "void", 4, CPARSE_KW_VOID },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "_Noreturn", 9, CPARSE_KW_NORETURN },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "double", 6, CPARSE_KW_DOUBLE },
+	{ "switch", 6, CPARSE_KW_SWITCH },
+	{ "signed", 6, CPARSE_KW_SIGNED },
+	{ 0 },
+	{ "struct", 6, CPARSE_KW_STRUCT },
+	{ 0 },
+	{ "union", 5, CPARSE_KW_UNION },
+	{ "while", 5, CPARSE_KW_WHILE },
+	{ "static", 6, CPARSE_KW_STATIC },
+	{ "_Imaginary", 10, CPARSE_KW_IMAGINARY },
+	{ 0 },
+	{ "const", 5, CPARSE_KW_CONST },
+	{ 0 },
+	{ 0 },
+	{ "auto", 4, CPARSE_KW_AUTO },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "float", 5, CPARSE_KW_FLOAT },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "for", 3, CPARSE_KW_FOR },
+	{ 0 },
+	{ 0 },
+	{ "int", 3, CPARSE_KW_INT },
+	{ "short", 5, CPARSE_KW_SHORT },
+	{ 0 },
+	{ "_Alignas", 8, CPARSE_KW_ALIGNAS },
+	{ "typedef", 7, CPARSE_KW_TYPEDEF },
+	{ 0 },
+	{ "goto", 4, CPARSE_KW_GOTO },
+	{ "unsigned", 8, CPARSE_KW_UNSIGNED },
+	{ "break", 5, CPARSE_KW_BREAK },
+	{ 0 },
+	{ "_Generic", 8, CPARSE_KW_GENERIC },
+	{ "char", 4, CPARSE_KW_CHAR },
+	{ 0 },
+	{ "extern", 6, CPARSE_KW_EXTERN },
+	{ "_Alignof", 8, CPARSE_KW_ALIGNOF },
+	{ 0 },
+	{ 0 },
+	{ "register", 8, CPARSE_KW_REGISTER },
+	{ 0 },
+	{ "else", 4, CPARSE_KW_ELSE },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "case", 4, CPARSE_KW_CASE },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ 0 },
+	{ "_Complex", 8, CPARSE_KW_COMPLEX },
+	{ "do", 2, CPARSE_KW_DO },
+	{ "_Static_assert", 14, CPARSE_KW_STATIC_ASSERT },
+	{ "continue", 8, CPARSE_KW_CONTINUE },
+	{ "long", 4, CPARSE_KW_LONG },
+};
+
+static cparse_token_t cparse_lex_keyword(const char* str, uint length)
+{
+	if (length < CPARSE_KEYWORD_MIN_LENGTH || length > CPARSE_KEYWORD_MAX_LENGTH)
+		return CPARSE_TOK_IDENTIFIER;
+
+	const uint key = (unsigned char)str[0] | (unsigned char)str[1] << 8 | (unsigned char)str[length - 1] << 16 | length << 24;
+	const uint slot = (key * CPARSE_KEYWORD_HASH_MULTIPLIER) >> (32 - CPARSE_KEYWORD_HASH_BITS);
+	if (cparse_keywords[slot].length == length && memcmp(cparse_keywords[slot].spelling, str, length) == 0)
+		return cparse_keywords[slot].token;
+	return CPARSE_TOK_IDENTIFIER;
+}
+
+#ifndef NDEBUG
+/* every keyword token is found by its spelling and the table holds nothing else */
+static void cparse_keywords_check(void)
+{
+	uint count = 0;
+	for (uint slot = 0; slot < (1u << CPARSE_KEYWORD_HASH_BITS); ++slot)
+		count += cparse_keywords[slot].spelling != NULL;
+	assert(count == CPARSE_KW_THREAD_LOCAL - CPARSE_KW_AUTO + 1);
+
+	for (cparse_token_t tok = CPARSE_KW_AUTO; tok <= CPARSE_KW_THREAD_LOCAL; ++tok) {
+		char buffer[2];
+		const char* spelling = cparse_strtok(tok, buffer);
+		assert(cparse_lex_keyword(spelling, (uint)strlen(spelling)) == tok);
+		(void)spelling;
+	}
+}
+#endif
+
+/* scanning kernels, process CPARSE_VEC_SIZE bytes at a time with SSE2/AVX2 and finish with a scalar loop
+   (which is all there is without SIMD). they never read past end. */
+
+#ifdef CPARSE_VEC_SIZE
+static uint cparse_ctz(uint x)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, x);
+	return index;
+#elif defined(__GNUC__)
+	return __builtin_ctz(x);
+#else
+	uint n = 0;
+	while (!(x & 1)) { x >>= 1; ++n; }
+	return n;
+#endif
+}
+
+static uint cparse_bsr(uint x)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse(&index, x);
+	return index;
+#elif defined(__GNUC__)
+	return 31 - __builtin_clz(x);
+#else
+	uint n = 0;
+	while (x >>= 1) ++n;
+	return n;
+#endif
+}
+
+static uint cparse_popcount(uint x)
+{
+	x = x - ((x >> 1) & 0x55555555u);
+	x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+	return (((x + (x >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24;
+}
+
+/* advances line and line_begin past the newlines in mask (bit i is p[i]) */
+static void cparse_scan_newlines(const char* p, uint newlines, uint* line, const char** line_begin)
+{
+	if (newlines) {
+		*line += cparse_popcount(newlines);
+		*line_begin = p + cparse_bsr(newlines) + 1;
+	}
+}
+#endif
+
+static const char* cparse_scan_whitespace(const char* p, const char* end, uint* line, const char** line_begin)
+{
+#ifdef CPARSE_VEC_SIZE
+	const cparse_vec space = cparse_vec_set1(' '), tab = cparse_vec_set1('\t'), cr = cparse_vec_set1('\r'), lf = cparse_vec_set1('\n');
+	for (; p + CPARSE_VEC_SIZE <= end; p += CPARSE_VEC_SIZE) {
+		cparse_vec v = cparse_vec_load(p);
+		uint newlines = cparse_vec_mask(cparse_vec_eq(v, lf));
+		uint blanks = newlines | cparse_vec_mask(cparse_vec_or(cparse_vec_or(cparse_vec_eq(v, space), cparse_vec_eq(v, tab)), cparse_vec_eq(v, cr)));
+		uint stop = ~blanks & CPARSE_VEC_MASK;
+		if (stop) {
+			cparse_scan_newlines(p, newlines & ((1u << cparse_ctz(stop)) - 1), line, line_begin);
+			return p + cparse_ctz(stop);
+		}
+		cparse_scan_newlines(p, newlines, line, line_begin);
+	}
+#endif
+	for (; p < end; ++p) {
+		if (*p == '\n') {
+			++*line;
+			*line_begin = p + 1;
+		}
+		else if (*p != ' ' && *p != '\t' && *p != '\r') {
+			break;
+		}
+	}
+	return p;
+}
+
+static const char* cparse_scan_identifier(const char* p, const char* end)
+{
+#ifdef CPARSE_VEC_SIZE
+	const cparse_vec case_bit = cparse_vec_set1(0x20), underscore = cparse_vec_set1('_');
+	const cparse_vec before_a = cparse_vec_set1('a' - 1), after_z = cparse_vec_set1('z' + 1);
+	const cparse_vec before_0 = cparse_vec_set1('0' - 1), after_9 = cparse_vec_set1('9' + 1);
+	for (; p + CPARSE_VEC_SIZE <= end; p += CPARSE_VEC_SIZE) {
+		/* bytes >= 0x80 are negative in the signed compares and never match */
+		cparse_vec v = cparse_vec_load(p);
+		cparse_vec lower = cparse_vec_or(v, case_bit);
+		cparse_vec alpha = cparse_vec_and(cparse_vec_gt(lower, before_a), cparse_vec_gt(after_z, lower));
+		cparse_vec digit = cparse_vec_and(cparse_vec_gt(v, before_0), cparse_vec_gt(after_9, v));
+		uint stop = ~cparse_vec_mask(cparse_vec_or(cparse_vec_or(alpha, digit), cparse_vec_eq(v, underscore))) & CPARSE_VEC_MASK;
+		if (stop)
+			return p + cparse_ctz(stop);
+	}
+#endif
+	while (p < end && cparse_lex_is_identifier_char((unsigned char)*p, false))
+		++p;
+	return p;
+}
+
+/* returns the newline ending the line comment at p, or end */
+static const char* cparse_scan_line_comment(const char* p, const char* end)
+{
+#ifdef CPARSE_VEC_SIZE
+	const cparse_vec lf = cparse_vec_set1('\n');
+	for (; p + CPARSE_VEC_SIZE <= end; p += CPARSE_VEC_SIZE) {
+		uint stop = cparse_vec_mask(cparse_vec_eq(cparse_vec_load(p), lf));
+		if (stop)
+			return p + cparse_ctz(stop);
+	}
+#endif
+	while (p < end && *p != '\n')
+		++p;
+	return p;
+}
+
+/* returns the first byte after the closing star-slash of the block comment at p, or null if unterminated */
+static const char* cparse_scan_block_comment(const char* p, const char* end, uint* line, const char** line_begin)
+{
+#ifdef CPARSE_VEC_SIZE
+	const cparse_vec star = cparse_vec_set1('*'), slash = cparse_vec_set1('/'), lf = cparse_vec_set1('\n');
+	for (; p + CPARSE_VEC_SIZE + 1 <= end; p += CPARSE_VEC_SIZE) {
+		cparse_vec v = cparse_vec_load(p);
+		uint newlines = cparse_vec_mask(cparse_vec_eq(v, lf));
+		uint close = cparse_vec_mask(cparse_vec_eq(v, star)) & cparse_vec_mask(cparse_vec_eq(cparse_vec_load(p + 1), slash));
+		if (close) {
+			cparse_scan_newlines(p, newlines & ((1u << cparse_ctz(close)) - 1), line, line_begin);
+			return p + cparse_ctz(close) + 2;
+		}
+		cparse_scan_newlines(p, newlines, line, line_begin);
+	}
+#endif
+	for (; p < end; ++p) {
+		if (*p == '\n') {
+			++*line;
+			*line_begin = p + 1;
+		}
+		else if (*p == '*' && p + 1 < end && p[1] == '/') {
+			return p + 2;
+		}
+	}
+	return NULL;
+}
+
+/* returns the first newline, slash, quote or backslash at or after p, or end. used to skip the lines of
+   excluded conditional groups without lexing them. */
+static const char* cparse_scan_line_special(const char* p, const char* end)
+{
+#ifdef CPARSE_VEC_SIZE
+	const cparse_vec lf = cparse_vec_set1('\n'), slash = cparse_vec_set1('/'), backslash = cparse_vec_set1('\\');
+	const cparse_vec quote = cparse_vec_set1('"'), apostrophe = cparse_vec_set1('\'');
+	for (; p + CPARSE_VEC_SIZE <= end; p += CPARSE_VEC_SIZE) {
+		cparse_vec v = cparse_vec_load(p);
+		cparse_vec special = cparse_vec_or(cparse_vec_or(cparse_vec_eq(v, lf), cparse_vec_eq(v, slash)), cparse_vec_eq(v, backslash));
+		uint stop = cparse_vec_mask(cparse_vec_or(special, cparse_vec_or(cparse_vec_eq(v, quote), cparse_vec_eq(v, apostrophe))));
+		if (stop)
+			return p + cparse_ctz(stop);
+	}
+#endif
+	while (p < end && *p != '\n' && *p != '/' && *p != '\\' && *p != '"' && *p != '\'')
+		++p;
+	return p;
+}
+
+/* returns the first bracket, quote, slash, '#' or, if separators is set, ',' or ';' at or after p, or end, counting the
+   newlines before it. used to skip function bodies and initializers without lexing them. */
+static const char* cparse_scan_bracket(const char* p, const char* end, bool commas, bool semicolons, uint* line, const char** line_begin)
+{
+#ifdef CPARSE_VEC_SIZE
+	/* '[' and '{' differ in the case bit only, so do ']' and '}', and '(' and ')' in the lowest bit. the comma and
+	   semicolon compares look for quotes again when they are not wanted. */
+	const cparse_vec case_mask = cparse_vec_set1(~0x20), open = cparse_vec_set1('['), close = cparse_vec_set1(']');
+	const cparse_vec paren = cparse_vec_set1('('), paren_mask = cparse_vec_set1(~0x01);
+	const cparse_vec quote = cparse_vec_set1('"'), apostrophe = cparse_vec_set1('\''), slash = cparse_vec_set1('/'), hash = cparse_vec_set1('#');
+	const cparse_vec comma = cparse_vec_set1(commas ? ',' : '"'), semicolon = cparse_vec_set1(semicolons ? ';' : '"');
+	const cparse_vec lf = cparse_vec_set1('\n');
+	for (; p + CPARSE_VEC_SIZE <= end; p += CPARSE_VEC_SIZE) {
+		cparse_vec v = cparse_vec_load(p);
+		cparse_vec upper = cparse_vec_and(v, case_mask);
+		cparse_vec brackets = cparse_vec_or(cparse_vec_or(cparse_vec_eq(upper, open), cparse_vec_eq(upper, close)), cparse_vec_eq(cparse_vec_and(v, paren_mask), paren));
+		cparse_vec special = cparse_vec_or(cparse_vec_or(cparse_vec_eq(v, quote), cparse_vec_eq(v, apostrophe)), cparse_vec_or(cparse_vec_eq(v, slash), cparse_vec_eq(v, hash)));
+		uint newlines = cparse_vec_mask(cparse_vec_eq(v, lf));
+		uint stop = cparse_vec_mask(cparse_vec_or(cparse_vec_or(brackets, special), cparse_vec_or(cparse_vec_eq(v, comma), cparse_vec_eq(v, semicolon))));
+		if (stop) {
+			cparse_scan_newlines(p, newlines & ((1u << cparse_ctz(stop)) - 1), line, line_begin);
+			return p + cparse_ctz(stop);
+		}
+		cparse_scan_newlines(p, newlines, line, line_begin);
+	}
+#endif
+	for (; p < end; ++p) {
+		switch (*p) {
+			case '\n':
+				++*line;
+				*line_begin = p + 1;
+				break;
+			case ',':
+				if (commas)
+					return p;
+				break;
+			case ';':
+				if (semicolons)
+					return p;
+				break;
+			case '(': case ')': case '[': case ']': case '{': case '}': case '"': case '\'': case '/': case '#':
+				return p;
+		}
+	}
+	return p;
+}
+
+/* returns the first byte after the string or character literal whose quote is at p, or null if it does not end on its
+   line (or continues on the next one) */
+static const char* cparse_scan_literal(const char* p, const char* end)
+{
+	const char quote = *p++;
+	while ((p = cparse_scan_line_special(p, end)) < end && *p != '\n') {
+		if (*p == quote)
+			return p + 1;
+		if (*p == '\\' && (++p == end || *p == '\n' || *p == '\r'))
+			return NULL;
+		++p;
+	}
+	return NULL;
+}
+
+/* whether the '#' at p starts a directive as the lexer sees it, that is whether a newline comes before it with only
+   blanks and the last block comment skipped, [comment_begin, comment_end), in between. from is where the text to
+   skip starts, after a token. */
+static bool cparse_scan_directive(const char* from, const char* p, const char* comment_begin, const char* comment_end)
+{
+	while (p > from) {
+		if (p == comment_end) {
+			p = comment_begin;
+			continue;
+		}
+		--p;
+		if (*p == '\n')
+			return p == from || (p[-1] != '\\' && (p[-1] != '\r' || p - 1 == from || p[-2] != '\\'));
+		if (*p != ' ' && *p != '\t' && *p != '\r')
+			return false;
+	}
+	return false;
+}
+
+/* skips text from *p with depth brackets of any kind open, up to the closer that closes them all (or one too many) or,
+   if separators is set, to the first ',' or ';' outside of brackets, and returns true with *p there. if braces is not
+   null it also stops at the first ';' outside of braces, *braces counting those open. returns false with *p where
+   lexing has to take over: at a directive, at a literal or comment that does not end where the scanner can tell, or at
+   end. strings, characters and comments are skipped whole, brackets are counted without being matched. */
+static bool cparse_scan_balanced(const char** p, const char* end, bool separators, int* depth, int* braces, uint* line, const char** line_begin)
+{
+	const char* comment_begin = NULL;
+	const char* comment_end = NULL;
+	const char* q = *p;
+	for (;; ++q) {
+		q = cparse_scan_bracket(q, end, separators, separators || braces, line, line_begin);
+		if (q == end)
+			break;
+
+		switch (*q) {
+			case '(': case '[': case '{':
+				++*depth;
+				if (*q == '{' && braces)
+					++*braces;
+				continue;
+
+			case ')': case ']': case '}':
+				if (*q == '}' && braces)
+					--*braces;
+				if (--*depth < 0 || (*depth == 0 && !separators)) {
+					*p = q;
+					return true;
+				}
+				continue;
+
+			case ',': case ';':
+				if (separators ? *depth == 0 : *braces == 0) {
+					*p = q;
+					return true;
+				}
+				continue;
+
+			case '"': case '\'': {
+				const char* literal_end = cparse_scan_literal(q, end);
+				if (!literal_end)
+					break;
+				q = literal_end - 1;
+				continue;
+			}
+
+			case '/':
+				if (q + 1 < end && q[1] == '/') {
+					q = cparse_scan_line_comment(q + 2, end) - 1;
+					continue;
+				}
+				if (q + 1 < end && q[1] == '*') {
+					/* the lexer reports an unterminated comment from where it starts */
+					uint comment_line = *line;
+					const char* comment_line_begin = *line_begin;
+					const char* after = cparse_scan_block_comment(q + 2, end, &comment_line, &comment_line_begin);
+					if (!after)
+						break;
+					*line = comment_line;
+					*line_begin = comment_line_begin;
+					comment_begin = q;
+					comment_end = after;
+					q = after - 1;
+				}
+				continue;
+
+			default: /* '#' */
+				if (cparse_scan_directive(*p, q, comment_begin, comment_end))
+					break;
+				continue;
+		}
+		break;
+	}
+
+	*p = q;
+	return false;
+}
+
+/* starts lexing [data, data + size) */
+static void cparse_lex_begin(struct cparse_state* s, const char* filename, const char* data, cparse_size_t size)
+{
+	struct cparse_lexer* l = &s->lex;
+	l->filename = filename;
+	l->cursor = data;
+	l->source_end = data + size;
+	l->line_begin = data;
+	l->line = 1;
+	l->curr = 0;
+	l->token = data;
+	l->token_size = 0;
+	l->lookahead = CPARSE_TOK_EOF;
+	l->line_start = true;
+	cparse_lex_skip(s);
+}
+
+static bool cparse_lex_accept_c(struct cparse_state* s, int ch)
+{
+	if (s->lex.curr != ch)
+		return false;
+	cparse_lex_push(s);
+	return true;
+}
+
+/* skips whitespace, comments and line continuations */
+static void cparse_lex_skip_blanks(struct cparse_state* s)
+{
+	struct cparse_lexer* l = &s->lex;
+	while (l->curr >= 0) {
+		switch (cparse_char_class[l->curr])
+		{
+			case CPARSE_CHAR_SPACE: {
+				const uint line = l->line;
+				cparse_lex_seek(s, cparse_scan_whitespace(cparse_lex_position(l), l->source_end, &l->line, &l->line_begin));
+				l->line_start |= l->line != line;
+				break;
+			}
+
+			case CPARSE_CHAR_SLASH:
+				if (l->cursor < l->source_end && *l->cursor == '/') {
+					cparse_lex_seek(s, cparse_scan_line_comment(l->cursor + 1, l->source_end));
+					break;
+				}
+				if (l->cursor < l->source_end && *l->cursor == '*') {
+					const char* end = cparse_scan_block_comment(l->cursor + 1, l->source_end, &l->line, &l->line_begin);
+					if (!end)
+						cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "unterminated comment.");
+					cparse_lex_seek(s, end);
+					break;
+				}
+				return;
+
+			case CPARSE_CHAR_BACKSLASH: {
+				const char* p = l->cursor;
+				if (p < l->source_end && *p == '\r')
+					++p;
+				if (p >= l->source_end || *p != '\n')
+					return;
+				++l->line;
+				l->line_begin = p + 1;
+				cparse_lex_seek(s, p + 1);
+				break;
+			}
+
+			default:
+				return;
+		}
+	}
+}
+
+static cparse_token_t cparse_lex_operator(struct cparse_state* s)
+{
+	const int ch = s->lex.curr;
+	cparse_lex_push(s);
+
+	switch (ch)
+	{
+		case '#':
+			return cparse_lex_accept_c(s, '#') ? CPARSE_TOK_HASHHASH : ch;
+
+		case '-':
+			if (cparse_lex_accept_c(s, '>')) return CPARSE_TOK_ARROW;
+			if (cparse_lex_accept_c(s, '-')) return CPARSE_TOK_DEC;
+			return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_SUB_ASSIGN : ch;
+
+		case '+':
+			if (cparse_lex_accept_c(s, '+')) return CPARSE_TOK_INC;
+			return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_ADD_ASSIGN : ch;
+
+		case '<':
+			if (cparse_lex_accept_c(s, '<')) return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_SHL_ASSIGN : CPARSE_TOK_SHL;
+			return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_LE : ch;
+
+		case '>':
+			if (cparse_lex_accept_c(s, '>')) return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_SHR_ASSIGN : CPARSE_TOK_SHR;
+			return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_GE : ch;
+
+		case '&':
+			if (cparse_lex_accept_c(s, '&')) return CPARSE_TOK_AND;
+			return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_AND_ASSIGN : ch;
+
+		case '|':
+			if (cparse_lex_accept_c(s, '|')) return CPARSE_TOK_OR;
+			return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_OR_ASSIGN : ch;
+
+		case '=': return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_EQ : ch;
+		case '!': return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_NE : ch;
+		case '*': return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_MUL_ASSIGN : ch;
+		case '/': return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_DIV_ASSIGN : ch;
+		case '%': return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_MOD_ASSIGN : ch;
+		case '^': return cparse_lex_accept_c(s, '=') ? CPARSE_TOK_XOR_ASSIGN : ch;
+	}
+
+	return ch;
+}
+
+/* lexes a preprocessing number (digits, letters, dots and signed exponents) starting at the current
+   character, which is a digit or a dot followed by one */
+static cparse_token_t cparse_lex_number(struct cparse_state* s)
+{
+	struct cparse_lexer* l = &s->lex;
+	const bool hex = l->curr == '0' && l->cursor < l->source_end && (*l->cursor == 'x' || *l->cursor == 'X');
+	bool is_float = false;
+
+	for (;;) {
+		cparse_lex_push_to(s, cparse_scan_identifier(cparse_lex_position(l), l->source_end));
+		if (l->curr == '.') {
+			is_float = true;
+			cparse_lex_push(s);
+			continue;
+		}
+		if (l->curr == '+' || l->curr == '-') {
+			const char exponent = l->token[l->token_size - 1];
+			if ((!hex && (exponent == 'e' || exponent == 'E')) || exponent == 'p' || exponent == 'P') {
+				is_float = true;
+				cparse_lex_push(s);
+				continue;
+			}
+		}
+		break;
+	}
+
+	if (!is_float && !hex)
+		is_float = memchr(l->token, 'e', l->token_size) || memchr(l->token, 'E', l->token_size);
+
+	return is_float ? CPARSE_TOK_FLOAT : CPARSE_TOK_INTEGER;
+}
+
+static cparse_token_t cparse_lex_quoted(struct cparse_state* s)
+{
+	struct cparse_lexer* l = &s->lex;
+	const int quote = l->curr;
+	cparse_lex_push(s);
+
+	while (!cparse_lex_accept_c(s, quote)) {
+		if (l->curr < 0 || l->curr == '\n')
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "missing terminating %c character.", quote);
+		if (l->curr == '\\' && cparse_lex_push(s) < 0)
+			continue;
+		cparse_lex_push(s);
+	}
+
+	return quote == '"' ? CPARSE_TOK_STRING : CPARSE_TOK_CHAR;
+}
+
+/* lexes the token at the current character, blanks must have been skipped. flags are left to the caller. */
+static void cparse_lex_token(struct cparse_state* s, struct cparse_token* tok)
+{
+	struct cparse_lexer* l = &s->lex;
+	l->token = cparse_lex_position(l);
+	l->token_size = 0;
+
+	if (l->curr < 0) {
+		tok->kind = CPARSE_TOK_EOF;
+	}
+	else {
+		switch (cparse_char_class[l->curr])
+		{
+			case CPARSE_CHAR_PUNCT:
+				tok->kind = l->curr;
+				cparse_lex_push(s);
+				break;
+
+			case CPARSE_CHAR_OPERATOR:
+			case CPARSE_CHAR_SLASH:
+				tok->kind = cparse_lex_operator(s);
+				break;
+
+			case CPARSE_CHAR_DOT:
+				if (l->cursor < l->source_end && *l->cursor >= '0' && *l->cursor <= '9') {
+					tok->kind = cparse_lex_number(s);
+				}
+				else if (l->cursor + 1 < l->source_end && l->cursor[0] == '.' && l->cursor[1] == '.') {
+					cparse_lex_push_to(s, l->cursor + 2);
+					tok->kind = CPARSE_TOK_ELLIPSIS;
+				}
+				else {
+					tok->kind = '.';
+					cparse_lex_push(s);
+				}
+				break;
+
+			case CPARSE_CHAR_DIGIT:
+				tok->kind = cparse_lex_number(s);
+				break;
+
+			case CPARSE_CHAR_ALPHA:
+				cparse_lex_push_to(s, cparse_scan_identifier(l->token, l->source_end));
+
+				/* encoding prefixes of string and character literals */
+				if ((l->curr == '"' || l->curr == '\'') && l->token_size <= 2 && (l->token[0] == 'L' || l->token[0] == 'u' || l->token[0] == 'U') && (l->token_size == 1 || (l->token[0] == 'u' && l->token[1] == '8'))) {
+					tok->kind = cparse_lex_quoted(s);
+					break;
+				}
+
+				tok->kind = cparse_lex_keyword(l->token, l->token_size);
+				break;
+
+			case CPARSE_CHAR_QUOTE:
+				tok->kind = cparse_lex_quoted(s);
+				break;
+
+			default:
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "unexpected '%c'.", l->curr);
+				break;
+		}
+	}
+
+	tok->text = l->token;
+	tok->length = l->token_size;
+	tok->param = 0;
+
+	if (cparse_stats_enabled(s) && tok->kind != CPARSE_TOK_EOF) {
+		++s->stats->tokens;
+		++s->stats->tokens_by_kind[cparse_token_kind(tok->kind)];
+	}
+}
+
+static bool cparse_token_is_identifier(struct cparse_token const* tok)
+{
+	return tok->kind == CPARSE_TOK_IDENTIFIER || (tok->kind >= CPARSE_KW_AUTO && tok->kind <= CPARSE_KW_THREAD_LOCAL);
+}
+
+static bool cparse_token_is(struct cparse_token const* tok, const char* spelling)
+{
+	return strlen(spelling) == tok->length && memcmp(tok->text, spelling, tok->length) == 0;
+}
+
+/* parses a decimal, octal, hexadecimal or binary integer literal with an optional u/l suffix, false if it is malformed
+   or does not fit 64 bits */
+static bool cparse_parse_integer_literal(const char* text, uint length, unsigned long long* value)
+{
+	const char* p = text;
+	const char* end = text + length;
+	uint base = 10;
+
+	if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+		base = 16;
+		p += 2;
+	}
+	else if (end - p > 2 && p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) {
+		base = 2;
+		p += 2;
+	}
+	else if (p < end && p[0] == '0') {
+		base = 8;
+	}
+
+	*value = 0;
+	const char* digits = p;
+	for (; p < end; ++p) {
+		uint digit;
+		if (*p >= '0' && *p <= '9') digit = *p - '0';
+		else if (*p >= 'a' && *p <= 'f') digit = *p - 'a' + 10;
+		else if (*p >= 'A' && *p <= 'F') digit = *p - 'A' + 10;
+		else break;
+		if (digit >= base || *value > (ULLONG_MAX - digit) / base)
+			return false;
+		*value = *value * base + digit;
+	}
+
+	if (p == digits)
+		return false;
+
+	for (; p < end; ++p) {
+		if (*p != 'u' && *p != 'U' && *p != 'l' && *p != 'L')
+			return false;
+	}
+
+	return true;
+}
+
+/* preprocessor */
+
+#define CPARSE_MAX_INCLUDE_DEPTH 200
+
+static struct cparse_macro** cparse_pp_macro_slot(struct cparse_preprocessor const* pp, uint hash, const char* name, uint length)
+{
+	const uint mask = pp->macros_capacity - 1;
+	for (uint i = hash & mask;; i = (i + 1) & mask) {
+		struct cparse_macro** slot = pp->macros + i;
+		if (!*slot || ((*slot)->hash == hash && (*slot)->name_length == length && memcmp((*slot)->name, name, length) == 0))
+			return slot;
+	}
+}
+
+static struct cparse_macro* cparse_pp_find_macro(struct cparse_preprocessor const* pp, const char* name, uint length)
+{
+	if (!pp->macros_count)
+		return NULL;
+	struct cparse_macro* macro = *cparse_pp_macro_slot(pp, cparse_hash(name, length), name, length);
+	return macro && macro->defined ? macro : NULL;
+}
+
+/* returns the entry for name, adding an undefined one if there is none */
+static struct cparse_macro* cparse_pp_get_macro(struct cparse_state* s, const char* name, uint length)
+{
+	struct cparse_preprocessor* pp = &s->pp;
+
+	/* same growth policy as cparse_symbol_table_insert */
+	if ((pp->macros_count + 1) * 4 > pp->macros_capacity * 3) {
+		struct cparse_preprocessor grown = *pp;
+		grown.macros_capacity = pp->macros_capacity ? pp->macros_capacity * 2 : 64;
+		grown.macros = cparse_alloc(s, grown.macros_capacity * sizeof(struct cparse_macro*), __alignof(struct cparse_macro*));
+		memset(grown.macros, 0, grown.macros_capacity * sizeof(struct cparse_macro*));
+
+		for (uint i = 0; i < pp->macros_capacity; ++i) {
+			struct cparse_macro* macro = pp->macros[i];
+			if (macro)
+				*cparse_pp_macro_slot(&grown, macro->hash, macro->name, macro->name_length) = macro;
+		}
+
+		pp->macros = grown.macros;
+		pp->macros_capacity = grown.macros_capacity;
+	}
+
+	const uint hash = cparse_hash(name, length);
+	struct cparse_macro** slot = cparse_pp_macro_slot(pp, hash, name, length);
+	if (!*slot) {
+		struct cparse_macro* macro = cparse_alloc_type(s, struct cparse_macro);
+		memset(macro, 0, sizeof(struct cparse_macro));
+		macro->name = name;
+		macro->name_length = length;
+		macro->hash = hash;
+		*slot = macro;
+		++pp->macros_count;
+	}
+	return *slot;
+}
+
+/* growable token array in the buffer, outgrown arrays are left behind */
+struct cparse_token_array {
+	struct cparse_token* tokens;
+	uint count;
+	uint capacity;
+};
+
+static void cparse_token_array_push(struct cparse_state* s, struct cparse_token_array* array, struct cparse_token const* tok)
+{
+	if (array->count == array->capacity) {
+		uint capacity = array->capacity ? array->capacity * 2 : 8;
+		struct cparse_token* tokens = cparse_alloc(s, capacity * sizeof(struct cparse_token), __alignof(struct cparse_token));
+		if (cparse_stats_enabled(s))
+			s->stats->token_array_bytes += capacity * sizeof(struct cparse_token);
+		if (array->count)
+			memcpy(tokens, array->tokens, array->count * sizeof(struct cparse_token));
+		array->tokens = tokens;
+		array->capacity = capacity;
+	}
+	array->tokens[array->count++] = *tok;
+}
+
+static struct cparse_pp_context* cparse_pp_push_context(struct cparse_state* s, struct cparse_token const* tokens, uint count, struct cparse_macro* macro)
+{
+	struct cparse_preprocessor* pp = &s->pp;
+	struct cparse_pp_context* context = pp->free_contexts;
+	if (context)
+		pp->free_contexts = context->prev;
+	else
+		context = cparse_alloc_type(s, struct cparse_pp_context);
+
+	context->prev = pp->context;
+	context->tokens = tokens;
+	context->count = count;
+	context->index = 0;
+	context->macro = macro;
+	context->boundary = false;
+	pp->context = context;
+	return context;
+}
+
+static void cparse_pp_pop_context(struct cparse_state* s)
+{
+	struct cparse_preprocessor* pp = &s->pp;
+	struct cparse_pp_context* context = pp->context;
+	if (context->macro)
+		context->macro->expanding = false;
+	pp->context = context->prev;
+	context->prev = pp->free_contexts;
+	pp->free_contexts = context;
+}
+
+/* makes tok the next token read */
+static void cparse_pp_unread(struct cparse_state* s, struct cparse_token const* tok)
+{
+	struct cparse_pp_context* context = cparse_pp_push_context(s, NULL, 1, NULL);
+	context->single = *tok;
+	context->tokens = &context->single;
+}
+
+/* reads the next token on the directive line, returns false at the end of the line */
+static bool cparse_pp_line_token(struct cparse_state* s, struct cparse_token* tok)
+{
+	struct cparse_lexer* l = &s->lex;
+	const char* before = cparse_lex_position(l);
+	cparse_lex_skip_blanks(s);
+	if (l->line_start || l->curr < 0)
+		return false;
+	tok->flags = before != cparse_lex_position(l) ? CPARSE_TOKEN_SPACE : 0;
+	cparse_lex_token(s, tok);
+	return true;
+}
+
+/* skips the rest of the line without lexing it, stops at the newline */
+static void cparse_pp_skip_line(struct cparse_state* s)
+{
+	struct cparse_lexer* l = &s->lex;
+	if (l->line_start)
+		return;
+
+	const char* p = cparse_lex_position(l);
+	const char* end = l->source_end;
+
+	while ((p = cparse_scan_line_special(p, end)) < end && *p != '\n') {
+		switch (*p)
+		{
+			case '/':
+				if (p + 1 < end && p[1] == '*') {
+					p = cparse_scan_block_comment(p + 2, end, &l->line, &l->line_begin);
+					p = p ? p : end;
+				}
+				else if (p + 1 < end && p[1] == '/') {
+					p = cparse_scan_line_comment(p + 2, end);
+				}
+				else {
+					++p;
+				}
+				break;
+
+			case '\\':
+				++p;
+				if (p < end && *p == '\r')
+					++p;
+				if (p < end && *p == '\n') {
+					++l->line;
+					l->line_begin = ++p;
+				}
+				break;
+
+			default: {
+				/* unmatched quotes are fine in skipped text, they end with the line */
+				const char quote = *p++;
+				while (p < end && *p != quote && *p != '\n')
+					p += *p == '\\' && p + 1 < end && p[1] != '\n' ? 2 : 1;
+				if (p < end && *p == quote)
+					++p;
+				break;
+			}
+		}
+	}
+
+	cparse_lex_seek(s, p);
+}
+
+/* reads the identifier naming a directive, returns false if there is none */
+static bool cparse_pp_directive_name(struct cparse_state* s, struct cparse_token* name)
+{
+	struct cparse_lexer* l = &s->lex;
+	cparse_lex_skip_blanks(s);
+	if (l->line_start || l->curr < 0 || cparse_char_class[l->curr] != CPARSE_CHAR_ALPHA)
+		return false;
+	name->kind = CPARSE_TOK_IDENTIFIER;
+	name->text = cparse_lex_position(l);
+	name->length = (uint)(cparse_scan_identifier(name->text, l->source_end) - name->text);
+	cparse_lex_seek(s, name->text + name->length);
+	return true;
+}
+
+static void cparse_pp_read(struct cparse_state* s, struct cparse_token* tok);
+static void cparse_pp_next(struct cparse_state* s, struct cparse_token* tok);
+
+/* macro expansion */
+
+struct cparse_pp_arg {
+	struct cparse_token* tokens;
+	uint count;
+	struct cparse_token* expanded; /* fully macro-replaced, computed on first use */
+	uint expanded_count;
+	bool is_expanded;
+};
+
+/* macro-replaces tokens in isolation from what follows them */
+static void cparse_pp_expand_list(struct cparse_state* s, struct cparse_token const* tokens, uint count, struct cparse_token_array* out)
+{
+	struct cparse_pp_context* boundary = cparse_pp_push_context(s, tokens, count, NULL);
+	boundary->boundary = true;
+
+	for (;;) {
+		struct cparse_token tok;
+		cparse_pp_next(s, &tok);
+		if (tok.kind == CPARSE_TOK_EOF)
+			break;
+		cparse_token_array_push(s, out, &tok);
+	}
+
+	assert(s->pp.context == boundary);
+	cparse_pp_pop_context(s);
+}
+
+static struct cparse_pp_arg* cparse_pp_collect_args(struct cparse_state* s, struct cparse_macro const* macro)
+{
+	const uint capacity = macro->num_params ? macro->num_params : 1;
+	struct cparse_pp_arg* args = cparse_alloc(s, capacity * sizeof(struct cparse_pp_arg), __alignof(struct cparse_pp_arg));
+	memset(args, 0, capacity * sizeof(struct cparse_pp_arg));
+
+	struct cparse_token_array arg = { 0 };
+	uint num_args = 0;
+	uint depth = 0;
+
+	for (;;) {
+		struct cparse_token tok;
+		cparse_pp_read(s, &tok);
+
+		if (tok.kind == CPARSE_TOK_EOF)
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "unterminated argument list invoking macro '%.*s'.", macro->name_length, macro->name);
+
+		if (tok.kind == '(') {
+			++depth;
+		}
+		else if (tok.kind == ')' || (tok.kind == ',' && !depth && !(macro->variadic && num_args + 1 == macro->num_params))) {
+			if (tok.kind == ')' && depth) {
+				--depth;
+			}
+			else {
+				if (num_args < capacity) {
+					args[num_args].tokens = arg.tokens;
+					args[num_args].count = arg.count;
+				}
+				++num_args;
+				arg.tokens = NULL;
+				arg.count = arg.capacity = 0;
+				if (tok.kind == ')')
+					break;
+				continue;
+			}
+		}
+
+		/* newlines in arguments are just whitespace */
+		if (tok.flags & CPARSE_TOKEN_LINE_START)
+			tok.flags = (tok.flags & ~CPARSE_TOKEN_LINE_START) | CPARSE_TOKEN_SPACE;
+		cparse_token_array_push(s, &arg, &tok);
+	}
+
+	/* a single empty argument is no argument at all for macros without parameters, and the variable
+	   arguments may be left out entirely */
+	if ((!macro->num_params && num_args == 1 && !args[0].count) || (macro->variadic && num_args + 1 == macro->num_params))
+		num_args = macro->num_params;
+
+	if (num_args != macro->num_params)
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "macro '%.*s' requires %u arguments, but %u given.", macro->name_length, macro->name, macro->num_params, num_args);
+
+	return args;
+}
+
+static struct cparse_token cparse_pp_stringify(struct cparse_state* s, struct cparse_pp_arg const* arg)
+{
+	uint size = 3;
+	for (uint i = 0; i < arg->count; ++i)
+		size += arg->tokens[i].length * 2 + 1;
+
+	char* text = cparse_alloc(s, size, 1);
+	char* p = text;
+	*p++ = '"';
+	for (uint i = 0; i < arg->count; ++i) {
+		struct cparse_token const* tok = arg->tokens + i;
+		if (i && (tok->flags & CPARSE_TOKEN_SPACE))
+			*p++ = ' ';
+		const bool escape = tok->kind == CPARSE_TOK_STRING || tok->kind == CPARSE_TOK_CHAR;
+		for (uint j = 0; j < tok->length; ++j) {
+			if (escape && (tok->text[j] == '"' || tok->text[j] == '\\'))
+				*p++ = '\\';
+			*p++ = tok->text[j];
+		}
+	}
+	*p++ = '"';
+
+	struct cparse_token result = { CPARSE_TOK_STRING, 0, text, (uint)(p - text), 0 };
+	return result;
+}
+
+/* replaces left with the token spelled by the concatenation of left and right */
+static void cparse_pp_paste(struct cparse_state* s, struct cparse_token* left, struct cparse_token const* right)
+{
+	const uint length = left->length + right->length;
+	char* text = cparse_alloc(s, length + 1, 1);
+	memcpy(text, left->text, left->length);
+	memcpy(text + left->length, right->text, right->length);
+	text[length] = 0;
+
+	const struct cparse_lexer saved = s->lex;
+	const uint flags = left->flags;
+	cparse_lex_begin(s, saved.filename, text, length);
+	cparse_lex_token(s, left);
+	const bool valid = cparse_lex_position(&s->lex) == text + length;
+	s->lex = saved;
+
+	if (!valid)
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "pasting '%s' does not give a valid preprocessing token.", text);
+
+	left->flags = flags;
+}
+
+/* substitutes args into the replacement list of macro */
+static void cparse_pp_substitute(struct cparse_state* s, struct cparse_macro const* macro, struct cparse_pp_arg* args, struct cparse_token_array* out)
+{
+	struct cparse_token const* body = macro->tokens;
+	bool left_empty = false; /* the left operand of the next ## is an empty argument */
+
+	for (uint i = 0; i < macro->num_tokens; ++i) {
+		struct cparse_token const* tok = body + i;
+
+		if (tok->kind == '#' && macro->function_like) {
+			struct cparse_token str = cparse_pp_stringify(s, args + body[++i].param);
+			str.flags = tok->flags;
+			cparse_token_array_push(s, out, &str);
+			left_empty = false;
+		}
+		else if (tok->kind == CPARSE_TOK_HASHHASH) {
+			struct cparse_token const* right = body + ++i;
+			struct cparse_token const* operand = right;
+			uint count = 1;
+
+			bool paste = !left_empty && out->count;
+			if (right->kind == CPARSE_TOK_MACRO_PARAM) {
+				struct cparse_pp_arg const* arg = args + right->param;
+				operand = arg->tokens;
+				count = arg->count;
+
+				/* gnu extension, ", ## __VA_ARGS__" drops the comma when there are no variable arguments and
+				   does not paste otherwise */
+				if (paste && macro->variadic && right->param + 1 == macro->num_params && out->tokens[out->count - 1].kind == ',') {
+					out->count -= !count;
+					paste = false;
+				}
+			}
+
+			uint first = 0;
+			if (count && paste) {
+				cparse_pp_paste(s, out->tokens + out->count - 1, operand);
+				first = 1;
+			}
+			for (uint j = first; j < count; ++j)
+				cparse_token_array_push(s, out, operand + j);
+			left_empty = left_empty && !count;
+		}
+		else if (tok->kind == CPARSE_TOK_MACRO_PARAM) {
+			struct cparse_pp_arg* arg = args + tok->param;
+			const uint first = out->count;
+
+			/* operands of ## are not macro-replaced */
+			if (i + 1 < macro->num_tokens && body[i + 1].kind == CPARSE_TOK_HASHHASH) {
+				for (uint j = 0; j < arg->count; ++j)
+					cparse_token_array_push(s, out, arg->tokens + j);
+				left_empty = !arg->count;
+			}
+			else {
+				if (!arg->is_expanded) {
+					struct cparse_token_array expanded = { 0 };
+					cparse_pp_expand_list(s, arg->tokens, arg->count, &expanded);
+					arg->expanded = expanded.tokens;
+					arg->expanded_count = expanded.count;
+					arg->is_expanded = true;
+				}
+				for (uint j = 0; j < arg->expanded_count; ++j)
+					cparse_token_array_push(s, out, arg->expanded + j);
+				left_empty = false;
+			}
+
+			if (out->count > first)
+				out->tokens[first].flags = (out->tokens[first].flags & ~CPARSE_TOKEN_SPACE) | (tok->flags & CPARSE_TOKEN_SPACE);
+		}
+		else {
+			cparse_token_array_push(s, out, tok);
+			left_empty = false;
+		}
+	}
+}
+
+/* expands the macro named by name, returns false if a function-like macro is not invoked */
+static bool cparse_pp_expand(struct cparse_state* s, struct cparse_macro* macro, struct cparse_token const* name)
+{
+	struct cparse_token_array expansion = { 0 };
+
+	if (macro->builtin == CPARSE_MACRO_FILE) {
+		const char* filename = s->lex.filename;
+		char* text = cparse_alloc(s, strlen(filename) * 2 + 3, 1);
+		char* p = text;
+		*p++ = '"';
+		for (; *filename; ++filename) {
+			if (*filename == '\\' || *filename == '"')
+				*p++ = '\\';
+			*p++ = *filename;
+		}
+		*p++ = '"';
+		struct cparse_token tok = { CPARSE_TOK_STRING, 0, text, (uint)(p - text), 0 };
+		cparse_token_array_push(s, &expansion, &tok);
+	}
+	else if (macro->builtin == CPARSE_MACRO_LINE) {
+		char* text = cparse_alloc(s, 16, 1);
+		struct cparse_token tok = { CPARSE_TOK_INTEGER, 0, text, (uint)cparse_format(text, 16, "%u", s->lex.line), 0 };
+		cparse_token_array_push(s, &expansion, &tok);
+	}
+	else if (macro->function_like) {
+		struct cparse_token paren;
+		cparse_pp_read(s, &paren);
+		if (paren.kind != '(') {
+			if (paren.kind != CPARSE_TOK_EOF)
+				cparse_pp_unread(s, &paren);
+			return false;
+		}
+		cparse_pp_substitute(s, macro, cparse_pp_collect_args(s, macro), &expansion);
+	}
+	else {
+		cparse_pp_substitute(s, macro, NULL, &expansion);
+	}
+
+	/* the expansion takes the place of the name */
+	if (expansion.count)
+		expansion.tokens[0].flags = (expansion.tokens[0].flags & ~(CPARSE_TOKEN_SPACE | CPARSE_TOKEN_LINE_START)) | (name->flags & (CPARSE_TOKEN_SPACE | CPARSE_TOKEN_LINE_START));
+
+	cparse_pp_push_context(s, expansion.tokens, expansion.count, macro);
+	macro->expanding = true;
+	return true;
+}
+
+/* #define */
+
+static void cparse_pp_define(struct cparse_state* s)
+{
+	struct cparse_lexer* l = &s->lex;
+	struct cparse_token tok;
+
+	if (!cparse_pp_line_token(s, &tok) || !cparse_token_is_identifier(&tok))
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "macro names must be identifiers.");
+
+	struct cparse_macro* macro = cparse_pp_get_macro(s, tok.text, tok.length);
+	if (macro->builtin != CPARSE_MACRO_USER)
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "redefining builtin macro '%.*s'.", tok.length, tok.text);
+
+	struct cparse_token_array params = { 0 };
+	bool variadic = false;
+	const bool function_like = l->curr == '(';
+
+	if (function_like) {
+		cparse_lex_skip(s);
+		if (!cparse_pp_line_token(s, &tok))
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "missing ')' in macro parameter list.");
+
+		while (tok.kind != ')') {
+			if (tok.kind == CPARSE_TOK_ELLIPSIS) {
+				static const char va_args[] = "__VA_ARGS__";
+				tok.text = va_args;
+				tok.length = sizeof(va_args) - 1;
+				variadic = true;
+			}
+			else if (!cparse_token_is_identifier(&tok)) {
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "invalid macro parameter '%.*s'.", tok.length, tok.text);
+			}
+			cparse_token_array_push(s, &params, &tok);
+
+			if (!cparse_pp_line_token(s, &tok) || (tok.kind != ')' && (variadic || tok.kind != ',')))
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "expected ',' or ')' in macro parameter list.");
+			if (tok.kind == ',' && (!cparse_pp_line_token(s, &tok) || tok.kind == ')'))
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "expected parameter name in macro parameter list.");
+		}
+	}
+
+	struct cparse_token_array body = { 0 };
+	while (cparse_pp_line_token(s, &tok)) {
+		if (function_like && cparse_token_is_identifier(&tok)) {
+			for (uint i = 0; i < params.count; ++i) {
+				if (params.tokens[i].length == tok.length && memcmp(params.tokens[i].text, tok.text, tok.length) == 0) {
+					tok.kind = CPARSE_TOK_MACRO_PARAM;
+					tok.param = i;
+					break;
+				}
+			}
+		}
+		if (!body.count)
+			tok.flags &= ~CPARSE_TOKEN_SPACE;
+		cparse_token_array_push(s, &body, &tok);
+	}
+
+	if (body.count && (body.tokens[0].kind == CPARSE_TOK_HASHHASH || body.tokens[body.count - 1].kind == CPARSE_TOK_HASHHASH))
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "'##' cannot appear at either end of a macro expansion.");
+
+	if (function_like) {
+		for (uint i = 0; i < body.count; ++i) {
+			if (body.tokens[i].kind == '#' && (i + 1 == body.count || body.tokens[i + 1].kind != CPARSE_TOK_MACRO_PARAM))
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "'#' is not followed by a macro parameter.");
+		}
+	}
+
+	macro->defined = true;
+	macro->function_like = function_like;
+	macro->variadic = variadic;
+	macro->num_params = params.count;
+	macro->tokens = body.tokens;
+	macro->num_tokens = body.count;
+}
+
+/* defines "NAME" or "NAME=VALUE" as if by #define NAME VALUE, VALUE defaults to 1 */
+static void cparse_pp_define_string(struct cparse_state* s, const char* definition)
+{
+	const char* assign = strchr(definition, '=');
+	const size_t name_length = assign ? (size_t)(assign - definition) : strlen(definition);
+	const char* value = assign ? assign + 1 : "1";
+	const size_t length = name_length + 1 + strlen(value);
+
+	char* text = cparse_alloc(s, length + 1, 1);
+	memcpy(text, definition, name_length);
+	text[name_length] = ' ';
+	strcpy(text + name_length + 1, value);
+
+	const struct cparse_lexer saved = s->lex;
+	cparse_lex_begin(s, "<command line>", text, length);
+	s->lex.line_start = false;
+	cparse_pp_define(s);
+	s->lex = saved;
+}
+
+/* #include */
+
+static void cparse_pp_push_file(struct cparse_state* s, const char* name, uint length, bool angled, bool next)
+{
+	struct cparse_preprocessor* pp = &s->pp;
+	const char** dirs = s->info->include_dirs;
+	const uint64_t open_begin = cparse_stats_enabled(s) ? cparse_ticks() : 0;
+
+	if (pp->include_depth >= CPARSE_MAX_INCLUDE_DEPTH)
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "#include nested too deeply.");
+
+	/* quoted names are looked up next to the including file first */
+	const char* dir = "";
+	size_t dir_length = 0;
+	if (!angled && !next) {
+		for (const char* p = s->lex.filename; *p; ++p) {
+			if (*p == '/' || *p == '\\')
+				dir_length = p - s->lex.filename + 1;
+		}
+		dir = s->lex.filename;
+	}
+
+	size_t max_dir_length = dir_length;
+	for (int i = 0; dirs && dirs[i]; ++i) {
+		if (strlen(dirs[i]) + 1 > max_dir_length)
+			max_dir_length = strlen(dirs[i]) + 1;
+	}
+
+	char* path = alloca(max_dir_length + length + 1);
+	struct cparse_source_file file = { NULL, 0, false };
+	int dir_index = -1;
+
+	if (!angled && !next) {
+		memcpy(path, dir, dir_length);
+		memcpy(path + dir_length, name, length);
+		path[dir_length + length] = 0;
+		cparse_source_file_open(&file, path);
+	}
+
+	for (int i = next ? pp->dir_index + 1 : 0; !file.data && dirs && dirs[i]; ++i) {
+		size_t n = strlen(dirs[i]);
+		memcpy(path, dirs[i], n);
+		if (n && dirs[i][n - 1] != '/' && dirs[i][n - 1] != '\\')
+			path[n++] = '/';
+		memcpy(path + n, name, length);
+		path[n + length] = 0;
+		cparse_source_file_open(&file, path);
+		dir_index = i;
+	}
+
+	if (!file.data)
+		cparse_error(s, CPARSE_RESULT_INVALID_INPUT_FILE, "'%.*s' file not found.", length, name);
+
+	/* the include directive runs inside cparse_lex, move the time out of lexing */
+	if (cparse_stats_enabled(s)) {
+		const uint64_t open_ticks = cparse_ticks() - open_begin;
+		s->open_ticks += open_ticks;
+		s->lex_ticks -= open_ticks;
+		s->stats->bytes_read += file.size;
+		++s->stats->files_read;
+	}
+
+	const uint hash = cparse_hash(path, (uint)strlen(path));
+	for (struct cparse_pp_once* once = pp->once; once; once = once->next) {
+		if (once->hash == hash && strcmp(once->path, path) == 0) {
+			cparse_source_file_close(&file);
+			return;
+		}
+	}
+
+	char* filename = cparse_alloc(s, strlen(path) + 1, 1);
+	strcpy(filename, path);
+
+	if (s->flags & CPARSE_STATE_CACHE) {
+		struct cparse_pp_dependency* dependency = cparse_alloc_type(s, struct cparse_pp_dependency);
+		dependency->path = filename;
+		dependency->hash = cparse_hash64(CPARSE_CACHE_MAGIC, file.data, file.size);
+		dependency->next = pp->dependencies;
+		pp->dependencies = dependency;
+	}
+
+	/* the file must stay alive until the end of the parse, or as long as the unit with slices */
+	const char* data = file.data;
+	if (s->flags & CPARSE_FLAG_SPELLING_SLICES) {
+		char* copy = cparse_alloc(s, file.size, 1);
+		memcpy(copy, file.data, file.size);
+		cparse_source_file_close(&file);
+		data = copy;
+	}
+	else {
+		struct cparse_pp_source* source = cparse_alloc_type(s, struct cparse_pp_source);
+		source->file = file;
+		source->next = pp->sources;
+		pp->sources = source;
+	}
+
+	struct cparse_pp_include* include = cparse_alloc_type(s, struct cparse_pp_include);
+	include->prev = pp->include;
+	include->lex = s->lex;
+	include->conditionals = pp->conditionals;
+	include->dir_index = pp->dir_index;
+	pp->include = include;
+	++pp->include_depth;
+	pp->dir_index = dir_index;
+
+	cparse_lex_begin(s, filename, data, file.size);
+}
+
+static void cparse_pp_include(struct cparse_state* s, bool next)
+{
+	struct cparse_lexer* l = &s->lex;
+	const char* name = NULL;
+	uint length = 0;
+	bool angled = false;
+
+	cparse_lex_skip_blanks(s);
+	if (!l->line_start && (l->curr == '"' || l->curr == '<')) {
+		angled = l->curr == '<';
+		const char close = angled ? '>' : '"';
+		const char* p = name = l->cursor;
+		while (p < l->source_end && *p != close && *p != '\n')
+			++p;
+		if (p == l->source_end || *p != close)
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "missing terminating %c character.", close);
+		length = (uint)(p - name);
+		cparse_lex_seek(s, p + 1);
+	}
+	else {
+		/* computed include, the macro-replaced line must have one of the two forms above */
+		struct cparse_token_array line = { 0 }, expanded = { 0 };
+		struct cparse_token tok;
+		while (cparse_pp_line_token(s, &tok))
+			cparse_token_array_push(s, &line, &tok);
+		cparse_pp_expand_list(s, line.tokens, line.count, &expanded);
+
+		if (expanded.count && expanded.tokens[0].kind == CPARSE_TOK_STRING) {
+			name = expanded.tokens[0].text + 1;
+			length = expanded.tokens[0].length - 2;
+		}
+		else if (expanded.count && expanded.tokens[0].kind == '<') {
+			uint size = 0;
+			for (uint i = 1; i < expanded.count; ++i)
+				size += expanded.tokens[i].length + 1;
+
+			char* text = cparse_alloc(s, size + 1, 1);
+			uint i = 1;
+			for (; i < expanded.count && expanded.tokens[i].kind != '>'; ++i) {
+				if (i > 1 && (expanded.tokens[i].flags & CPARSE_TOKEN_SPACE))
+					text[length++] = ' ';
+				memcpy(text + length, expanded.tokens[i].text, expanded.tokens[i].length);
+				length += expanded.tokens[i].length;
+			}
+			if (i == expanded.count)
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "missing terminating > character.");
+			name = text;
+			angled = true;
+		}
+		else {
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "#include expects \"FILENAME\" or <FILENAME>.");
+		}
+	}
+
+	cparse_pp_skip_line(s);
+	cparse_pp_push_file(s, name, length, angled, next);
+}
+
+/* returns to the includer at the end of an included file, or returns false at the end of the main file */
+static bool cparse_pp_end_of_file(struct cparse_state* s)
+{
+	struct cparse_preprocessor* pp = &s->pp;
+	struct cparse_pp_include* include = pp->include;
+
+	if (pp->conditionals != (include ? include->conditionals : NULL))
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "unterminated conditional directive.");
+
+	if (!include)
+		return false;
+
+	s->lex = include->lex;
+	pp->dir_index = include->dir_index;
+	pp->include = include->prev;
+	--pp->include_depth;
+	return true;
+}
+
+/* #if expressions */
+
+struct cparse_pp_expr {
+	struct cparse_token const* tokens;
+	uint count;
+	uint index;
+};
+
+static int cparse_pp_binary_precedence(cparse_token_t kind)
+{
+	switch (kind)
+	{
+		case '*': case '/': case '%': return 10;
+		case '+': case '-': return 9;
+		case CPARSE_TOK_SHL: case CPARSE_TOK_SHR: return 8;
+		case '<': case '>': case CPARSE_TOK_LE: case CPARSE_TOK_GE: return 7;
+		case CPARSE_TOK_EQ: case CPARSE_TOK_NE: return 6;
+		case '&': return 5;
+		case '^': return 4;
+		case '|': return 3;
+		case CPARSE_TOK_AND: return 2;
+		case CPARSE_TOK_OR: return 1;
+		default: return 0;
+	}
+}
+
+static long long cparse_pp_char_value(struct cparse_token const* tok)
+{
+	const char* p = (const char*)memchr(tok->text, '\'', tok->length) + 1;
+	if (*p != '\\')
+		return (unsigned char)*p;
+
+	switch (*++p)
+	{
+		case 'n': return '\n';
+		case 't': return '\t';
+		case 'r': return '\r';
+		case 'a': return '\a';
+		case 'b': return '\b';
+		case 'f': return '\f';
+		case 'v': return '\v';
+		case 'x': {
+			long long value = 0;
+			for (++p; (*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F'); ++p)
+				value = value * 16 + (*p <= '9' ? *p - '0' : (*p | 0x20) - 'a' + 10);
+			return value;
+		}
+		default:
+			if (*p >= '0' && *p <= '7') {
+				long long value = 0;
+				for (int i = 0; i < 3 && *p >= '0' && *p <= '7'; ++i, ++p)
+					value = value * 8 + (*p - '0');
+				return value;
+			}
+			return (unsigned char)*p;
+	}
+}
+
+static long long cparse_pp_eval(struct cparse_state* s, struct cparse_pp_expr* e, int min_precedence, bool evaluate);
+
+static struct cparse_token const* cparse_pp_expr_next(struct cparse_state* s, struct cparse_pp_expr* e)
+{
+	if (e->index == e->count)
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "unexpected end of #if expression.");
+	return e->tokens + e->index++;
+}
+
+static long long cparse_pp_eval_unary(struct cparse_state* s, struct cparse_pp_expr* e, bool evaluate)
+{
+	struct cparse_token const* tok = cparse_pp_expr_next(s, e);
+
+	switch (tok->kind)
+	{
+		case '+': return cparse_pp_eval_unary(s, e, evaluate);
+		case '-': return (long long)(0ull - (unsigned long long)cparse_pp_eval_unary(s, e, evaluate));
+		case '!': return !cparse_pp_eval_unary(s, e, evaluate);
+		case '~': return ~cparse_pp_eval_unary(s, e, evaluate);
+
+		case '(': {
+			long long value = cparse_pp_eval(s, e, 0, evaluate);
+			if (cparse_pp_expr_next(s, e)->kind != ')')
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "missing ')' in #if expression.");
+			return value;
+		}
+
+		case CPARSE_TOK_INTEGER: {
+			unsigned long long value;
+			if (!cparse_parse_integer_literal(tok->text, tok->length, &value))
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "invalid integer constant '%.*s' in #if expression.", tok->length, tok->text);
+			return (long long)value;
+		}
+
+		case CPARSE_TOK_CHAR:
+			return cparse_pp_char_value(tok);
+
+		default:
+			if (cparse_token_is_identifier(tok)) {
+				/* identifiers left after macro replacement are zero, skip the arguments of unknown
+				   function-like ones such as __has_include */
+				if (e->index < e->count && e->tokens[e->index].kind == '(') {
+					for (uint depth = 0;;) {
+						cparse_token_t kind = cparse_pp_expr_next(s, e)->kind;
+						if (kind == '(') ++depth;
+						else if (kind == ')' && !--depth) break;
+					}
+				}
+				return 0;
+			}
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "token '%.*s' is not valid in preprocessor expressions.", tok->length, tok->text);
+			return 0;
+	}
+}
+
+static long long cparse_pp_eval(struct cparse_state* s, struct cparse_pp_expr* e, int min_precedence, bool evaluate)
+{
+	long long lhs = cparse_pp_eval_unary(s, e, evaluate);
+
+	while (e->index < e->count) {
+		const cparse_token_t op = e->tokens[e->index].kind;
+
+		/* the conditional operator has the lowest precedence and is right associative */
+		if (op == '?') {
+			if (min_precedence > 0)
+				break;
+			++e->index;
+			long long a = cparse_pp_eval(s, e, 0, evaluate && lhs);
+			if (cparse_pp_expr_next(s, e)->kind != ':')
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "missing ':' in #if expression.");
+			long long b = cparse_pp_eval(s, e, 0, evaluate && !lhs);
+			lhs = lhs ? a : b;
+			continue;
+		}
+
+		const int precedence = cparse_pp_binary_precedence(op);
+		if (precedence <= min_precedence)
+			break;
+		++e->index;
+
+		const bool short_circuit = (op == CPARSE_TOK_AND && !lhs) || (op == CPARSE_TOK_OR && lhs);
+		const long long rhs = cparse_pp_eval(s, e, precedence, evaluate && !short_circuit);
+		const unsigned long long a = (unsigned long long)lhs, b = (unsigned long long)rhs;
+
+		switch (op)
+		{
+			case '/':
+			case '%':
+				if (!rhs) {
+					if (evaluate)
+						cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "division by zero in #if expression.");
+					lhs = 0;
+				}
+				else if (rhs == -1) {
+					lhs = op == '/' ? (long long)(0ull - a) : 0;
+				}
+				else {
+					lhs = op == '/' ? lhs / rhs : lhs % rhs;
+				}
+				break;
+
+			case '*': lhs = (long long)(a * b); break;
+			case '+': lhs = (long long)(a + b); break;
+			case '-': lhs = (long long)(a - b); break;
+			case CPARSE_TOK_SHL: lhs = (long long)(a << (b & 63)); break;
+			case CPARSE_TOK_SHR: lhs = lhs >> (b & 63); break;
+			case '<': lhs = lhs < rhs; break;
+			case '>': lhs = lhs > rhs; break;
+			case CPARSE_TOK_LE: lhs = lhs <= rhs; break;
+			case CPARSE_TOK_GE: lhs = lhs >= rhs; break;
+			case CPARSE_TOK_EQ: lhs = lhs == rhs; break;
+			case CPARSE_TOK_NE: lhs = lhs != rhs; break;
+			case '&': lhs = lhs & rhs; break;
+			case '^': lhs = lhs ^ rhs; break;
+			case '|': lhs = lhs | rhs; break;
+			case CPARSE_TOK_AND: lhs = lhs && rhs; break;
+			case CPARSE_TOK_OR: lhs = lhs || rhs; break;
+		}
+	}
+
+	return lhs;
+}
+
+/* evaluates the rest of the directive line */
+static bool cparse_pp_eval_line(struct cparse_state* s)
+{
+	struct cparse_token_array line = { 0 };
+	struct cparse_token tok;
+
+	/* defined operators are resolved before macro replacement */
+	while (cparse_pp_line_token(s, &tok)) {
+		if (tok.kind == CPARSE_TOK_IDENTIFIER && cparse_token_is(&tok, "defined")) {
+			bool paren = false;
+			if (cparse_pp_line_token(s, &tok) && tok.kind == '(') {
+				paren = true;
+				cparse_pp_line_token(s, &tok);
+			}
+			if (!cparse_token_is_identifier(&tok))
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "operator 'defined' requires an identifier.");
+
+			const bool defined = cparse_pp_find_macro(&s->pp, tok.text, tok.length) != NULL;
+			if (paren && (!cparse_pp_line_token(s, &tok) || tok.kind != ')'))
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "missing ')' after 'defined'.");
+
+			tok.kind = CPARSE_TOK_INTEGER;
+			tok.text = defined ? "1" : "0";
+			tok.length = 1;
+		}
+		cparse_token_array_push(s, &line, &tok);
+	}
+
+	struct cparse_token_array expanded = { 0 };
+	cparse_pp_expand_list(s, line.tokens, line.count, &expanded);
+	if (!expanded.count)
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "#if with no expression.");
+
+	struct cparse_pp_expr e = { expanded.tokens, expanded.count, 0 };
+	const long long value = cparse_pp_eval(s, &e, 0, true);
+	if (e.index != e.count)
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "missing binary operator before '%.*s'.", e.tokens[e.index].length, e.tokens[e.index].text);
+
+	return value != 0;
+}
+
+/* conditional directives */
+
+static bool cparse_pp_in_conditional(struct cparse_preprocessor const* pp)
+{
+	return pp->conditionals && pp->conditionals != (pp->include ? pp->include->conditionals : NULL);
+}
+
+/* skips lines up to the next group to include or past the matching #endif */
+static void cparse_pp_skip_group(struct cparse_state* s)
+{
+	struct cparse_lexer* l = &s->lex;
+	struct cparse_pp_conditional* conditional = s->pp.conditionals;
+	uint depth = 0;
+
+	for (;;) {
+		cparse_lex_skip_blanks(s);
+		if (l->curr < 0)
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "unterminated conditional directive.");
+
+		if (!l->line_start || l->curr != '#') {
+			l->line_start = false;
+			cparse_pp_skip_line(s);
+			continue;
+		}
+
+		l->line_start = false;
+		cparse_lex_skip(s);
+
+		struct cparse_token name;
+		if (!cparse_pp_directive_name(s, &name))
+			continue;
+
+		if (cparse_token_is(&name, "if") || cparse_token_is(&name, "ifdef") || cparse_token_is(&name, "ifndef")) {
+			++depth;
+		}
+		else if (cparse_token_is(&name, "endif")) {
+			if (!depth--) {
+				s->pp.conditionals = conditional->prev;
+				cparse_pp_skip_line(s);
+				return;
+			}
+		}
+		else if (!depth && cparse_token_is(&name, "elif")) {
+			if (conditional->has_else)
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "#elif after #else.");
+			if (!conditional->taken && cparse_pp_eval_line(s)) {
+				conditional->taken = true;
+				return;
+			}
+		}
+		else if (!depth && cparse_token_is(&name, "else")) {
+			if (conditional->has_else)
+				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "#else after #else.");
+			conditional->has_else = true;
+			if (!conditional->taken) {
+				conditional->taken = true;
+				cparse_pp_skip_line(s);
+				return;
+			}
+		}
+	}
+}
+
+static void cparse_pp_if(struct cparse_state* s, bool value)
+{
+	struct cparse_pp_conditional* conditional = cparse_alloc_type(s, struct cparse_pp_conditional);
+	conditional->prev = s->pp.conditionals;
+	conditional->taken = value;
+	conditional->has_else = false;
+	s->pp.conditionals = conditional;
+
+	if (!value)
+		cparse_pp_skip_group(s);
+}
+
+static void cparse_pp_directive(struct cparse_state* s)
+{
+	struct cparse_preprocessor* pp = &s->pp;
+	struct cparse_token name, tok;
+
+	/* the null directive, also skips line markers such as # 1 "file" */
+	if (!cparse_pp_directive_name(s, &name)) {
+		cparse_pp_skip_line(s);
+		return;
+	}
+
+	if (cparse_token_is(&name, "define")) {
+		cparse_pp_define(s);
+	}
+	else if (cparse_token_is(&name, "undef")) {
+		if (!cparse_pp_line_token(s, &tok) || !cparse_token_is_identifier(&tok))
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "macro names must be identifiers.");
+		struct cparse_macro* macro = cparse_pp_find_macro(pp, tok.text, tok.length);
+		if (macro && macro->builtin == CPARSE_MACRO_USER)
+			macro->defined = false;
+		cparse_pp_skip_line(s);
+	}
+	else if (cparse_token_is(&name, "include") || cparse_token_is(&name, "include_next")) {
+		cparse_pp_include(s, cparse_token_is(&name, "include_next") && pp->include);
+	}
+	else if (cparse_token_is(&name, "ifdef") || cparse_token_is(&name, "ifndef")) {
+		if (!cparse_pp_line_token(s, &tok) || !cparse_token_is_identifier(&tok))
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "no macro name given in #%.*s directive.", name.length, name.text);
+		const bool defined = cparse_pp_find_macro(pp, tok.text, tok.length) != NULL;
+		cparse_pp_skip_line(s);
+		cparse_pp_if(s, defined == (name.length == 5));
+	}
+	else if (cparse_token_is(&name, "if")) {
+		cparse_pp_if(s, cparse_pp_eval_line(s));
+	}
+	else if (cparse_token_is(&name, "elif") || cparse_token_is(&name, "else")) {
+		if (!cparse_pp_in_conditional(pp))
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "#%.*s without #if.", name.length, name.text);
+		if (pp->conditionals->has_else)
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "#%.*s after #else.", name.length, name.text);
+
+		/* a group was included, skip the rest of the conditional */
+		pp->conditionals->has_else = cparse_token_is(&name, "else");
+		cparse_pp_skip_line(s);
+		cparse_pp_skip_group(s);
+	}
+	else if (cparse_token_is(&name, "endif")) {
+		if (!cparse_pp_in_conditional(pp))
+			cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "#endif without #if.");
+		pp->conditionals = pp->conditionals->prev;
+		cparse_pp_skip_line(s);
+	}
+	else if (cparse_token_is(&name, "pragma")) {
+		if (cparse_pp_line_token(s, &tok) && cparse_token_is(&tok, "once")) {
+			struct cparse_pp_once* once = cparse_alloc_type(s, struct cparse_pp_once);
+			once->path = s->lex.filename;
+			once->hash = cparse_hash(once->path, (uint)strlen(once->path));
+			once->next = pp->once;
+			pp->once = once;
+		}
+		cparse_pp_skip_line(s);
+	}
+	else if (cparse_token_is(&name, "error")) {
+		const char* begin = cparse_lex_position(&s->lex);
+		cparse_pp_skip_line(s);
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "#error%.*s", (int)(cparse_lex_position(&s->lex) - begin), begin);
+	}
+	else if (cparse_token_is(&name, "warning") || cparse_token_is(&name, "line") || cparse_token_is(&name, "ident")) {
+		cparse_pp_skip_line(s);
+	}
+	else {
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "invalid preprocessing directive #%.*s.", name.length, name.text);
+	}
+}
+
+/* reads the next token, executing directives but without macro replacement */
+static void cparse_pp_read(struct cparse_state* s, struct cparse_token* tok)
+{
+	struct cparse_preprocessor* pp = &s->pp;
+	struct cparse_lexer* l = &s->lex;
+
+	for (;;) {
+		struct cparse_pp_context* context = pp->context;
+		if (context) {
+			if (context->index < context->count) {
+				*tok = context->tokens[context->index++];
+				return;
+			}
+			if (context->boundary) {
+				tok->kind = CPARSE_TOK_EOF;
+				tok->flags = 0;
+				tok->text = "";
+				tok->length = 0;
+				return;
+			}
+			cparse_pp_pop_context(s);
+			continue;
+		}
+
+		const char* before = cparse_lex_position(l);
+		cparse_lex_skip_blanks(s);
+		tok->flags = (l->line_start ? CPARSE_TOKEN_LINE_START : 0) | (before != cparse_lex_position(l) ? CPARSE_TOKEN_SPACE : 0);
+		l->line_start = false;
+		cparse_lex_token(s, tok);
+
+		if (tok->kind == '#' && (tok->flags & CPARSE_TOKEN_LINE_START)) {
+			/* macros, includes and conditionals outlive the declaration being streamed, expansions do not */
+			pp->rewritten = true;
+			cparse_arena_swap(s);
+			cparse_pp_directive(s);
+			cparse_arena_swap(s);
+		}
+		else if (tok->kind != CPARSE_TOK_EOF || !cparse_pp_end_of_file(s))
+			return;
+	}
+}
+
+/* reads the next fully macro-replaced token */
+static void cparse_pp_next(struct cparse_state* s, struct cparse_token* tok)
+{
+	for (;;) {
+		cparse_pp_read(s, tok);
+		if (!cparse_token_is_identifier(tok) || (tok->flags & CPARSE_TOKEN_NO_EXPAND))
+			return;
+
+		struct cparse_macro* macro = cparse_pp_find_macro(&s->pp, tok->text, tok->length);
+		if (!macro)
+			return;
+
+		if (macro->expanding) {
+			tok->flags |= CPARSE_TOKEN_NO_EXPAND;
+			return;
+		}
+
+		s->pp.rewritten = true;
+		if (!cparse_pp_expand(s, macro, tok))
+			return;
+	}
+}
+
+static void cparse_pp_init(struct cparse_state* s)
+{
+	static const char* const predefined[] = { "__STDC__=1", "__STDC_VERSION__=201112L", "__STDC_HOSTED__=1", NULL };
+
+	struct cparse_preprocessor* pp = &s->pp;
+	memset(pp, 0, sizeof(struct cparse_preprocessor));
+	pp->dir_index = -1;
+
+	struct cparse_macro* file = cparse_pp_get_macro(s, "__FILE__", 8);
+	file->builtin = CPARSE_MACRO_FILE;
+	file->defined = true;
+
+	struct cparse_macro* line = cparse_pp_get_macro(s, "__LINE__", 8);
+	line->builtin = CPARSE_MACRO_LINE;
+	line->defined = true;
+
+	for (const char* const* define = predefined; *define; ++define)
+		cparse_pp_define_string(s, *define);
+
+	for (const char** define = s->info->defines; define && *define; ++define)
+		cparse_pp_define_string(s, *define);
+}
+
+/* closes the files opened by #include */
+static void cparse_pp_release_sources(struct cparse_state* s)
+{
+	for (struct cparse_pp_source* source = s->pp.sources; source; source = source->next)
+		cparse_source_file_close(&source->file);
+	s->pp.sources = NULL;
+}
+
+/* reads the next token for the parser. tokens are lexed on demand, the parser never looks further than the one
+   token ahead, and lexing the whole input into token arrays before parsing was measured slower. */
+static cparse_token_t cparse_lex(struct cparse_state* s)
+{
+	struct cparse_token tok;
+	s->lexing = true;
+	if (cparse_stats_enabled(s)) {
+		const uint64_t begin = cparse_ticks();
+		cparse_pp_next(s, &tok);
+		s->lex_ticks += cparse_ticks() - begin;
+	}
+	else {
+		cparse_pp_next(s, &tok);
+	}
+	s->lexing = false;
+	s->lex.lookahead = tok.kind;
+	s->lex.token = tok.text;
+	s->lex.token_size = tok.length;
+	return tok.kind;
+}
+
+/* parsing helpers */
+
+static void cparse_error_syntax(struct cparse_state* s)
+{
+	cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "unexpected '%.*s'.", s->lex.token_size, s->lex.token);
+}
+
+static void cparse_error_syntax_expected(struct cparse_state* s, cparse_token_t tok)
+{
+	char spelling[2];
+	cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "missing '%s' before '%.*s'.", cparse_strtok(tok, spelling), s->lex.token_size, s->lex.token);
+}
+
+static bool cparse_peek(struct cparse_state* s, cparse_token_t tok)
+{
+	return s->lex.lookahead == tok;
+}
+
+static bool cparse_accept(struct cparse_state* s, cparse_token_t tok)
+{
+	if (cparse_peek(s, tok))
+	{
+		cparse_lex(s);
+		return true;
+	}
+	return false;
+}
+
+static void cparse_check(struct cparse_state* s, cparse_token_t tok)
+{
+	if (!cparse_peek(s, tok))
+		cparse_error_syntax_expected(s, tok);
+}
+
+static void cparse_expect(struct cparse_state* s, cparse_token_t tok)
+{
+	cparse_check(s, tok);
+	cparse_lex(s);
+}
+
+/* reads the value of the current integer literal token */
+static long long cparse_token_integer(struct cparse_state* s)
+{
+	unsigned long long value;
+	if (!cparse_parse_integer_literal(s->lex.token, s->lex.token_size, &value))
+		cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "invalid integer constant '%.*s'.", s->lex.token_size, s->lex.token);
+	if (value > LLONG_MAX)
+		cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "integer constant '%.*s' is too large.", s->lex.token_size, s->lex.token);
+	return (long long)value;
+}
+
+/* sets the current token as the spelling of decl, the token stays the lookahead so that errors point at it */
+static void cparse_copy_spelling(struct cparse_state* s, struct cparse_decl* decl)
+{
+	decl->spelling_length = s->lex.token_size;
+
+	if (s->context) {
+		decl->spelling = cparse_context_intern(s->context, s->lex.token, s->lex.token_size);
+		if (!decl->spelling)
+			cparse_error_out_of_memory(s);
+	}
+	else if (s->flags & CPARSE_FLAG_SPELLING_SLICES) {
+		decl->spelling = s->lex.token;
+	}
+	else {
+		char* spelling = cparse_alloc(s, s->lex.token_size + 1, 1);
+		memcpy(spelling, s->lex.token, s->lex.token_size);
+		spelling[s->lex.token_size] = 0;
+		decl->spelling = spelling;
+	}
+}
+
+/* sets the current token as the spelling of decl and eats it */
+static void cparse_scan_spelling(struct cparse_state* s, struct cparse_decl* decl)
+{
+	cparse_copy_spelling(s, decl);
+	cparse_lex(s);
+}
+
+/* function bodies, parameter lists and initializers */
+
+/* whether the lookahead was read from the source as written, not from an included file or a macro expansion */
+static bool cparse_token_in_source(struct cparse_state const* s)
+{
+	return !s->pp.context && !s->pp.include;
+}
+
+enum cparse_skip_kind {
+	CPARSE_SKIP_BODY, /* up to the '}' that closes it */
+	CPARSE_SKIP_PARAMETERS, /* up to the ')' that closes them, or the first ';' outside of braces if it is missing */
+	CPARSE_SKIP_INITIALIZER, /* up to the ',' or ';' after it */
+};
+
+/* skips a function body or parameter list, the lookahead being the bracket that opens it, or an initializer starting at
+   the lookahead, and leaves the lookahead on the token that ends it. the text is scanned without being lexed wherever
+   the preprocessor has nothing to do, that is up to the next directive and unless the lookahead comes from the tokens
+   of a macro expansion. [*begin, *end) is set to the text skipped as in cparse_decl_function. */
+static void cparse_skip(struct cparse_state* s, enum cparse_skip_kind kind, cparse_size_t* begin, cparse_size_t* end)
+{
+	struct cparse_lexer* l = &s->lex;
+	const char* first = l->token;
+	const bool first_in_source = cparse_token_in_source(s);
+	const bool balanced = kind != CPARSE_SKIP_INITIALIZER;
+	const cparse_token_t closer = kind == CPARSE_SKIP_INITIALIZER ? ';' : kind == CPARSE_SKIP_PARAMETERS ? ')' : '}';
+
+	/* a ';' outside of braces cannot be part of a parameter list, stopping there leaves the error at it instead of
+	   somewhere in the declarations that follow */
+	int braces = 0;
+	int* const parameter_braces = kind == CPARSE_SKIP_PARAMETERS ? &braces : NULL;
+
+	for (int depth = 0;; cparse_lex(s)) {
+		switch (l->lookahead) {
+			case '(': case '[': case '{':
+				++depth;
+				braces += l->lookahead == '{';
+				break;
+
+			case ')': case ']': case '}':
+				braces -= l->lookahead == '}';
+				if (--depth < 0 || (depth == 0 && balanced))
+					goto skipped;
+				break;
+
+			case ',': case ';':
+				if (depth == 0 && !balanced)
+					goto skipped;
+				if (l->lookahead == ';' && parameter_braces && braces == 0)
+					goto skipped;
+				break;
+
+			case CPARSE_TOK_EOF:
+				cparse_error_syntax_expected(s, closer);
+				break;
+		}
+
+		if (!s->pp.context) {
+			const char* p = cparse_lex_position(l);
+			const char* from = p;
+			const bool stopped = cparse_scan_balanced(&p, l->source_end, !balanced, &depth, parameter_braces, &l->line, &l->line_begin);
+			if (cparse_stats_enabled(s))
+				s->stats->bytes_skipped += (cparse_size_t)(p - from);
+
+			if (stopped) {
+				l->lookahead = (cparse_token_t)*p;
+				l->token = p;
+				l->token_size = 1;
+				cparse_lex_seek(s, p + 1);
+				goto skipped;
+			}
+
+			/* the lexer takes over at the directive, or whatever the scanner could not skip */
+			cparse_lex_seek(s, p);
+			l->line_start = p < l->source_end && *p == '#';
+		}
+	}
+
+skipped:
+	if (!first_in_source || !cparse_token_in_source(s)) {
+		*begin = 0;
+		*end = 0;
+		return;
+	}
+
+	const char* last = l->token;
+	if (balanced)
+		last += l->token_size;
+	else {
+		while (last > first && cparse_char_class[(unsigned char)last[-1]] == CPARSE_CHAR_SPACE)
+			--last;
+	}
+	*begin = (cparse_size_t)(first - s->source);
+	*end = (cparse_size_t)(last - s->source);
+}
+
+/* error recovery */
+
+static const char* cparse_copy_string(struct cparse_state* s, const char* text, size_t length)
+{
+	char* copy = cparse_alloc(s, length + 1, 1);
+	memcpy(copy, text, length);
+	copy[length] = 0;
+	return copy;
+}
+
+/* CPARSE_FLAG_RECOVER: records the error at the current token, with the tags outside of a streamed declaration */
+static void cparse_diagnostic_add(struct cparse_state* s, enum cparse_result code, const char* message, size_t length)
+{
+	cparse_arena_swap(s);
+
+	struct cparse_diagnostic* diagnostic = cparse_alloc_type(s, struct cparse_diagnostic);
+	diagnostic->next = NULL;
+	diagnostic->code = code;
+	diagnostic->filename = cparse_copy_string(s, s->lex.filename, strlen(s->lex.filename));
+	diagnostic->line = (int)s->lex.line;
+	diagnostic->column = (int)cparse_lex_column(&s->lex);
+	diagnostic->token_length = cparse_peek(s, CPARSE_TOK_EOF) ? 0 : s->lex.token_size;
+	diagnostic->token = cparse_copy_string(s, s->lex.token, diagnostic->token_length);
+	diagnostic->message = cparse_copy_string(s, message, length);
+
+	cparse_arena_swap(s);
+
+	*s->last_diagnostic = diagnostic;
+	s->last_diagnostic = &diagnostic->next;
+}
+
+/* CPARSE_FLAG_RECOVER: skips what is left of the declaration that failed, that is up to its ';' or, within braces, to
+   the '}' that closes them. a declaration that only misses its ';' stops at the struct, enum or typedef that follows. */
+static void cparse_recover(struct cparse_state* s, const char* begin, bool within_braces)
+{
+	if (s->lex.token != begin && (cparse_peek(s, CPARSE_KW_STRUCT) || cparse_peek(s, CPARSE_KW_ENUM) || (!within_braces && cparse_peek(s, CPARSE_KW_TYPEDEF))))
+		return;
+
+	for (int depth = 0; !cparse_peek(s, CPARSE_TOK_EOF); cparse_lex(s)) {
+		if (cparse_peek(s, '{')) {
+			++depth;
+		}
+		else if (cparse_peek(s, '}')) {
+			if (depth == 0 && within_braces)
+				return;
+			if (depth <= 1 && !within_braces) {
+				/* closes the body the declaration failed in or one that was skipped, the ';' goes with it */
+				cparse_lex(s);
+				cparse_accept(s, ';');
+				return;
+			}
+			--depth;
+		}
+		else if (cparse_peek(s, ';') && depth == 0) {
+			cparse_lex(s);
+			return;
+		}
+	}
+}
+
+/* initialize functions */
+static void cparse_decl_init(struct cparse_state* s, struct cparse_decl* decl, enum cparse_decl_kind type)
+{
+	if (cparse_stats_enabled(s))
+		++s->stats->decls;
+
+	decl->kind = type;
+	decl->spelling = NULL;
+	decl->spelling_length = 0;
+	decl->next = NULL;
+	decl->referenced = 0;
+}
+
+/* types, each one made once per parse, see cparse_type_table_intern */
+
+static struct cparse_type* cparse_type_primitive(struct cparse_state* s, enum cparse_type_primitive_kind primitive_kind, enum cparse_type_qualifier qualifiers)
+{
+	struct cparse_type_key key;
+	key.kind = CPARSE_TYPE_PRIMITIVE;
+	key.qualifiers = qualifiers;
+	key.target = NULL;
+	key.value = primitive_kind;
+	struct cparse_type_slot* slot = cparse_type_table_intern(s, &key);
+	if (slot->type)
+		return slot->type;
+
+	struct cparse_type_primitive* primitive_type = cparse_alloc_type(s, struct cparse_type_primitive);
+	primitive_type->type.kind = CPARSE_TYPE_PRIMITIVE;
+	primitive_type->type.qualifiers = qualifiers;
+	primitive_type->type.size = s->abi->primitives[primitive_kind][0];
+	primitive_type->type.alignment = s->abi->primitives[primitive_kind][1];
+	primitive_type->kind = primitive_kind;
+	slot->type = (struct cparse_type*)primitive_type;
+	return (struct cparse_type*)primitive_type;
+}
+
+static struct cparse_type* cparse_type_pointer(struct cparse_state* s, struct cparse_type* pointee_type, enum cparse_type_qualifier qualifiers)
+{
+	struct cparse_type_key key;
+	key.kind = CPARSE_TYPE_POINTER;
+	key.qualifiers = qualifiers;
+	key.target = pointee_type;
+	key.value = 0;
+	struct cparse_type_slot* slot = cparse_type_table_intern(s, &key);
+	if (slot->type)
+		return slot->type;
+
+	struct cparse_type_pointer* ptr_type = cparse_alloc_type(s, struct cparse_type_pointer);
+	ptr_type->type.kind = CPARSE_TYPE_POINTER;
+	ptr_type->type.qualifiers = qualifiers;
+	ptr_type->type.size = s->abi->pointer[0];
+	ptr_type->type.alignment = s->abi->pointer[1];
+	ptr_type->pointee_type = pointee_type;
+	slot->type = (struct cparse_type*)ptr_type;
+	return (struct cparse_type*)ptr_type;
+}
+
+/* type of the enum or struct decl */
+static struct cparse_type* cparse_type_tag(struct cparse_state* s, struct cparse_decl* decl, enum cparse_type_qualifier qualifiers)
+{
+	struct cparse_type_key key;
+	key.kind = decl->kind == CPARSE_DECL_ENUM ? CPARSE_TYPE_ENUM : CPARSE_TYPE_STRUCT;
+	key.qualifiers = qualifiers;
+	key.target = decl;
+	key.value = 0;
+	struct cparse_type_slot* slot = cparse_type_table_intern(s, &key);
+	if (slot->type)
+		return slot->type;
+
+	if (decl->kind == CPARSE_DECL_ENUM) {
+		struct cparse_type_enum* enum_type = cparse_alloc_type(s, struct cparse_type_enum);
+		enum_type->type.kind = CPARSE_TYPE_ENUM;
+		enum_type->type.qualifiers = qualifiers;
+		enum_type->type.size = s->abi->primitives[CPARSE_PRIMITIVE_TYPE_SIGNED_INT][0];
+		enum_type->type.alignment = s->abi->primitives[CPARSE_PRIMITIVE_TYPE_SIGNED_INT][1];
+		enum_type->enum_type = (struct cparse_decl_enum*)decl;
+		slot->type = (struct cparse_type*)enum_type;
+		return (struct cparse_type*)enum_type;
+	}
+
+	struct cparse_type_struct* struct_type = cparse_alloc_type(s, struct cparse_type_struct);
+	struct_type->type.kind = CPARSE_TYPE_STRUCT;
+	struct_type->type.qualifiers = qualifiers;
+	struct_type->struct_type = (struct cparse_decl_struct*)decl;
+	struct_type->type.size = struct_type->struct_type->size;
+	struct_type->type.alignment = struct_type->struct_type->alignment;
+
+	/* only usable through pointers until the struct is defined */
+	if (!struct_type->type.alignment) {
+		struct cparse_incomplete_type* incomplete = cparse_alloc_type(s, struct cparse_incomplete_type);
+		incomplete->type = struct_type;
+		incomplete->next = s->incomplete_types;
+		s->incomplete_types = incomplete;
+	}
+
+	slot->type = (struct cparse_type*)struct_type;
+	return (struct cparse_type*)struct_type;
+}
+
+/* the size is checked by the caller */
+static struct cparse_type* cparse_type_array(struct cparse_state* s, struct cparse_type* element_type, int extent)
+{
+	/* an array of an incomplete struct is not interned, its size would not follow the definition */
+	struct cparse_type_key key;
+	key.kind = CPARSE_TYPE_ARRAY;
+	key.qualifiers = CPARSE_TYPE_QUAL_NONE;
+	key.target = element_type;
+	key.value = extent;
+	struct cparse_type_slot* slot = element_type->alignment ? cparse_type_table_intern(s, &key) : NULL;
+	if (slot && slot->type)
+		return slot->type;
+
+	struct cparse_type_array* array_type = cparse_alloc_type(s, struct cparse_type_array);
+	array_type->type.kind = CPARSE_TYPE_ARRAY;
+	array_type->type.qualifiers = CPARSE_TYPE_QUAL_NONE;
+	array_type->element_type = element_type;
+	array_type->extent = extent;
+	array_type->type.size = element_type->size * extent;
+	array_type->type.alignment = element_type->alignment;
+	if (slot)
+		slot->type = (struct cparse_type*)array_type;
+	return (struct cparse_type*)array_type;
+}
+
+/* type with the qualifiers added, those of an array go to its elements */
+static struct cparse_type* cparse_type_qualify(struct cparse_state* s, struct cparse_type* type, enum cparse_type_qualifier qualifiers)
+{
+	if ((type->qualifiers | qualifiers) == type->qualifiers)
+		return type;
+
+	switch (type->kind) {
+		case CPARSE_TYPE_PRIMITIVE:
+			return cparse_type_primitive(s, ((struct cparse_type_primitive*)type)->kind, type->qualifiers | qualifiers);
+		case CPARSE_TYPE_POINTER:
+			return cparse_type_pointer(s, ((struct cparse_type_pointer*)type)->pointee_type, type->qualifiers | qualifiers);
+		case CPARSE_TYPE_ARRAY:
+			return cparse_type_array(s, cparse_type_qualify(s, ((struct cparse_type_array*)type)->element_type, qualifiers), ((struct cparse_type_array*)type)->extent);
+		case CPARSE_TYPE_STRUCT:
+			return cparse_type_tag(s, &((struct cparse_type_struct*)type)->struct_type->decl, type->qualifiers | qualifiers);
+		case CPARSE_TYPE_ENUM:
+			return cparse_type_tag(s, &((struct cparse_type_enum*)type)->enum_type->decl, type->qualifiers | qualifiers);
+	}
+	return type;
+}
+
+/* types interned by another parse, or copied out of the arena by stream mode, are equal without being the same.
+   tags are compared as decls, the symbol tables resolve a tag to the same decl (its stub in stream mode) for every
+   type that refers to it. pointers go on to their pointees. */
+static bool cparse_type_equal(struct cparse_type const* a, struct cparse_type const* b)
+{
+	for (; a != b; a = ((struct cparse_type_pointer const*)a)->pointee_type, b = ((struct cparse_type_pointer const*)b)->pointee_type) {
+		if (a->kind != b->kind || a->qualifiers != b->qualifiers)
+			return false;
+
+		switch (a->kind) {
+			case CPARSE_TYPE_PRIMITIVE:
+				return ((struct cparse_type_primitive const*)a)->kind == ((struct cparse_type_primitive const*)b)->kind;
+			case CPARSE_TYPE_POINTER:
+				break;
+			case CPARSE_TYPE_ARRAY:
+				return ((struct cparse_type_array const*)a)->extent == ((struct cparse_type_array const*)b)->extent &&
+					cparse_type_equal(((struct cparse_type_array const*)a)->element_type, ((struct cparse_type_array const*)b)->element_type);
+			case CPARSE_TYPE_STRUCT:
+				return ((struct cparse_type_struct const*)a)->struct_type == ((struct cparse_type_struct const*)b)->struct_type;
+			case CPARSE_TYPE_ENUM:
+				return ((struct cparse_type_enum const*)a)->enum_type == ((struct cparse_type_enum const*)b)->enum_type;
+		}
+	}
+	return true;
+}
+
+/* parsing functions */
+
+static enum cparse_type_qualifier cparse_parse_type_qualifiers(struct cparse_state* s)
+{
+	enum cparse_type_qualifier qualifiers = CPARSE_TYPE_QUAL_NONE;
+	for (;;) {
+		switch (s->lex.lookahead) {
+			case CPARSE_KW_CONST: qualifiers |= CPARSE_TYPE_QUAL_CONST; break;
+			case CPARSE_KW_VOLATILE: qualifiers |= CPARSE_TYPE_QUAL_VOLATILE; break;
+			case CPARSE_KW_RESTRICT: qualifiers |= CPARSE_TYPE_QUAL_RESTRICT; break;
+			default: return qualifiers;
+		}
+		cparse_lex(s);
+	}
+}
+
+/* struct or enum type naming a tag declared before */
+static struct cparse_type* cparse_parse_type_tag(struct cparse_state* s, enum cparse_type_qualifier qualifiers)
+{
+	const enum cparse_decl_kind kind = cparse_peek(s, CPARSE_KW_STRUCT) ? CPARSE_DECL_STRUCT : CPARSE_DECL_ENUM;
+	cparse_lex(s);
+	cparse_check(s, CPARSE_TOK_IDENTIFIER);
+
+	struct cparse_decl* decl = cparse_symbol_table_find(&s->unit->symbols, s->lex.token, s->lex.token_size);
+	if (!decl)
+		cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "unknown type '%s %.*s'.", kind == CPARSE_DECL_STRUCT ? "struct" : "enum", s->lex.token_size, s->lex.token);
+	if (decl->kind != kind)
+		cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "'%.*s' defined as wrong kind of tag.", s->lex.token_size, s->lex.token);
+	if (decl != (struct cparse_decl*)s->defining)
+		decl->referenced = 1;
+	cparse_lex(s);
+
+	return cparse_type_tag(s, decl, qualifiers | cparse_parse_type_qualifiers(s));
+}
+
+/* type named by the typedef the current token spells */
+static struct cparse_type* cparse_parse_type_name(struct cparse_state* s, enum cparse_type_qualifier qualifiers)
+{
+	struct cparse_decl* decl = cparse_symbol_table_find(&s->unit->typedefs, s->lex.token, s->lex.token_size);
+	if (!decl)
+		cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "unknown type name '%.*s'.", s->lex.token_size, s->lex.token);
+	decl->referenced = 1;
+	cparse_lex(s);
+
+	return cparse_type_qualify(s, ((struct cparse_decl_typedef*)decl)->type, qualifiers | cparse_parse_type_qualifiers(s));
+}
+
+static struct cparse_type* cparse_parse_type(struct cparse_state* s)
+{
+	bool primitive_signed = true;
+	enum cparse_type_primitive_kind primitive_kind = 0;
+	enum cparse_type_qualifier qualifier = cparse_parse_type_qualifiers(s);
+
+	switch (s->lex.lookahead)
+	{
+		case CPARSE_KW_CHAR:
+			cparse_lex(s);
+			primitive_kind = CPARSE_PRIMITIVE_TYPE_CHAR;
+			goto set_primitive_type;
+
+		case CPARSE_KW_SIGNED:
+			cparse_lex(s);
+			goto parse_integral_primitive_type;
+
+		case CPARSE_KW_UNSIGNED:
+			cparse_lex(s);
+			primitive_signed = false;
+			goto parse_integral_primitive_type;
+
+		case CPARSE_KW_FLOAT:
+			cparse_lex(s);
+			primitive_kind = CPARSE_PRIMITIVE_TYPE_FLOAT;
+			goto set_primitive_type;
+
+		case CPARSE_KW_DOUBLE:
+			cparse_lex(s);
+			primitive_kind = CPARSE_PRIMITIVE_TYPE_DOUBLE;
+			goto set_primitive_type;
+
+		case CPARSE_KW_BOOL:
+			cparse_lex(s);
+			primitive_kind = CPARSE_PRIMITIVE_TYPE_BOOL;
+			goto set_primitive_type;
+
+		case CPARSE_KW_VOID:
+			cparse_lex(s);
+			primitive_kind = CPARSE_PRIMITIVE_TYPE_VOID;
+			goto set_primitive_type;
+
+		case CPARSE_KW_LONG:
+			cparse_lex(s);
+			if (cparse_accept(s, CPARSE_KW_DOUBLE)) {
+				primitive_kind = CPARSE_PRIMITIVE_TYPE_LONG_DOUBLE;
+				goto set_primitive_type;
+			}
+			goto long_keyword_parsed;
+
+		case CPARSE_KW_STRUCT:
+		case CPARSE_KW_ENUM:
+			return cparse_parse_type_tag(s, qualifier);
+
+		case CPARSE_TOK_IDENTIFIER:
+			return cparse_parse_type_name(s, qualifier);
+
+		default:
+			break;
+	}
+
+parse_integral_primitive_type:
+	switch (s->lex.lookahead)
+	{
+		case CPARSE_KW_CHAR:
+			cparse_lex(s);
+			primitive_kind = primitive_signed ? CPARSE_PRIMITIVE_TYPE_SIGNED_CHAR : CPARSE_PRIMITIVE_TYPE_UNSIGNED_CHAR;
+			goto set_primitive_type;
+
+		case CPARSE_KW_SHORT:
+			cparse_lex(s);
+			primitive_kind = primitive_signed ? CPARSE_PRIMITIVE_TYPE_SIGNED_SHORT : CPARSE_PRIMITIVE_TYPE_UNSIGNED_SHORT;
+			cparse_accept(s, CPARSE_KW_INT);
+			goto set_primitive_type;
+
+		case CPARSE_KW_INT:
+			cparse_lex(s);
+			primitive_kind = primitive_signed ? CPARSE_PRIMITIVE_TYPE_SIGNED_INT : CPARSE_PRIMITIVE_TYPE_UNSIGNED_INT;
+			goto set_primitive_type;
+
+		case CPARSE_KW_LONG:
+			cparse_lex(s);
+		long_keyword_parsed:
+			primitive_kind = primitive_signed ? CPARSE_PRIMITIVE_TYPE_SIGNED_LONG : CPARSE_PRIMITIVE_TYPE_UNSIGNED_LONG;
+			if (cparse_accept(s, CPARSE_KW_LONG))
+				primitive_kind = primitive_signed ? CPARSE_PRIMITIVE_TYPE_SIGNED_LONG_LONG : CPARSE_PRIMITIVE_TYPE_UNSIGNED_LONG_LONG;
+			cparse_accept(s, CPARSE_KW_INT);
+			goto set_primitive_type;
+
+		set_primitive_type:
+			return cparse_type_primitive(s, primitive_kind, qualifier | cparse_parse_type_qualifiers(s));
+	}
+
+	cparse_error_syntax(s);
+	return NULL;
+}
+
+static struct cparse_type* cparse_parse_type_ptr(struct cparse_state* s, struct cparse_type* type)
+{
+	while (cparse_accept(s, '*'))
+		type = cparse_type_pointer(s, type, cparse_parse_type_qualifiers(s));
+	return type;
+}
+
+static struct cparse_type* cparse_parse_type_array(struct cparse_state* s, struct cparse_type* type)
+{
+	while (cparse_accept(s, '['))
+	{
+		/* left to the initializer, which is not parsed, or a flexible array member */
+		if (cparse_accept(s, ']')) {
+			type = cparse_type_array(s, type, 0);
+			continue;
+		}
+
+		/* todo: this should be any static expression */
+		cparse_check(s, CPARSE_TOK_INTEGER);
+
+		/* the extent and the size of the array both have to fit an int */
+		const long long extent = cparse_token_integer(s);
+		if (extent > INT_MAX || (type->size > 0 && extent > INT_MAX / type->size))
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "invalid array size '%.*s'.", s->lex.token_size, s->lex.token);
+
+		cparse_lex(s); /* eat the extent */
+		cparse_expect(s, ']');
+		type = cparse_type_array(s, type, (int)extent);
+	}
+
+	return type;
+}
+
+static void cparse_unit_add_tag(struct cparse_state* s, struct cparse_decl* decl)
+{
+	cparse_arena_swap(s);
+	struct cparse_decl* previous = cparse_symbol_table_insert(s, &s->unit->symbols, decl);
+	cparse_arena_swap(s);
+	if (previous)
+		cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "redefinition of '%.*s'.", decl->spelling_length, decl->spelling);
+}
+
+/* returns the enum defined. if declared is not null the enum is that of a typedef, which can also name an enum declared
+   before (then null is returned), and the enum is stored there in any case. */
+static struct cparse_decl_enum* cpase_parse_enum(struct cparse_state* s, struct cparse_decl*** parent_decls, struct cparse_decl** declared)
+{
+	cparse_expect(s, CPARSE_KW_ENUM);
+
+	struct cparse_decl* tag = declared && cparse_peek(s, CPARSE_TOK_IDENTIFIER) ? cparse_symbol_table_find(&s->unit->symbols, s->lex.token, s->lex.token_size) : NULL;
+	if (tag) {
+		if (tag->kind != CPARSE_DECL_ENUM)
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "'%.*s' defined as wrong kind of tag.", s->lex.token_size, s->lex.token);
+		cparse_lex(s);
+		if (cparse_peek(s, '{'))
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "redefinition of '%.*s'.", tag->spelling_length, tag->spelling);
+		tag->referenced = 1;
+		*declared = tag;
+		return NULL;
+	}
+
+	struct cparse_decl_enum* enum_decl = cparse_alloc_type(s, struct cparse_decl_enum);
+	cparse_decl_init(s, &enum_decl->decl, CPARSE_DECL_ENUM);
+	enum_decl->constants = NULL;
+	enum_decl->num_constants = 0;
+	cparse_symbol_table_init(&enum_decl->symbols);
+	if (declared)
+		*declared = &enum_decl->decl;
+
+	if (cparse_peek(s, CPARSE_TOK_IDENTIFIER)) {
+		cparse_scan_spelling(s, &enum_decl->decl);
+		if (declared && !cparse_peek(s, '{'))
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "unknown type 'enum %.*s'.", enum_decl->decl.spelling_length, enum_decl->decl.spelling);
+		cparse_unit_add_tag(s, &enum_decl->decl);
+		**parent_decls = (struct cparse_decl*)enum_decl;
+		*parent_decls = &enum_decl->decl.next;
+	}
+
+	cparse_expect(s, '{');
+
+	long long int value = 0;
+	bool overflows = false; /* the previous constant is LLONG_MAX, the next one needs a value */
+
+	struct cparse_decl_enum_constant** next_constant = &enum_decl->constants;
+	while (!cparse_accept(s, '}')) {
+		cparse_check(s, CPARSE_TOK_IDENTIFIER);
+		struct cparse_decl_enum_constant* constant = cparse_alloc_type(s, struct cparse_decl_enum_constant);
+		cparse_decl_init(s, &constant->decl, CPARSE_DECL_ENUM_CONSTANT);
+		cparse_copy_spelling(s, &constant->decl);
+		if (cparse_symbol_table_insert(s, &enum_decl->symbols, &constant->decl))
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "duplicate enum constant '%.*s'.", constant->decl.spelling_length, constant->decl.spelling);
+		cparse_lex(s);
+
+		if (cparse_accept(s, '=')) {
+			cparse_check(s, CPARSE_TOK_INTEGER);
+			value = cparse_token_integer(s);
+			cparse_lex(s);
+		}
+		else if (overflows) {
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "overflow in the value of enum constant '%.*s'.", constant->decl.spelling_length, constant->decl.spelling);
+		}
+
+		constant->value = value;
+		overflows = value == LLONG_MAX;
+		if (!overflows)
+			++value;
+		++enum_decl->num_constants;
+
+		cparse_accept(s, ',');
+
+		*next_constant = constant;
+		next_constant = (struct cparse_decl_enum_constant**)&constant->decl.next;
+	}
+
+	return enum_decl;
+}
+
+/* where the next field of the struct being defined goes */
+struct cparse_struct_layout {
+	long long offset;
+	int alignment;
+	struct cparse_decl_variable_field** next_field;
+};
+
+/* parses the fields declared with the same base type, up to their ';' */
+static void cparse_parse_fields(struct cparse_state* s, struct cparse_decl_struct* struct_decl, struct cparse_struct_layout* layout)
+{
+	struct cparse_type* base_type = cparse_parse_type(s);
+	do
+	{
+		struct cparse_decl_variable_field* field = cparse_alloc_type(s, struct cparse_decl_variable_field);
+		field->variable.type = cparse_parse_type_ptr(s, base_type);
+		field->offset = 0;
+		cparse_check(s, CPARSE_TOK_IDENTIFIER);
+		cparse_decl_init(s, &field->variable.decl, CPARSE_DECL_FIELD);
+		cparse_copy_spelling(s, &field->variable.decl);
+		if (cparse_symbol_table_insert(s, &struct_decl->symbols, &field->variable.decl))
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "duplicate struct field '%.*s'.", field->variable.decl.spelling_length, field->variable.decl.spelling);
+		cparse_lex(s);
+
+		struct cparse_type* type = cparse_parse_type_array(s, field->variable.type);
+		if (!type->alignment)
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "field '%.*s' has incomplete type.", field->variable.decl.spelling_length, field->variable.decl.spelling);
+
+		/* each field at the next multiple of its alignment, the struct aligned as its strictest field */
+		long long offset = (layout->offset + type->alignment - 1) / type->alignment * type->alignment;
+		if (offset + type->size > 0x7fffffff)
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "struct '%.*s' is too large.", struct_decl->decl.spelling_length, struct_decl->decl.spelling);
+		field->variable.type = type;
+		field->offset = (int)offset;
+		layout->offset = offset + type->size;
+		layout->alignment = type->alignment > layout->alignment ? type->alignment : layout->alignment;
+		++struct_decl->num_fields;
+
+		*layout->next_field = field;
+		layout->next_field = (struct cparse_decl_variable_field**)&field->variable.decl.next;
+	} while (cparse_accept(s, ','));
+	cparse_expect(s, ';');
+}
+
+/* lays out the types in the list that referred to the struct before it was defined */
+static void cparse_complete_types(struct cparse_incomplete_type** incomplete, struct cparse_decl_struct const* struct_decl)
+{
+	while (*incomplete) {
+		if ((*incomplete)->type->struct_type == struct_decl) {
+			(*incomplete)->type->type.size = struct_decl->size;
+			(*incomplete)->type->type.alignment = struct_decl->alignment;
+			*incomplete = (*incomplete)->next;
+		}
+		else {
+			incomplete = &(*incomplete)->next;
+		}
+	}
+}
+
+/* returns the struct defined, or null for a forward declaration or a redeclaration. if declared is not null the struct
+   is that of a typedef, which can also name a struct declared before or declare it (then null is returned), and the
+   struct is stored there in any case. */
+static struct cparse_decl_struct* cparse_parse_struct(struct cparse_state* s, struct cparse_decl*** parent_decls, struct cparse_decl** declared)
+{
+	cparse_expect(s, CPARSE_KW_STRUCT);
+
+	struct cparse_decl* tag = cparse_peek(s, CPARSE_TOK_IDENTIFIER) ? cparse_symbol_table_find(&s->unit->symbols, s->lex.token, s->lex.token_size) : NULL;
+	struct cparse_decl_struct* struct_decl;
+
+	if (tag) {
+		/* redeclarations do nothing, a definition completes the forward declaration in place */
+		if (tag->kind != CPARSE_DECL_STRUCT)
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "'%.*s' defined as wrong kind of tag.", s->lex.token_size, s->lex.token);
+		struct_decl = (struct cparse_decl_struct*)tag;
+		cparse_lex(s);
+		if (declared)
+			*declared = tag;
+		if (cparse_peek(s, ';'))
+			return NULL;
+		if (declared && !cparse_peek(s, '{')) {
+			tag->referenced = 1;
+			return NULL;
+		}
+		if (struct_decl->alignment)
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "redefinition of '%.*s'.", tag->spelling_length, tag->spelling);
+		s->linked = true;
+		s->completing = struct_decl;
+	}
+	else {
+		struct_decl = cparse_alloc_type(s, struct cparse_decl_struct);
+		cparse_decl_init(s, &struct_decl->decl, CPARSE_DECL_STRUCT);
+		struct_decl->size = 0;
+		struct_decl->alignment = 0;
+		struct_decl->fields = NULL;
+		struct_decl->num_fields = 0;
+		cparse_symbol_table_init(&struct_decl->symbols);
+		if (declared)
+			*declared = &struct_decl->decl;
+
+		if (cparse_peek(s, CPARSE_TOK_IDENTIFIER)) {
+			cparse_scan_spelling(s, &struct_decl->decl);
+			cparse_unit_add_tag(s, &struct_decl->decl);
+			**parent_decls = (struct cparse_decl*)struct_decl;
+			*parent_decls = &struct_decl->decl.next;
+
+			/* forward declaration */
+			if (cparse_peek(s, ';') || (declared && !cparse_peek(s, '{')))
+				return NULL;
+		}
+	}
+
+	cparse_expect(s, '{');
+
+	struct cparse_decl_struct* defining = s->defining;
+	s->defining = struct_decl;
+
+	struct cparse_struct_layout layout;
+	layout.offset = 0;
+	layout.alignment = 1;
+	layout.next_field = &struct_decl->fields;
+
+	/* a field declaration that fails is skipped up to its ';', the struct goes on with the next one */
+	jmp_buf recover_handler;
+	jmp_buf* const unit_recover_handler = s->recover_handler;
+	volatile bool recovered = false;
+	if (unit_recover_handler)
+		s->recover_handler = &recover_handler;
+
+	while (!cparse_peek(s, '}')) {
+		const char* volatile begin = s->lex.token; /* read after the longjmp */
+		if (s->recover_handler) {
+			if (setjmp(recover_handler)) {
+				recovered = true;
+				cparse_recover(s, begin, true);
+				if (cparse_peek(s, CPARSE_TOK_EOF))
+					break;
+				continue;
+			}
+		}
+		cparse_parse_fields(s, struct_decl, &layout);
+	}
+
+	s->recover_handler = unit_recover_handler;
+	cparse_expect(s, '}');
+	s->defining = defining;
+
+	/* the layout of a struct missing some of its fields would be wrong, it stays incomplete (alignment 0) with the
+	   fields that could be parsed */
+	if (recovered)
+		return struct_decl;
+
+	struct_decl->size = (int)((layout.offset + layout.alignment - 1) / layout.alignment * layout.alignment);
+	struct_decl->alignment = layout.alignment;
+
+	cparse_complete_types(&s->incomplete_types, struct_decl);
+	cparse_complete_types(&s->stream_incomplete_types, struct_decl);
+	return struct_decl;
+}
+
+static void cparse_unit_add_typedef(struct cparse_state* s, struct cparse_decl_typedef* typedef_decl, struct cparse_decl*** last_next)
+{
+	cparse_arena_swap(s);
+	struct cparse_decl* previous = cparse_symbol_table_insert(s, &s->unit->typedefs, &typedef_decl->decl);
+	cparse_arena_swap(s);
+
+	/* repeating a typedef is fine as long as the type is the same, the first one stays */
+	if (previous) {
+		if (!cparse_type_equal(((struct cparse_decl_typedef*)previous)->type, typedef_decl->type))
+			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "conflicting types for '%.*s'.", typedef_decl->decl.spelling_length, typedef_decl->decl.spelling);
+		return;
+	}
+
+	**last_next = &typedef_decl->decl;
+	*last_next = &typedef_decl->decl.next;
+}
+
+/* the type the declarators of a declaration derive from, which can define or declare an enum or struct (stored in
+   *defined if defined). null if the declaration is of that enum or struct alone, with no declarators. */
+static struct cparse_type* cparse_parse_base_type(struct cparse_state* s, struct cparse_decl*** last_next, struct cparse_decl** defined)
+{
+	*defined = NULL;
+	const enum cparse_type_qualifier qualifiers = cparse_parse_type_qualifiers(s);
+	if (!cparse_peek(s, CPARSE_KW_STRUCT) && !cparse_peek(s, CPARSE_KW_ENUM))
+		return cparse_type_qualify(s, cparse_parse_type(s), qualifiers);
+
+	struct cparse_decl* tag;
+	if (cparse_peek(s, CPARSE_KW_STRUCT))
+		*defined = (struct cparse_decl*)cparse_parse_struct(s, last_next, &tag);
+	else
+		*defined = (struct cparse_decl*)cpase_parse_enum(s, last_next, &tag);
+
+	if (cparse_peek(s, ';'))
+		return NULL;
+
+	/* an anonymous enum or struct can only be reached through the declarators, it goes in the decls before them */
+	if (!tag->spelling) {
+		**last_next = tag;
+		*last_next = &tag->next;
+	}
+	return cparse_type_tag(s, tag, qualifiers | cparse_parse_type_qualifiers(s));
+}
+
+/* typedef of one or more names, up to the ';'. returns the enum or struct defined along, if any. */
+static struct cparse_decl* cparse_parse_typedef(struct cparse_state* s, struct cparse_decl*** last_next)
+{
+	cparse_expect(s, CPARSE_KW_TYPEDEF);
+	s->typedefs_changed = true;
+
+	struct cparse_decl* defined;
+	struct cparse_type* base_type = cparse_parse_base_type(s, last_next, &defined);
+
+	do {
+		struct cparse_decl_typedef* typedef_decl = cparse_alloc_type(s, struct cparse_decl_typedef);
+		struct cparse_type* type = cparse_parse_type_ptr(s, base_type);
+		cparse_check(s, CPARSE_TOK_IDENTIFIER);
+		cparse_decl_init(s, &typedef_decl->decl, CPARSE_DECL_TYPEDEF);
+		cparse_scan_spelling(s, &typedef_decl->decl);
+		typedef_decl->type = cparse_parse_type_array(s, type);
+		cparse_unit_add_typedef(s, typedef_decl, last_next);
+	} while (cparse_accept(s, ','));
+
+	return defined;
+}
+
+static enum cparse_storage_class cparse_parse_storage_class(struct cparse_state* s)
+{
+	enum cparse_storage_class storage_class = CPARSE_STORAGE_CLASS_DEFAULT;
+	for (;;) {
+		switch (s->lex.lookahead) {
+			case CPARSE_KW_EXTERN: storage_class |= CPARSE_STORAGE_CLASS_EXTERN; break;
+			case CPARSE_KW_STATIC: storage_class |= CPARSE_STORAGE_CLASS_STATIC; break;
+			case CPARSE_KW_INLINE: storage_class |= CPARSE_STORAGE_CLASS_INLINE; break;
+			case CPARSE_KW_NORETURN: storage_class |= CPARSE_STORAGE_CLASS_NORETURN; break;
+			case CPARSE_KW_THREAD_LOCAL: storage_class |= CPARSE_STORAGE_CLASS_THREAD_LOCAL; break;
+			default: return storage_class;
+		}
+		cparse_lex(s);
+	}
+}
+
+/* declaration of enums, structs, functions and variables, up to the ';' or the '}' of a function body (then *body is
+   set). returns the enum or struct defined along, if any. */
+static struct cparse_decl* cparse_parse_object_declaration(struct cparse_state* s, struct cparse_decl*** last_next, bool* body)
+{
+	const enum cparse_storage_class storage_class = cparse_parse_storage_class(s);
+	struct cparse_decl* defined;
+	struct cparse_type* base_type = cparse_parse_base_type(s, last_next, &defined);
+	if (cparse_peek(s, ';'))
+		return defined;
+
+	bool first = true;
+	do {
+		struct cparse_type* type = cparse_parse_type_ptr(s, base_type);
+		cparse_check(s, CPARSE_TOK_IDENTIFIER);
+		struct cparse_decl name;
+		cparse_scan_spelling(s, &name);
+
+		struct cparse_decl* decl;
+		if (cparse_peek(s, '(')) {
+			struct cparse_decl_function* function = cparse_alloc_type(s, struct cparse_decl_function);
+			cparse_decl_init(s, &function->decl, CPARSE_DECL_FUNCTION);
+			function->return_type = type;
+			function->storage_class = storage_class;
+			function->defined = 0;
+			function->body_begin = 0;
+			function->body_end = 0;
+			cparse_skip(s, CPARSE_SKIP_PARAMETERS, &function->parameters_begin, &function->parameters_end);
+			cparse_expect(s, ')');
+
+			/* a definition ends the declaration */
+			if (first && cparse_peek(s, '{')) {
+				function->defined = 1;
+				cparse_skip(s, CPARSE_SKIP_BODY, &function->body_begin, &function->body_end);
+				*body = true;
+			}
+			decl = &function->decl;
+		}
+		else {
+			struct cparse_decl_variable_global* variable = cparse_alloc_type(s, struct cparse_decl_variable_global);
+			cparse_decl_init(s, &variable->variable.decl, CPARSE_DECL_VARIABLE);
+			variable->variable.type = cparse_parse_type_array(s, type);
+			variable->storage_class = storage_class;
+			variable->initialized = 0;
+			variable->initializer_begin = 0;
+			variable->initializer_end = 0;
+			if (cparse_accept(s, '=')) {
+				if (cparse_peek(s, ',') || cparse_peek(s, ';'))
+					cparse_error_syntax(s);
+				variable->initialized = 1;
+				cparse_skip(s, CPARSE_SKIP_INITIALIZER, &variable->initializer_begin, &variable->initializer_end);
+			}
+			decl = &variable->variable.decl;
+		}
+
+		decl->spelling = name.spelling;
+		decl->spelling_length = name.spelling_length;
+		**last_next = decl;
+		*last_next = &decl->next;
+		first = false;
+	} while (!*body && cparse_accept(s, ','));
+
+	return defined;
+}
+
+/* parses a top-level declaration up to its ';' or the '}' of a function body (then *body is set) and returns the enum
+   or struct it defines, if any */
+static struct cparse_decl* cparse_parse_tag_definition(struct cparse_state* s, struct cparse_decl*** last_next, bool* body)
+{
+	*body = false;
+	if (cparse_peek(s, CPARSE_KW_TYPEDEF))
+		return cparse_parse_typedef(s, last_next);
+	return cparse_parse_object_declaration(s, last_next, body);
+}
+
+/* parses a top-level declaration and returns its span, or null once tokens stopped mapping to the source */
+static struct cparse_unit_span* cparse_parse_declaration(struct cparse_state* s, struct cparse_decl*** last_next)
+{
+	const char* begin = s->lex.token;
+	struct cparse_decl** decl = *last_next;
+
+	bool body;
+	cparse_parse_tag_definition(s, last_next, &body);
+
+	const char* end = s->lex.token + s->lex.token_size;
+	cparse_expect(s, body ? '}' : ';');
+
+	if (s->pp.rewritten)
+		return NULL;
+
+	struct cparse_unit_span* span = cparse_alloc_type(s, struct cparse_unit_span);
+	span->next = NULL;
+	span->begin = (cparse_size_t)(begin - s->source);
+	span->end = (cparse_size_t)(end - s->source);
+	span->decl = *last_next != decl ? *decl : NULL;
+	span->num_decls = 0;
+	for (; decl != *last_next; decl = &(*decl)->next)
+		++span->num_decls;
+	return span;
+}
+
+/* copy of the tag decl out of the arena about to be rewound, to be called with the arenas swapped. the stub keeps the
+   identity of the tag for the types of later declarations, but not its fields or constants. */
+static struct cparse_decl* cparse_stream_stub(struct cparse_state* s, struct cparse_decl const* decl)
+{
+	struct cparse_decl* stub;
+	if (decl->kind == CPARSE_DECL_ENUM) {
+		struct cparse_decl_enum* enum_decl = cparse_alloc_type(s, struct cparse_decl_enum);
+		enum_decl->constants = NULL;
+		enum_decl->num_constants = 0;
+		cparse_symbol_table_init(&enum_decl->symbols);
+		stub = &enum_decl->decl;
+	}
+	else {
+		struct cparse_decl_struct* struct_decl = cparse_alloc_type(s, struct cparse_decl_struct);
+		struct_decl->size = ((struct cparse_decl_struct const*)decl)->size;
+		struct_decl->alignment = ((struct cparse_decl_struct const*)decl)->alignment;
+		struct_decl->fields = NULL;
+		struct_decl->num_fields = 0;
+		cparse_symbol_table_init(&struct_decl->symbols);
+		stub = &struct_decl->decl;
+	}
+
+	*stub = *decl;
+	stub->next = NULL;
+	if (decl->spelling && !s->context)
+		stub->spelling = cparse_copy_string(s, decl->spelling, decl->spelling_length);
+	return stub;
+}
+
+/* moves a tag declared by a streamed declaration out of the arena about to be rewound */
+static void cparse_stream_keep_tag(struct cparse_state* s, struct cparse_decl* decl)
+{
+	cparse_arena_swap(s);
+	struct cparse_decl* stub = cparse_stream_stub(s, decl);
+	cparse_arena_swap(s);
+
+	cparse_symbol_table_probe(&s->unit->symbols, cparse_hash(stub->spelling, stub->spelling_length), stub->spelling, stub->spelling_length)->decl = stub;
+}
+
+/* copy of type out of the arena about to be rewound, to be called with the arenas swapped. the tags it refers to are
+   replaced by their stubs, anonymous is the tag without a spelling of the declaration, if any, and anonymous_stub
+   its stub. any other tag without a spelling is the stub kept with an earlier typedef. */
+static struct cparse_type* cparse_stream_keep_type(struct cparse_state* s, struct cparse_type const* type, struct cparse_decl const* anonymous, struct cparse_decl* anonymous_stub)
+{
+	switch (type->kind)
+	{
+		case CPARSE_TYPE_POINTER: {
+			struct cparse_type_pointer* ptr_type = cparse_alloc_type(s, struct cparse_type_pointer);
+			*ptr_type = *(struct cparse_type_pointer const*)type;
+			ptr_type->pointee_type = cparse_stream_keep_type(s, ptr_type->pointee_type, anonymous, anonymous_stub);
+			return &ptr_type->type;
+		}
+
+		case CPARSE_TYPE_ARRAY: {
+			struct cparse_type_array* array_type = cparse_alloc_type(s, struct cparse_type_array);
+			*array_type = *(struct cparse_type_array const*)type;
+			array_type->element_type = cparse_stream_keep_type(s, array_type->element_type, anonymous, anonymous_stub);
+			return &array_type->type;
+		}
+
+		case CPARSE_TYPE_STRUCT:
+		case CPARSE_TYPE_ENUM: {
+			struct cparse_decl* decl = type->kind == CPARSE_TYPE_STRUCT ? &((struct cparse_type_struct const*)type)->struct_type->decl :
+				&((struct cparse_type_enum const*)type)->enum_type->decl;
+			if (decl->spelling)
+				decl = cparse_symbol_table_find(&s->unit->symbols, decl->spelling, decl->spelling_length);
+			else if (decl == anonymous)
+				decl = anonymous_stub;
+
+			if (type->kind == CPARSE_TYPE_ENUM) {
+				struct cparse_type_enum* enum_type = cparse_alloc_type(s, struct cparse_type_enum);
+				*enum_type = *(struct cparse_type_enum const*)type;
+				enum_type->enum_type = (struct cparse_decl_enum*)decl;
+				return &enum_type->type;
+			}
+
+			struct cparse_type_struct* struct_type = cparse_alloc_type(s, struct cparse_type_struct);
+			*struct_type = *(struct cparse_type_struct const*)type;
+			struct_type->struct_type = (struct cparse_decl_struct*)decl;
+			if (!struct_type->type.alignment) {
+				struct cparse_incomplete_type* incomplete = cparse_alloc_type(s, struct cparse_incomplete_type);
+				incomplete->type = struct_type;
+				incomplete->next = s->stream_incomplete_types;
+				s->stream_incomplete_types = incomplete;
+			}
+			return &struct_type->type;
+		}
+
+		default: {
+			struct cparse_type_primitive* primitive_type = cparse_alloc_type(s, struct cparse_type_primitive);
+			*primitive_type = *(struct cparse_type_primitive const*)type;
+			return &primitive_type->type;
+		}
+	}
+}
+
+/* moves a typedef declared by a streamed declaration out of the arena about to be rewound, with a copy of its type */
+static void cparse_stream_keep_typedef(struct cparse_state* s, struct cparse_decl_typedef const* typedef_decl, struct cparse_decl const* anonymous, struct cparse_decl* anonymous_stub)
+{
+	cparse_arena_swap(s);
+	struct cparse_decl_typedef* kept = cparse_alloc_type(s, struct cparse_decl_typedef);
+	kept->decl = typedef_decl->decl;
+	kept->decl.next = NULL;
+	if (!s->context)
+		kept->decl.spelling = cparse_copy_string(s, typedef_decl->decl.spelling, typedef_decl->decl.spelling_length);
+	kept->type = cparse_stream_keep_type(s, typedef_decl->type, anonymous, anonymous_stub);
+	cparse_arena_swap(s);
+
+	cparse_symbol_table_probe(&s->unit->typedefs, cparse_hash(kept->decl.spelling, kept->decl.spelling_length), kept->decl.spelling, kept->decl.spelling_length)->decl = &kept->decl;
+}
+
+/* CPARSE_STATE_STREAM: keeps what outlives the declaration just parsed, or given up on, before its arena is rewound,
+   that is the tags and typedefs it declared, decls and those chained after it. functions and variables are dropped. */
+static void cparse_stream_drop_declaration(struct cparse_state* s, struct cparse_decl* decls)
+{
+	struct cparse_decl* anonymous = NULL;
+	struct cparse_decl* anonymous_stub = NULL;
+	for (struct cparse_decl* decl = decls; decl; decl = decl->next) {
+		if (decl->kind == CPARSE_DECL_FUNCTION || decl->kind == CPARSE_DECL_VARIABLE)
+			continue;
+
+		if (decl->kind == CPARSE_DECL_TYPEDEF) {
+			cparse_stream_keep_typedef(s, (struct cparse_decl_typedef*)decl, anonymous, anonymous_stub);
+		}
+		else if (decl->spelling) {
+			cparse_stream_keep_tag(s, decl);
+		}
+		else {
+			cparse_arena_swap(s);
+			anonymous_stub = cparse_stream_stub(s, decl);
+			cparse_arena_swap(s);
+			anonymous = decl;
+		}
+	}
+
+	/* a stub completed in place keeps its size and alignment only */
+	if (s->completing) {
+		s->completing->fields = NULL;
+		s->completing->num_fields = 0;
+		cparse_symbol_table_init(&s->completing->symbols);
+	}
+}
+
+/* CPARSE_STATE_STREAM: parses a top-level declaration and hands what it defines to the callbacks, the tags and
+   typedefs it declares are linked to *decls */
+static void cparse_stream_declaration(struct cparse_state* s, struct cparse_decl** decls)
+{
+	struct cparse_info const* info = s->info;
+	struct cparse_decl** last_next = decls;
+	bool body;
+	struct cparse_decl* defined = cparse_parse_tag_definition(s, &last_next, &body);
+	cparse_expect(s, body ? '}' : ';');
+
+	if (defined && defined->kind == CPARSE_DECL_ENUM && info->on_enum)
+		info->on_enum(info->callback_user_data, (struct cparse_decl_enum*)defined);
+	else if (defined && defined->kind == CPARSE_DECL_STRUCT && info->on_struct)
+		info->on_struct(info->callback_user_data, (struct cparse_decl_struct*)defined);
+}
+
+/* CPARSE_STATE_STREAM: reuses the arena of the declarations streamed since mark */
+static void cparse_stream_rewind(struct cparse_state* s, struct cparse_arena const* mark)
+{
+	/* the lookahead can still come from the tokens of a macro expansion, which live in the same arena as
+	   the declarations, then the declarations it expands to are freed together */
+	if (!s->pp.context) {
+		if (cparse_stats_enabled(s))
+			cparse_stats_high_water(s);
+		s->pp.free_contexts = NULL;
+		cparse_arena_rewind(s, mark);
+
+		/* the types, including those waiting for a struct definition, were all part of the declarations */
+		s->incomplete_types = NULL;
+		cparse_type_table_init(&s->types);
+	}
+}
+
+static struct cparse_unit* cparse_parse_unit(struct cparse_state* s)
+{
+	struct cparse_unit* unit = cparse_alloc_type(s, struct cparse_unit);
+	unit->decls = NULL;
+	cparse_symbol_table_init(&unit->symbols);
+	cparse_symbol_table_init(&unit->typedefs);
+	unit->spans = NULL;
+	unit->source = (s->flags & CPARSE_FLAG_SPELLING_SLICES) ? s->source : NULL;
+	unit->diagnostics = NULL;
+	s->unit = unit;
+	s->last_diagnostic = &unit->diagnostics;
+
+	struct cparse_decl** last_next = &unit->decls;
+	struct cparse_unit_span** last_span = &unit->spans;
+	const struct cparse_arena mark = cparse_arena_mark(s);
+	struct cparse_decl* stream_decls = NULL;
+
+	/* a declaration that fails is skipped and parsing resumes with the next one */
+	jmp_buf recover_handler;
+	if (s->flags & CPARSE_FLAG_RECOVER)
+		s->recover_handler = &recover_handler;
+
+	while (!cparse_peek(s, CPARSE_TOK_EOF))
+	{
+		const char* volatile begin = s->lex.token; /* read after the longjmp */
+		if (s->recover_handler) {
+			if (setjmp(recover_handler)) {
+				cparse_recover(s, begin, false);
+				s->defining = NULL;
+				if (s->flags & CPARSE_STATE_STREAM) {
+					cparse_stream_drop_declaration(s, stream_decls);
+					cparse_stream_rewind(s, &mark);
 				}
-				goto parse_identifier;
+				s->completing = NULL;
+				continue;
+			}
+		}
+
+		if (s->flags & CPARSE_STATE_STREAM) {
+			stream_decls = NULL;
+			cparse_stream_declaration(s, &stream_decls);
+			cparse_stream_drop_declaration(s, stream_decls);
+			cparse_stream_rewind(s, &mark);
+			s->completing = NULL;
+			continue;
+		}
+
+		struct cparse_unit_span* span = cparse_parse_declaration(s, &last_next);
+		if (span) {
+			*last_span = span;
+			last_span = &span->next;
+		}
+	}
+
+	s->recover_handler = NULL;
+	unit->incremental = !s->pp.rewritten && !s->linked && !(s->flags & CPARSE_STATE_STREAM) && !unit->diagnostics;
+	if (!unit->incremental)
+		unit->spans = NULL;
+	return unit;
+}
+
+CPARSE_API const char* cparse_primitive_type_spelling(enum cparse_type_primitive_kind kind)
+{
+	#define CPARSE_PRIMITIVE_TYPE_STR(id, spelling)\
+		case CPARSE_PRIMITIVE_TYPE_##id: return spelling;
+
+	switch (kind) {
+		CPARSE_PRIMITIVE_TYPE_STR(CHAR, "char");
+		CPARSE_PRIMITIVE_TYPE_STR(SIGNED_CHAR, "signed char");
+		CPARSE_PRIMITIVE_TYPE_STR(UNSIGNED_CHAR, "unsigned char");
+		CPARSE_PRIMITIVE_TYPE_STR(SIGNED_SHORT, "short");
+		CPARSE_PRIMITIVE_TYPE_STR(UNSIGNED_SHORT, "unsigned short");
+		CPARSE_PRIMITIVE_TYPE_STR(SIGNED_INT, "int");
+		CPARSE_PRIMITIVE_TYPE_STR(UNSIGNED_INT, "unsigned int");
+		CPARSE_PRIMITIVE_TYPE_STR(SIGNED_LONG, "long");
+		CPARSE_PRIMITIVE_TYPE_STR(UNSIGNED_LONG, "unsigned long");
+		CPARSE_PRIMITIVE_TYPE_STR(SIGNED_LONG_LONG, "long long");
+		CPARSE_PRIMITIVE_TYPE_STR(UNSIGNED_LONG_LONG, "unsigned long long");
+		CPARSE_PRIMITIVE_TYPE_STR(FLOAT, "float");
+		CPARSE_PRIMITIVE_TYPE_STR(DOUBLE, "double");
+		CPARSE_PRIMITIVE_TYPE_STR(LONG_DOUBLE, "long double");
+		CPARSE_PRIMITIVE_TYPE_STR(BOOL, "_Bool");
+		CPARSE_PRIMITIVE_TYPE_STR(VOID, "void");
+		case CPARSE_PRIMITIVE_TYPE_COUNT_: break;
+	}
+
+	#undef CPARSE_PRIMITIVE_TYPE_STR
+	return "???";
+}
+
+/* binary cache */
+
+#define CPARSE_CACHE_VERSION 6 /* bump whenever a serialized struct changes */
+
+/* a cache file is the header followed by the unit image, the relocation table (offsets of the non-null
+   pointers in the image, which hold image offsets) and the dependencies (content hash, path length and
+   path of every included file, each padded to 8 bytes) */
+struct cparse_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pointer_size;
+	uint32_t image_alignment;
+	uint64_t key;
+	uint64_t payload_hash; /* of everything after the header */
+	uint64_t image_size;
+	uint64_t unit_offset;
+	uint64_t num_relocations;
+	uint64_t num_dependencies;
+};
+
+/* writes the working directory to buffer, false if it does not fit */
+static bool cparse_working_directory(char* buffer, size_t size)
+{
+#ifdef _WIN32
+	const DWORD length = GetCurrentDirectoryA((DWORD)size, buffer);
+	return length > 0 && length < size;
+#else
+	return getcwd(buffer, size) != NULL;
+#endif
+}
+
+/* key of a source: its path, its content, the defines and the include directories. the path matters because quoted
+   names are looked up next to the file and __FILE__ spells it, relative paths are keyed with the working directory
+   they are relative to. false if the working directory cannot be read, the source is not cached then. */
+static bool cparse_cache_key(struct cparse_info const* info, const char* filename, const char* data, cparse_size_t size, uint64_t* out)
+{
+	uint64_t key = cparse_hash64(CPARSE_CACHE_MAGIC ^ ((uint64_t)CPARSE_CACHE_VERSION << 32), data, size);
+	const bool absolute = filename[0] == '/' || filename[0] == '\\' || (filename[0] && filename[1] == ':');
+	if (!absolute) {
+		char directory[4096];
+		if (!cparse_working_directory(directory, sizeof(directory)))
+			return false;
+		key = cparse_hash64(key, directory, strlen(directory) + 1);
+	}
+	key = cparse_hash64(key, filename, strlen(filename) + 1);
+	for (const char** define = info->defines; define && *define; ++define)
+		key = cparse_hash64(key, *define, strlen(*define) + 1);
+	key = cparse_hash64(key, "", 1);
+	key = cparse_hash64(key, &info->abi, sizeof(info->abi));
+	for (const char** dir = info->include_dirs; dir && *dir; ++dir)
+		key = cparse_hash64(key, *dir, strlen(*dir) + 1);
+	*out = key;
+	return true;
+}
+
+/* writes <cache_dir>/<key>.cpc into path, which must hold strlen(cache_dir) + 22 characters */
+static void cparse_cache_path(char* path, const char* cache_dir, uint64_t key)
+{
+	size_t n = strlen(cache_dir);
+	memcpy(path, cache_dir, n);
+	if (n && cache_dir[n - 1] != '/' && cache_dir[n - 1] != '\\')
+		path[n++] = '/';
+	for (int i = 15; i >= 0; --i)
+		path[n++] = "0123456789abcdef"[(key >> (i * 4)) & 15];
+	memcpy(path + n, ".cpc", 5);
+}
+
+static uint cparse_process_id(void)
+{
+#ifdef _WIN32
+	return (uint)GetCurrentProcessId();
+#else
+	return (uint)getpid();
+#endif
+}
+
+/* image writer, builds the image in malloc memory and gives up on allocation failure */
+struct cparse_cache_writer {
+	char* data;
+	size_t size;
+	size_t capacity;
+	uint64_t* relocations;
+	size_t num_relocations;
+	size_t relocations_capacity;
+	struct cparse_cache_object* objects; /* already written objects by address */
+	size_t objects_capacity;
+	size_t num_objects;
+	uint alignment;
+	bool failed;
+};
+
+struct cparse_cache_object {
+	const void* ptr;
+	size_t offset;
+};
+
+static bool cparse_cache_reserve(struct cparse_cache_writer* w, void** data, size_t* capacity, size_t count, size_t element_size)
+{
+	if (w->failed)
+		return false;
+	if (count <= *capacity)
+		return true;
+
+	size_t new_capacity = *capacity ? *capacity : 64;
+	while (new_capacity < count)
+		new_capacity *= 2;
+
+	void* new_data = realloc(*data, new_capacity * element_size);
+	if (!new_data) {
+		w->failed = true;
+		return false;
+	}
+	*data = new_data;
+	*capacity = new_capacity;
+	return true;
+}
+
+/* appends size bytes of src (zeroes if null) and returns their offset */
+static size_t cparse_cache_put(struct cparse_cache_writer* w, const void* src, size_t size, uint alignment)
+{
+	const size_t offset = (w->size + (alignment - 1)) & ~(size_t)(alignment - 1);
+	if (!cparse_cache_reserve(w, (void**)&w->data, &w->capacity, offset + size, 1))
+		return 0;
+
+	memset(w->data + w->size, 0, offset - w->size);
+	if (src)
+		memcpy(w->data + offset, src, size);
+	else
+		memset(w->data + offset, 0, size);
+
+	w->size = offset + size;
+	w->alignment = alignment > w->alignment ? alignment : w->alignment;
+	return offset;
+}
+
+/* stores the image offset target in the pointer at offset field */
+static void cparse_cache_link(struct cparse_cache_writer* w, size_t field, size_t target)
+{
+	if (!cparse_cache_reserve(w, (void**)&w->relocations, &w->relocations_capacity, w->num_relocations + 1, sizeof(uint64_t)))
+		return;
+	uintptr_t value = (uintptr_t)target;
+	memcpy(w->data + field, &value, sizeof(uintptr_t));
+	w->relocations[w->num_relocations++] = field;
+}
+
+static struct cparse_cache_object* cparse_cache_probe(struct cparse_cache_object* objects, size_t capacity, const void* ptr)
+{
+	const size_t mask = capacity - 1;
+	for (size_t i = (size_t)(((uintptr_t)ptr >> 3) * 0x9e3779b97f4a7c15ull >> 16) & mask;; i = (i + 1) & mask) {
+		if (!objects[i].ptr || objects[i].ptr == ptr)
+			return objects + i;
+	}
+}
+
+/* looks up the image offset of an object that was already written */
+static bool cparse_cache_find(struct cparse_cache_writer const* w, const void* ptr, size_t* offset)
+{
+	if (!w->num_objects)
+		return false;
+	struct cparse_cache_object const* object = cparse_cache_probe(w->objects, w->objects_capacity, ptr);
+	*offset = object->offset;
+	return object->ptr != NULL;
+}
+
+/* registers the object written at offset, before its children so that cycles terminate */
+static void cparse_cache_insert(struct cparse_cache_writer* w, const void* ptr, size_t offset)
+{
+	if (w->failed)
+		return;
+
+	if ((w->num_objects + 1) * 4 > w->objects_capacity * 3) {
+		size_t capacity = w->objects_capacity ? w->objects_capacity * 2 : 256;
+		struct cparse_cache_object* objects = calloc(capacity, sizeof(struct cparse_cache_object));
+		if (!objects) {
+			w->failed = true;
+			return;
+		}
+		for (size_t i = 0; i < w->objects_capacity; ++i) {
+			if (w->objects[i].ptr)
+				*cparse_cache_probe(objects, capacity, w->objects[i].ptr) = w->objects[i];
+		}
+		free(w->objects);
+		w->objects = objects;
+		w->objects_capacity = capacity;
+	}
+
+	struct cparse_cache_object* object = cparse_cache_probe(w->objects, w->objects_capacity, ptr);
+	object->ptr = ptr;
+	object->offset = offset;
+	++w->num_objects;
+}
+
+/* replaces the source address held by the pointer at offset field with the offset of its target,
+   written by write if it is not in the image yet */
+static void cparse_cache_relocate(struct cparse_cache_writer* w, size_t field, size_t (*write)(struct cparse_cache_writer*, const void*))
+{
+	if (w->failed)
+		return;
+
+	const void* ptr;
+	memcpy(&ptr, w->data + field, sizeof(ptr));
+	if (!ptr)
+		return;
+
+	size_t target;
+	if (!cparse_cache_find(w, ptr, &target))
+		target = write(w, ptr);
+	if (!w->failed)
+		cparse_cache_link(w, field, target);
+}
+
+static void cparse_cache_clear_pointer(struct cparse_cache_writer* w, size_t field)
+{
+	if (!w->failed)
+		memset(w->data + field, 0, sizeof(void*));
+}
+
+static size_t cparse_cache_write_decl(struct cparse_cache_writer* w, const void* ptr);
+
+static size_t cparse_cache_write_type(struct cparse_cache_writer* w, const void* ptr)
+{
+	struct cparse_type const* type = ptr;
+	size_t offset = 0;
+
+	switch (type->kind)
+	{
+		case CPARSE_TYPE_PRIMITIVE:
+			offset = cparse_cache_put(w, type, sizeof(struct cparse_type_primitive), __alignof(struct cparse_type_primitive));
+			cparse_cache_insert(w, type, offset);
+			break;
+
+		case CPARSE_TYPE_POINTER:
+			offset = cparse_cache_put(w, type, sizeof(struct cparse_type_pointer), __alignof(struct cparse_type_pointer));
+			cparse_cache_insert(w, type, offset);
+			cparse_cache_relocate(w, offset + offsetof(struct cparse_type_pointer, pointee_type), cparse_cache_write_type);
+			break;
+
+		case CPARSE_TYPE_ARRAY:
+			offset = cparse_cache_put(w, type, sizeof(struct cparse_type_array), __alignof(struct cparse_type_array));
+			cparse_cache_insert(w, type, offset);
+			cparse_cache_relocate(w, offset + offsetof(struct cparse_type_array, element_type), cparse_cache_write_type);
+			break;
+
+		case CPARSE_TYPE_STRUCT:
+			offset = cparse_cache_put(w, type, sizeof(struct cparse_type_struct), __alignof(struct cparse_type_struct));
+			cparse_cache_insert(w, type, offset);
+			cparse_cache_relocate(w, offset + offsetof(struct cparse_type_struct, struct_type), cparse_cache_write_decl);
+			break;
+
+		case CPARSE_TYPE_ENUM:
+			offset = cparse_cache_put(w, type, sizeof(struct cparse_type_enum), __alignof(struct cparse_type_enum));
+			cparse_cache_insert(w, type, offset);
+			cparse_cache_relocate(w, offset + offsetof(struct cparse_type_enum, enum_type), cparse_cache_write_decl);
+			break;
+
+		default:
+			w->failed = true;
+			break;
+	}
+
+	return offset;
+}
+
+/* writes the symbol array of the table copied at offset table */
+static void cparse_cache_write_symbols(struct cparse_cache_writer* w, size_t table, struct cparse_symbol_table const* source)
+{
+	if (!source->symbols)
+		return;
+
+	const size_t symbols = cparse_cache_put(w, source->symbols, source->capacity * sizeof(struct cparse_symbol), __alignof(struct cparse_symbol));
+	cparse_cache_link(w, table + offsetof(struct cparse_symbol_table, symbols), symbols);
+
+	for (int i = 0; i < source->capacity; ++i)
+		cparse_cache_relocate(w, symbols + i * sizeof(struct cparse_symbol) + offsetof(struct cparse_symbol, decl), cparse_cache_write_decl);
+}
+
+/* writes a decl and its children, but not the decls chained after it */
+static size_t cparse_cache_write_decl_node(struct cparse_cache_writer* w, struct cparse_decl const* decl)
+{
+	size_t size, alignment;
+	switch (decl->kind)
+	{
+		case CPARSE_DECL_ENUM_CONSTANT: size = sizeof(struct cparse_decl_enum_constant); alignment = __alignof(struct cparse_decl_enum_constant); break;
+		case CPARSE_DECL_ENUM: size = sizeof(struct cparse_decl_enum); alignment = __alignof(struct cparse_decl_enum); break;
+		case CPARSE_DECL_VARIABLE: size = sizeof(struct cparse_decl_variable_global); alignment = __alignof(struct cparse_decl_variable_global); break;
+		case CPARSE_DECL_FIELD: size = sizeof(struct cparse_decl_variable_field); alignment = __alignof(struct cparse_decl_variable_field); break;
+		case CPARSE_DECL_STRUCT: size = sizeof(struct cparse_decl_struct); alignment = __alignof(struct cparse_decl_struct); break;
+		case CPARSE_DECL_TYPEDEF: size = sizeof(struct cparse_decl_typedef); alignment = __alignof(struct cparse_decl_typedef); break;
+		case CPARSE_DECL_FUNCTION: size = sizeof(struct cparse_decl_function); alignment = __alignof(struct cparse_decl_function); break;
+		default: w->failed = true; return 0;
+	}
+
+	const size_t offset = cparse_cache_put(w, decl, size, (uint)alignment);
+	cparse_cache_insert(w, decl, offset);
+	cparse_cache_clear_pointer(w, offset + offsetof(struct cparse_decl, next));
+
+	/* spellings are always copied and null terminated, slices included */
+	if (decl->spelling) {
+		const size_t spelling = cparse_cache_put(w, decl->spelling, decl->spelling_length + 1, 1);
+		if (!w->failed) {
+			w->data[spelling + decl->spelling_length] = 0;
+			cparse_cache_link(w, offset + offsetof(struct cparse_decl, spelling), spelling);
+		}
+	}
+
+	switch (decl->kind)
+	{
+		case CPARSE_DECL_ENUM:
+			cparse_cache_relocate(w, offset + offsetof(struct cparse_decl_enum, constants), cparse_cache_write_decl);
+			cparse_cache_write_symbols(w, offset + offsetof(struct cparse_decl_enum, symbols), &((struct cparse_decl_enum const*)decl)->symbols);
+			break;
+
+		case CPARSE_DECL_VARIABLE:
+		case CPARSE_DECL_FIELD:
+			cparse_cache_relocate(w, offset + offsetof(struct cparse_decl_variable, type), cparse_cache_write_type);
+			break;
+
+		case CPARSE_DECL_STRUCT:
+			cparse_cache_relocate(w, offset + offsetof(struct cparse_decl_struct, fields), cparse_cache_write_decl);
+			cparse_cache_write_symbols(w, offset + offsetof(struct cparse_decl_struct, symbols), &((struct cparse_decl_struct const*)decl)->symbols);
+			break;
+
+		case CPARSE_DECL_TYPEDEF:
+			cparse_cache_relocate(w, offset + offsetof(struct cparse_decl_typedef, type), cparse_cache_write_type);
+			break;
+
+		case CPARSE_DECL_FUNCTION:
+			cparse_cache_relocate(w, offset + offsetof(struct cparse_decl_function, return_type), cparse_cache_write_type);
+			break;
+
+		default:
+			break;
+	}
+
+	return offset;
+}
+
+/* writes the chain of decls starting at ptr, iteratively to keep the recursion depth bounded by the nesting */
+static size_t cparse_cache_write_decl(struct cparse_cache_writer* w, const void* ptr)
+{
+	struct cparse_decl const* decl = ptr;
+	const size_t first = cparse_cache_write_decl_node(w, decl);
+
+	for (size_t offset = first; decl->next && !w->failed; decl = decl->next) {
+		size_t next;
+		if (cparse_cache_find(w, decl->next, &next)) {
+			/* the rest of the chain is written by whoever wrote next */
+			cparse_cache_link(w, offset + offsetof(struct cparse_decl, next), next);
+			break;
+		}
+		next = cparse_cache_write_decl_node(w, decl->next);
+		cparse_cache_link(w, offset + offsetof(struct cparse_decl, next), next);
+		offset = next;
+	}
+
+	return first;
+}
+
+static size_t cparse_cache_write_unit(struct cparse_cache_writer* w, struct cparse_unit const* unit)
+{
+	const size_t offset = cparse_cache_put(w, unit, sizeof(struct cparse_unit), __alignof(struct cparse_unit));
+	cparse_cache_insert(w, unit, offset);
+	cparse_cache_clear_pointer(w, offset + offsetof(struct cparse_unit, blocks));
+	cparse_cache_relocate(w, offset + offsetof(struct cparse_unit, decls), cparse_cache_write_decl);
+	cparse_cache_write_symbols(w, offset + offsetof(struct cparse_unit, symbols), &unit->symbols);
+	cparse_cache_write_symbols(w, offset + offsetof(struct cparse_unit, typedefs), &unit->typedefs);
+
+	/* spellings are copies in the image and the arena is set once it is loaded */
+	cparse_cache_clear_pointer(w, offset + offsetof(struct cparse_unit, source));
+	cparse_cache_clear_pointer(w, offset + offsetof(struct cparse_unit, alloc_cursor));
+	cparse_cache_clear_pointer(w, offset + offsetof(struct cparse_unit, alloc_end));
+	cparse_cache_clear_pointer(w, offset + offsetof(struct cparse_unit, diagnostics));
+
+	size_t field = offset + offsetof(struct cparse_unit, spans);
+	for (struct cparse_unit_span const* span = unit->spans; span && !w->failed; span = span->next) {
+		const size_t span_offset = cparse_cache_put(w, span, sizeof(struct cparse_unit_span), __alignof(struct cparse_unit_span));
+		cparse_cache_link(w, field, span_offset);
+		cparse_cache_relocate(w, span_offset + offsetof(struct cparse_unit_span, decl), cparse_cache_write_decl);
+		field = span_offset + offsetof(struct cparse_unit_span, next);
+	}
+	return offset;
+}
+
+/* writes the cache file of the unit, failures are ignored */
+static void cparse_cache_store(struct cparse_state* s, struct cparse_unit const* unit)
+{
+	struct cparse_cache_writer w;
+	memset(&w, 0, sizeof(w));
+	w.alignment = 1;
+
+	const size_t unit_offset = cparse_cache_write_unit(&w, unit);
+	const size_t image_size = w.size;
+
+	/* the dependencies follow the image and the relocations, everything padded to 8 bytes */
+	cparse_cache_put(&w, NULL, 0, 8);
+	if (w.num_relocations)
+		cparse_cache_put(&w, w.relocations, w.num_relocations * sizeof(uint64_t), 8);
+
+	uint64_t num_dependencies = 0;
+	for (struct cparse_pp_dependency* dependency = s->pp.dependencies; dependency; dependency = dependency->next) {
+		const uint64_t path_length = strlen(dependency->path) + 1;
+		cparse_cache_put(&w, &dependency->hash, sizeof(uint64_t), 8);
+		cparse_cache_put(&w, &path_length, sizeof(uint64_t), 8);
+		cparse_cache_put(&w, dependency->path, (size_t)path_length, 1);
+		cparse_cache_put(&w, NULL, 0, 8);
+		++num_dependencies;
+	}
+
+	if (!w.failed) {
+		struct cparse_cache_header header;
+		memset(&header, 0, sizeof(header));
+		header.magic = CPARSE_CACHE_MAGIC;
+		header.version = CPARSE_CACHE_VERSION;
+		header.pointer_size = sizeof(void*);
+		header.image_alignment = w.alignment;
+		header.key = s->cache_key;
+		header.payload_hash = cparse_hash64(CPARSE_CACHE_MAGIC, w.data, w.size);
+		header.image_size = image_size;
+		header.unit_offset = unit_offset;
+		header.num_relocations = w.num_relocations;
+		header.num_dependencies = num_dependencies;
+
+		/* written next to the final path and renamed over it, so that readers never see a partial file */
+		const char* cache_dir = s->info->cache_dir;
+		char* path = alloca(strlen(cache_dir) + 22);
+		char* temp_path = alloca(strlen(cache_dir) + 22 + 24);
+		cparse_cache_path(path, cache_dir, s->cache_key);
+		cparse_format(temp_path, strlen(cache_dir) + 22 + 24, "%s.%u.%u.tmp", path, cparse_process_id(), (uint)(uintptr_t)&w);
+
+		FILE* file = fopen(temp_path, "wb");
+		if (file) {
+			bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(w.data, 1, w.size, file) == w.size;
+			written = fclose(file) == 0 && written;
+#ifdef _WIN32
+			written = written && MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+			written = written && rename(temp_path, path) == 0;
+#endif
+			if (!written)
+				remove(temp_path);
+		}
+	}
+
+	free(w.data);
+	free(w.relocations);
+	free(w.objects);
+}
+
+/* relocates the image of a cache file into the buffer, returns null if the file is stale or invalid */
+static struct cparse_unit* cparse_cache_read(struct cparse_state* s, const char* data, cparse_size_t size)
+{
+	struct cparse_cache_header header;
+	if (size < sizeof(header))
+		return NULL;
+	memcpy(&header, data, sizeof(header));
+
+	if (header.magic != CPARSE_CACHE_MAGIC || header.version != CPARSE_CACHE_VERSION || header.pointer_size != sizeof(void*) || header.key != s->cache_key)
+		return NULL;
+
+	const char* payload = data + sizeof(header);
+	const cparse_size_t payload_size = size - sizeof(header);
+	const uint64_t image_padded = (header.image_size + 7) & ~(uint64_t)7;
+	if (image_padded > payload_size || header.num_relocations > (payload_size - image_padded) / 8)
+		return NULL;
+	if (header.unit_offset + sizeof(struct cparse_unit) > header.image_size || !header.image_alignment || header.image_alignment > 64 || (header.image_alignment & (header.image_alignment - 1)))
+		return NULL;
+	if (cparse_hash64(CPARSE_CACHE_MAGIC, payload, payload_size) != header.payload_hash)
+		return NULL;
+
+	/* every included file must be unchanged */
+	const char* p = payload + image_padded + header.num_relocations * 8;
+	const char* end = payload + payload_size;
+	for (uint64_t i = 0; i < header.num_dependencies; ++i) {
+		uint64_t hash, path_length;
+		if (end - p < 16)
+			return NULL;
+		memcpy(&hash, p, 8);
+		memcpy(&path_length, p + 8, 8);
+		p += 16;
+		if (!path_length || path_length > (uint64_t)(end - p) || p[path_length - 1])
+			return NULL;
+
+		struct cparse_source_file file;
+		cparse_source_file_open(&file, p);
+		const bool unchanged = file.data && cparse_hash64(CPARSE_CACHE_MAGIC, file.data, file.size) == hash;
+		cparse_source_file_close(&file);
+		if (!unchanged)
+			return NULL;
+
+		p += (path_length + 7) & ~(uint64_t)7;
+	}
+
+	char* image = cparse_alloc(s, (cparse_size_t)header.image_size, header.image_alignment);
+	memcpy(image, payload, (size_t)header.image_size);
+
+	const char* relocations = payload + image_padded;
+	for (uint64_t i = 0; i < header.num_relocations; ++i) {
+		uint64_t field;
+		uintptr_t value;
+		memcpy(&field, relocations + i * 8, 8);
+		if (field > header.image_size - sizeof(uintptr_t) || field % sizeof(uintptr_t))
+			return NULL;
+		memcpy(&value, image + field, sizeof(value));
+		if (value >= header.image_size)
+			return NULL;
+		value += (uintptr_t)image;
+		memcpy(image + field, &value, sizeof(value));
+	}
+
+	return (struct cparse_unit*)(image + header.unit_offset);
+}
+
+/* the spellings of a unit read from the cache point into its image, swaps them for the copies kept by the context */
+static void cparse_cache_intern_spellings(struct cparse_state* s, struct cparse_decl* decl)
+{
+	if (decl->spelling && !(decl->spelling = cparse_context_intern(s->context, decl->spelling, decl->spelling_length)))
+		cparse_error_out_of_memory(s);
+
+	struct cparse_decl* child = NULL;
+	if (decl->kind == CPARSE_DECL_ENUM)
+		child = (struct cparse_decl*)((struct cparse_decl_enum*)decl)->constants;
+	else if (decl->kind == CPARSE_DECL_STRUCT)
+		child = (struct cparse_decl*)((struct cparse_decl_struct*)decl)->fields;
+
+	for (; child; child = child->next)
+		cparse_cache_intern_spellings(s, child);
+}
+
+static bool cparse_cache_load(struct cparse_state* s, struct cparse_unit** out)
+{
+	const char* cache_dir = s->info->cache_dir;
+	char* path = alloca(strlen(cache_dir) + 22);
+	cparse_cache_path(path, cache_dir, s->cache_key);
+
+	/* tracked with the included files, so that the mapping is released if the buffer runs out */
+	struct cparse_pp_source* source = cparse_alloc_type(s, struct cparse_pp_source);
+	cparse_source_file_open(&source->file, path);
+	if (!source->file.data)
+		return false;
+	source->next = s->pp.sources;
+	s->pp.sources = source;
+
+	*out = cparse_cache_read(s, source->file.data, source->file.size);
+	cparse_pp_release_sources(s);
+	if (!*out)
+		return false;
+
+	/* named tags and typedefs are all in the symbol tables, declared or not, anonymous tags, functions and variables
+	   only in the list */
+	if (s->context) {
+		struct cparse_symbol_table const* tables[2] = { &(*out)->symbols, &(*out)->typedefs };
+		for (int table = 0; table < 2; ++table) {
+			for (int i = 0; i < tables[table]->capacity; ++i) {
+				if (tables[table]->symbols[i].decl)
+					cparse_cache_intern_spellings(s, tables[table]->symbols[i].decl);
+			}
+		}
+		for (struct cparse_decl* decl = (*out)->decls; decl; decl = decl->next) {
+			if (!decl->spelling || decl->kind == CPARSE_DECL_FUNCTION || decl->kind == CPARSE_DECL_VARIABLE)
+				cparse_cache_intern_spellings(s, decl);
+		}
+	}
+	return true;
+}
+
+static void cparse_state_init(struct cparse_state* s, const char* filename, uint state_flags, struct cparse_info const* info)
+{
+#ifndef NDEBUG
+	cparse_keywords_check();
+#endif
+	s->context = info->context;
+	s->info = info;
+	s->flags = info->flags | state_flags;
+	s->measured_size = 0;
+	s->measured_alignment = 1;
+	s->alloc_begin = info->buffer;
+	s->alloc_end = info->buffer + info->buffer_size;
+	s->alloc_cursor = info->buffer;
+	s->alloc_retired = 0;
+	s->blocks = NULL;
+	if (!(state_flags & CPARSE_STATE_ERROR_BUFFER)) {
+		s->error_buffer = info->buffer;
+		s->error_buffer_size = info->buffer_size;
+	}
+
+	s->stream_arena.alloc_begin = s->stream_arena.alloc_end = s->stream_arena.alloc_cursor = NULL;
+	s->stream_arena.alloc_retired = 0;
+	s->stream_arena.blocks = NULL;
+	if (info->on_enum || info->on_struct) {
+		/* a streamed unit is never complete, there is nothing to cache */
+		s->flags = (s->flags | CPARSE_STATE_STREAM) & ~CPARSE_STATE_CACHE;
+		s->alloc_end = info->buffer + info->buffer_size / 2;
+		s->stream_arena.alloc_begin = s->stream_arena.alloc_cursor = s->alloc_end;
+		s->stream_arena.alloc_end = info->buffer + info->buffer_size;
+	}
+
+	s->abi = &cparse_abi_layouts[(uint)info->abi < CPARSE_ABI_COUNT_ ? info->abi : CPARSE_ABI_X86_64_SYSV];
+	s->defining = NULL;
+	s->incomplete_types = NULL;
+	s->stream_incomplete_types = NULL;
+	cparse_type_table_init(&s->types);
+	s->linked = false;
+	s->typedefs_changed = false;
+	s->recover_handler = NULL;
+	s->lexing = false;
+	s->last_diagnostic = NULL;
+	s->completing = NULL;
+
+#ifndef CPARSE_NO_STATS
+	s->stats = info->stats;
+#else
+	s->stats = NULL;
+#endif
+	if (cparse_stats_enabled(s))
+		cparse_stats_begin(s);
+
+	s->pp.sources = NULL;
+	s->lex.filename = filename ? filename : "<buffer>";
+	s->lex.line = 1;
+	s->lex.line_begin = s->lex.cursor = NULL;
+	s->lex.curr = -1;
+}
+
+/* hands the arena over to the unit */
+static void cparse_unit_finish(struct cparse_state* s, struct cparse_unit* unit)
+{
+	struct cparse_block** last = &s->blocks;
+	while (*last)
+		last = &(*last)->next;
+	*last = s->stream_arena.blocks;
+	s->stream_arena.blocks = NULL;
+
+	unit->blocks = s->blocks;
+	unit->alloc_cursor = s->alloc_cursor;
+	unit->alloc_end = s->alloc_end;
+}
+
+static enum cparse_result cparse_run(struct cparse_state* s, const char* filename, const char* data, cparse_size_t size, uint state_flags, struct cparse_info const* info, struct cparse_unit** out)
+{
+	cparse_state_init(s, filename, state_flags, info);
+
+	const double wall_begin = cparse_stats_enabled(s) ? cparse_wall_clock() : 0.0;
+	const uint64_t ticks_begin = cparse_stats_enabled(s) ? cparse_ticks() : 0;
+
+	/* set the error handler and handle any error */
+	int result = setjmp(s->error_handler);
+	if (result) {
+		if (cparse_stats_enabled(s))
+			cparse_stats_end(s, wall_begin, ticks_begin);
+		cparse_pp_release_sources(s);
+		cparse_release_blocks(s->blocks, info);
+		cparse_release_blocks(s->stream_arena.blocks, info);
+		return result;
+	}
+
+	if (!data) {
+		cparse_error(s, CPARSE_RESULT_INVALID_INPUT_FILE, "cannot open file.");
+	}
+
+	if (cparse_stats_enabled(s)) {
+		s->stats->bytes_read += size;
+		++s->stats->files_read;
+	}
+
+	if ((s->flags & CPARSE_STATE_CACHE) && !cparse_cache_key(info, filename, data, size, &s->cache_key))
+		s->flags &= ~CPARSE_STATE_CACHE;
+
+	if (s->flags & CPARSE_STATE_CACHE) {
+		if (cparse_cache_load(s, out)) {
+			cparse_unit_finish(s, *out);
+			if (cparse_stats_enabled(s))
+				cparse_stats_end(s, wall_begin, ticks_begin);
+			return CPARSE_RESULT_OK;
+		}
+	}
+
+	/* spellings must outlive a transient source, so move it into the buffer once. data is not reassigned, it is live
+	   across the setjmp above. */
+	const char* source = data;
+	if ((s->flags & CPARSE_FLAG_SPELLING_SLICES) && (s->flags & CPARSE_STATE_TRANSIENT_SOURCE)) {
+		char* copy = cparse_alloc(s, size, 1);
+		memcpy(copy, data, size);
+		source = copy;
+	}
+
+	s->source = source;
+	cparse_arena_swap(s);
+	cparse_pp_init(s);
+	cparse_arena_swap(s);
+	cparse_lex_begin(s, s->lex.filename, source, size); /* filename is not read after the setjmp either */
+	cparse_lex(s);
+
+	*out = cparse_parse_unit(s);
+	cparse_unit_finish(s, *out);
+	cparse_pp_release_sources(s);
+
+	/* the cache only keeps units parsed without errors */
+	if ((s->flags & CPARSE_STATE_CACHE) && !(*out)->diagnostics)
+		cparse_cache_store(s, *out);
+
+	if (cparse_stats_enabled(s))
+		cparse_stats_end(s, wall_begin, ticks_begin);
+
+	return CPARSE_RESULT_OK;
+}
+
+static enum cparse_result cparse_run_file(struct cparse_state* s, const char* filename, uint state_flags, struct cparse_info const* info, struct cparse_unit** out)
+{
+	struct cparse_source_file file;
+
+	const double open_begin = cparse_stats_enabled(info) ? cparse_wall_clock() : 0.0;
+	cparse_source_file_open(&file, filename);
+	const double open_seconds = cparse_stats_enabled(info) ? cparse_wall_clock() - open_begin : 0.0;
+	state_flags |= CPARSE_STATE_TRANSIENT_SOURCE | (info->cache_dir ? CPARSE_STATE_CACHE : 0);
+	enum cparse_result result = cparse_run(s, filename, file.data, file.size, state_flags, info, out);
+	cparse_source_file_close(&file);
+
+	/* cparse_run resets the stats, the main file was opened before */
+	if (cparse_stats_enabled(s))
+		s->stats->open_seconds += open_seconds;
+	return result;
+}
+
+CPARSE_API enum cparse_result cparse_file(const char* filename, struct cparse_info const* info, struct cparse_unit** out)
+{
+	struct cparse_state state;
+	return cparse_run_file(&state, filename, 0, info, out);
+}
+
+CPARSE_API enum cparse_result cparse_buffer(const char* data, cparse_size_t size, const char* filename, struct cparse_info const* info, struct cparse_unit** out)
+{
+	struct cparse_state state;
+	return cparse_run(&state, filename, data ? data : "", data ? size : 0, 0, info, out);
+}
+
+/* parallel parsing */
+
+struct cparse_files_job {
+	const char** filenames;
+	int count;
+	struct cparse_file_result* results;
+	struct cparse_info info; /* no caller buffer, every unit chains its own blocks */
+	volatile long next; /* next file to parse, workers pick files one at a time */
+};
+
+static void cparse_files_work(struct cparse_files_job* job)
+{
+	for (;;) {
+		long index = cparse_atomic_fetch_add(&job->next, 1);
+		if (index >= job->count)
+			break;
+
+		struct cparse_file_result* result = &job->results[index];
+		struct cparse_state state;
+		state.error_buffer = result->error;
+		state.error_buffer_size = sizeof(result->error);
+		result->error[0] = 0;
+		result->unit = NULL;
+		result->result = cparse_run_file(&state, job->filenames[index], CPARSE_STATE_ERROR_BUFFER, &job->info, &result->unit);
+	}
+}
+
+#ifdef _WIN32
+typedef HANDLE cparse_thread;
+
+static DWORD WINAPI cparse_files_thread(LPVOID job)
+{
+	cparse_files_work(job);
+	return 0;
+}
+
+static bool cparse_thread_start(cparse_thread* thread, struct cparse_files_job* job)
+{
+	*thread = CreateThread(NULL, 0, cparse_files_thread, job, 0, NULL);
+	return *thread != NULL;
+}
+
+static void cparse_thread_join(cparse_thread thread)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+static int cparse_cpu_count(void)
+{
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	return (int)system_info.dwNumberOfProcessors;
+}
+#else
+typedef pthread_t cparse_thread;
+
+static void* cparse_files_thread(void* job)
+{
+	cparse_files_work(job);
+	return NULL;
+}
+
+static bool cparse_thread_start(cparse_thread* thread, struct cparse_files_job* job)
+{
+	return pthread_create(thread, NULL, cparse_files_thread, job) == 0;
+}
+
+static void cparse_thread_join(cparse_thread thread)
+{
+	pthread_join(thread, NULL);
+}
+
+static int cparse_cpu_count(void)
+{
+	return (int)sysconf(_SC_NPROCESSORS_ONLN);
+}
+#endif
+
+CPARSE_API enum cparse_result cparse_files(const char** filenames, int count, int num_threads, struct cparse_info const* info, struct cparse_file_result* results)
+{
+	struct cparse_files_job job;
+	job.filenames = filenames;
+	job.count = count;
+	job.results = results;
+	job.info = *info;
+	job.info.buffer = NULL;
+	job.info.buffer_size = 0;
+	job.info.stats = NULL;
+	if (!job.info.allocate) {
+		job.info.allocate = cparse_default_allocate;
+		job.info.deallocate = cparse_default_deallocate;
+	}
+	job.next = 0;
+
+	if (num_threads <= 0)
+		num_threads = cparse_cpu_count();
+	if (num_threads > count)
+		num_threads = count;
+
+	/* the calling thread is a worker too, if some thread cannot be started the others parse its share */
+	cparse_thread* threads = num_threads > 1 ? malloc(sizeof(cparse_thread) * (num_threads - 1)) : NULL;
+	int num_started = 0;
+	while (threads && num_started < num_threads - 1 && cparse_thread_start(&threads[num_started], &job))
+		++num_started;
+
+	cparse_files_work(&job);
+
+	for (int i = 0; i < num_started; ++i)
+		cparse_thread_join(threads[i]);
+	free(threads);
+
+	/* report the first failure in file order so that the result does not depend on scheduling */
+	for (int i = 0; i < count; ++i) {
+		if (results[i].result != CPARSE_RESULT_OK)
+			return results[i].result;
+	}
+	return CPARSE_RESULT_OK;
+}
+
+static enum cparse_result cparse_measure_run(const char* filename, const char* data, cparse_size_t data_size, uint state_flags, struct cparse_info const* info, cparse_size_t* size, cparse_size_t* alignment)
+{
+	/* the nodes still have to be built to resolve names, do it in scratch memory */
+	struct cparse_info scratch = *info;
+	scratch.on_enum = NULL;
+	scratch.on_struct = NULL;
+	scratch.stats = NULL;
+	if (!scratch.allocate) {
+		scratch.allocate = cparse_default_allocate;
+		scratch.deallocate = cparse_default_deallocate;
+	}
 
-			case 't':
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
-				if (cparse_lex_accept(s, "ypedef"))
-				{
-					l->lookahead = CPARSE_KW_TYPEDEF;
-				}
-				goto parse_identifier;
+	struct cparse_state state;
+	struct cparse_unit* unit;
+	enum cparse_result result = cparse_run(&state, filename, data, data_size, state_flags | CPARSE_STATE_MEASURE, &scratch, &unit);
+	if (result == CPARSE_RESULT_OK) {
+		cparse_release_blocks(unit->blocks, &scratch);
+		*size = state.measured_size;
+		*alignment = state.measured_alignment;
+	}
+	return result;
+}
 
-			case 'u':
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
-				if (cparse_lex_accept(s, "nsigned"))
-				{
-					l->lookahead = CPARSE_KW_UNSIGNED;
-				}
-				goto parse_identifier;
+CPARSE_API enum cparse_result cparse_measure(const char* filename, struct cparse_info const* info, cparse_size_t* size, cparse_size_t* alignment)
+{
+	struct cparse_source_file file;
 
-			case 'v':
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
-				if (cparse_lex_accept(s, "olatile"))
-				{
-					l->lookahead = CPARSE_KW_VOLATILE;
-				}
-				goto parse_identifier;
+	cparse_source_file_open(&file, filename);
+	enum cparse_result result = cparse_measure_run(filename, file.data, file.size, CPARSE_STATE_TRANSIENT_SOURCE, info, size, alignment);
+	cparse_source_file_close(&file);
+	return result;
+}
 
-			case 'w':
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
-				if (cparse_lex_accept(s, "hile"))
-				{
-					l->lookahead = CPARSE_KW_WHILE;
-				}
-				goto parse_identifier;
+CPARSE_API enum cparse_result cparse_measure_buffer(const char* data, cparse_size_t data_size, const char* filename, struct cparse_info const* info, cparse_size_t* size, cparse_size_t* alignment)
+{
+	return cparse_measure_run(filename, data ? data : "", data ? data_size : 0, 0, info, size, alignment);
+}
 
-			default:
-				if (!cparse_lex_is_identifier_char(l->curr, true))
-					goto lex_error;
-				cparse_lex_push(s);
-				l->lookahead = CPARSE_TOK_IDENTIFIER;
+CPARSE_API void cparse_unit_release(struct cparse_unit* unit, struct cparse_info const* info)
+{
+	/* the unit itself may live in one of the blocks */
+	struct cparse_block* blocks = unit->blocks;
+	unit->blocks = NULL;
+	cparse_release_blocks(blocks, info);
+}
 
-			parse_identifier:
-				while (cparse_lex_is_identifier_char(l->curr, false)) {
-					cparse_lex_push(s);
-					l->lookahead = CPARSE_TOK_IDENTIFIER;
-				}
-				return l->lookahead;
+/* moves the slice spellings of decl and its children from the old source to the new one */
+static void cparse_rebase_spellings(struct cparse_decl* decl, const char* old_source, cparse_size_t old_size, const char* source, cparse_size_t shift)
+{
+	if (decl->spelling >= old_source && decl->spelling < old_source + old_size)
+		decl->spelling = source + ((cparse_size_t)(decl->spelling - old_source) + shift);
 
-			lex_error:
-				cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "unexpected '%c'.", s->lex.curr);
-				break;
+	struct cparse_decl* child = NULL;
+	if (decl->kind == CPARSE_DECL_ENUM)
+		child = (struct cparse_decl*)((struct cparse_decl_enum*)decl)->constants;
+	else if (decl->kind == CPARSE_DECL_STRUCT)
+		child = (struct cparse_decl*)((struct cparse_decl_struct*)decl)->fields;
+
+	for (; child; child = child->next)
+		cparse_rebase_spellings(child, old_source, old_size, source, shift);
+}
+
+/* moves the source ranges of a function or variable by shift, unless they are not in the source */
+static void cparse_rebase_ranges(struct cparse_decl* decl, cparse_size_t shift)
+{
+	if (decl->kind == CPARSE_DECL_FUNCTION) {
+		struct cparse_decl_function* function = (struct cparse_decl_function*)decl;
+		if (function->parameters_end) {
+			function->parameters_begin += shift;
+			function->parameters_end += shift;
+		}
+		if (function->body_end) {
+			function->body_begin += shift;
+			function->body_end += shift;
+		}
+	}
+	else if (decl->kind == CPARSE_DECL_VARIABLE) {
+		struct cparse_decl_variable_global* variable = (struct cparse_decl_variable_global*)decl;
+		if (variable->initializer_end) {
+			variable->initializer_begin += shift;
+			variable->initializer_end += shift;
 		}
 	}
 }
 
-/* parsing helpers */
+/* the symbol tables of a unit before an update, to restore on failure */
+struct cparse_unit_tables {
+	struct cparse_symbol_table symbols;
+	struct cparse_symbol_table typedefs;
+	struct cparse_symbol* saved; /* the symbols of both, in one allocation */
+};
 
-static void cparse_error_syntax(struct cparse_state* s)
+static bool cparse_unit_tables_save(struct cparse_unit_tables* tables, struct cparse_unit const* unit)
 {
-	cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "unexpected '%s'.", s->lex.token_buffer);
+	tables->symbols = unit->symbols;
+	tables->typedefs = unit->typedefs;
+	tables->saved = NULL;
+
+	const size_t capacity = (size_t)unit->symbols.capacity + (size_t)unit->typedefs.capacity;
+	if (!capacity)
+		return true;
+	if (!(tables->saved = malloc(capacity * sizeof(struct cparse_symbol))))
+		return false;
+	if (unit->symbols.capacity)
+		memcpy(tables->saved, unit->symbols.symbols, unit->symbols.capacity * sizeof(struct cparse_symbol));
+	if (unit->typedefs.capacity)
+		memcpy(tables->saved + unit->symbols.capacity, unit->typedefs.symbols, unit->typedefs.capacity * sizeof(struct cparse_symbol));
+	return true;
 }
 
-static void cparse_error_syntax_expected(struct cparse_state* s, cparse_token_t tok)
+/* the table decl is found in, null for anonymous enums and structs, functions and variables */
+static struct cparse_symbol_table* cparse_unit_table(struct cparse_unit* unit, struct cparse_decl const* decl)
 {
-	cparse_error(s, CPARSE_RESULT_SYNTAX_ERROR, "missing '%s' before '%s'.", cparse_strtok(tok), s->lex.token_buffer);
+	if (!decl->spelling || decl->kind == CPARSE_DECL_FUNCTION || decl->kind == CPARSE_DECL_VARIABLE)
+		return NULL;
+	return decl->kind == CPARSE_DECL_TYPEDEF ? &unit->typedefs : &unit->symbols;
 }
 
-static bool cparse_peek(struct cparse_state* s, cparse_token_t tok)
+static void cparse_unit_splice_undo(struct cparse_state* s, struct cparse_unit* unit, struct cparse_unit_tables* tables)
 {
-	return s->lex.lookahead == tok;
+	cparse_pp_release_sources(s);
+	unit->symbols = tables->symbols;
+	unit->typedefs = tables->typedefs;
+	if (tables->symbols.capacity)
+		memcpy(tables->symbols.symbols, tables->saved, tables->symbols.capacity * sizeof(struct cparse_symbol));
+	if (tables->typedefs.capacity)
+		memcpy(tables->typedefs.symbols, tables->saved + tables->symbols.capacity, tables->typedefs.capacity * sizeof(struct cparse_symbol));
+	free(tables->saved);
+
+	/* blocks chained meanwhile stay with the unit until it is released */
+	unit->blocks = s->blocks;
 }
 
-static bool cparse_accept(struct cparse_state* s, cparse_token_t tok)
+/* where an update resumes parsing. found by the caller of cparse_unit_splice, so that none of it is a local written
+   before the setjmp there. */
+struct cparse_unit_edit {
+	cparse_size_t start; /* end of the last declaration before the edit, 0 if none */
+	cparse_size_t old_edit_end; /* in the old source, where the text after the edit starts */
+	struct cparse_unit_span** first; /* link to the first span from start on */
+};
+
+static void cparse_unit_find_edit(struct cparse_unit_edit* edit, struct cparse_unit* unit, const char* old_data, cparse_size_t old_size, const char* data, cparse_size_t size)
 {
-	if (cparse_peek(s, tok))
-	{
-		cparse_lex(s);
+	/* the edit is what lies between the common prefix and the common suffix */
+	const cparse_size_t limit = old_size < size ? old_size : size;
+	cparse_size_t prefix = 0, suffix = 0;
+	while (prefix < limit && old_data[prefix] == data[prefix])
+		++prefix;
+	while (suffix < limit - prefix && old_data[old_size - 1 - suffix] == data[size - 1 - suffix])
+		++suffix;
+	edit->old_edit_end = old_size - suffix;
+
+	/* declarations that end before the edit lex the same way, parsing resumes after the last of them */
+	edit->first = &unit->spans;
+	edit->start = 0;
+	for (; *edit->first && (*edit->first)->end <= prefix; edit->first = &(*edit->first)->next)
+		edit->start = (*edit->first)->end;
+}
+
+/* splices the declarations the edit touched back in, returns false if the unit must be parsed from scratch */
+static bool cparse_unit_splice(struct cparse_state* s, struct cparse_unit* unit, struct cparse_unit_edit const* edit, cparse_size_t old_size, const char* data, cparse_size_t size, const char* filename, struct cparse_info const* info, enum cparse_result* result)
+{
+	struct cparse_unit_span** const first = edit->first;
+	const cparse_size_t start = edit->start;
+
+	/* the tags and typedefs declared from there on are out of sight while parsing, keep a copy to restore on failure */
+	struct cparse_unit_tables tables;
+	if (!cparse_unit_tables_save(&tables, unit)) {
+		*result = CPARSE_RESULT_OUT_OF_MEMORY;
 		return true;
 	}
-	return false;
+
+	cparse_state_init(s, filename, 0, info);
+	s->alloc_begin = unit->alloc_cursor;
+	s->alloc_cursor = unit->alloc_cursor;
+	s->alloc_end = unit->alloc_end;
+	s->blocks = unit->blocks;
+	s->unit = unit;
+
+	const double wall_begin = cparse_stats_enabled(s) ? cparse_wall_clock() : 0.0;
+	const uint64_t ticks_begin = cparse_stats_enabled(s) ? cparse_ticks() : 0;
+	if (cparse_stats_enabled(s)) {
+		s->stats->bytes_read += size - start;
+		++s->stats->files_read;
+	}
+
+	struct cparse_unit_span* new_spans = NULL;
+	struct cparse_unit_span** volatile last_span = &new_spans; /* volatile, both are written after the setjmp */
+	struct cparse_unit_span* volatile old = *first;
+
+	int error = setjmp(s->error_handler);
+	if (error) {
+		if (cparse_stats_enabled(s))
+			cparse_stats_end(s, wall_begin, ticks_begin);
+		cparse_unit_splice_undo(s, unit, &tables);
+		*result = error;
+
+		/* a full parse reports every error in the declarations of the new text */
+		return !(s->flags & CPARSE_FLAG_RECOVER) || s->lexing || (error != CPARSE_RESULT_SYNTAX_ERROR && error != CPARSE_RESULT_SEMANTIC_ERROR);
+	}
+
+	for (struct cparse_unit_span* span = old; span; span = span->next) {
+		struct cparse_decl* decl = span->decl;
+		for (int i = 0; i < span->num_decls; ++i, decl = decl->next) {
+			if (cparse_unit_table(unit, decl))
+				cparse_symbol_table_remove(cparse_unit_table(unit, decl), decl);
+		}
+	}
+
+	s->source = data;
+	cparse_pp_init(s);
+	cparse_lex_begin(s, s->lex.filename, data + start, size - start);
+	for (const char* p = data; (p = memchr(p, '\n', (size_t)(data + start - p))) != NULL; ++p) {
+		++s->lex.line;
+		s->lex.line_begin = p + 1;
+	}
+	if (s->lex.line == 1)
+		s->lex.line_begin = data;
+
+	struct cparse_decl* decls = NULL;
+	struct cparse_decl** last_next = &decls;
+
+	for (cparse_lex(s); !s->pp.rewritten && !s->linked; ) {
+		const bool eof = cparse_peek(s, CPARSE_TOK_EOF);
+		const cparse_size_t offset = eof ? size : (cparse_size_t)(s->lex.token - data);
+
+		/* drop the old declarations the edit overlaps or the parse went past, stop at the first one that
+		   starts right where the parse is, from there on the source is the same */
+		while (old && (eof || old->begin < edit->old_edit_end || size - (old_size - old->begin) < offset))
+			old = old->next;
+		if (eof || (old && size - (old_size - old->begin) == offset))
+			break;
+
+		struct cparse_unit_span* span = cparse_parse_declaration(s, &last_next);
+		if (span) {
+			*last_span = span;
+			last_span = &span->next;
+		}
+	}
+
+	/* types elsewhere may point to the dropped declarations, and the names of dropped typedefs may be read
+	   differently by the declarations kept */
+	bool dropped_referenced = false;
+	for (struct cparse_unit_span* span = *first; span != old; span = span->next) {
+		struct cparse_decl const* decl = span->decl;
+		for (int i = 0; i < span->num_decls; ++i, decl = decl->next)
+			dropped_referenced = dropped_referenced || decl->referenced || decl->kind == CPARSE_DECL_TYPEDEF;
+	}
+
+	if (s->pp.rewritten || s->linked || s->typedefs_changed || dropped_referenced) {
+		cparse_unit_splice_undo(s, unit, &tables);
+		return false;
+	}
+
+	for (struct cparse_unit_span* span = old; span; span = span->next) {
+		struct cparse_decl* decl = span->decl;
+		for (int i = 0; i < span->num_decls; ++i, decl = decl->next) {
+			if (cparse_unit_table(unit, decl) && cparse_symbol_table_insert(s, cparse_unit_table(unit, decl), decl))
+				cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "redefinition of '%.*s'.", decl->spelling_length, decl->spelling);
+		}
+	}
+
+	cparse_pp_release_sources(s);
+	free(tables.saved);
+
+	/* the old declarations after the edit are kept, they only move */
+	for (struct cparse_unit_span* span = old; span; span = span->next) {
+		span->begin = size - (old_size - span->begin);
+		span->end = size - (old_size - span->end);
+
+		struct cparse_decl* decl = span->decl;
+		for (int i = 0; i < span->num_decls; ++i, decl = decl->next)
+			cparse_rebase_ranges(decl, size - old_size);
+	}
+
+	if (unit->source) {
+		for (struct cparse_unit_span* span = unit->spans; span != *first; span = span->next) {
+			struct cparse_decl* decl = span->decl;
+			for (int i = 0; i < span->num_decls; ++i, decl = decl->next)
+				cparse_rebase_spellings(decl, unit->source, old_size, data, 0);
+		}
+		for (struct cparse_unit_span* span = old; span; span = span->next) {
+			struct cparse_decl* decl = span->decl;
+			for (int i = 0; i < span->num_decls; ++i, decl = decl->next)
+				cparse_rebase_spellings(decl, unit->source, old_size, data, size - old_size);
+		}
+		unit->source = data;
+	}
+
+	*last_span = old;
+	*first = new_spans;
+
+	/* the decls of a span are chained already, only the links between spans change */
+	last_next = &unit->decls;
+	for (struct cparse_unit_span* span = unit->spans; span; span = span->next) {
+		struct cparse_decl* decl = span->decl;
+		for (int i = 0; i < span->num_decls; ++i, decl = decl->next) {
+			*last_next = decl;
+			last_next = &decl->next;
+		}
+	}
+	*last_next = NULL;
+
+	cparse_unit_finish(s, unit);
+	if (cparse_stats_enabled(s))
+		cparse_stats_end(s, wall_begin, ticks_begin);
+	*result = CPARSE_RESULT_OK;
+	return true;
 }
 
-static void cparse_check(struct cparse_state* s, cparse_token_t tok)
+CPARSE_API enum cparse_result cparse_unit_update(struct cparse_unit** unit, const char* old_data, cparse_size_t old_size, const char* data, cparse_size_t size, const char* filename, struct cparse_info const* info)
 {
-	if (!cparse_peek(s, tok))
-		cparse_error_syntax_expected(s, tok);
+	struct cparse_state state;
+	enum cparse_result result;
+
+	if (!data) {
+		data = "";
+		size = 0;
+	}
+
+	if ((*unit)->incremental) {
+		if (!old_data)
+			old_size = 0;
+		struct cparse_unit_edit edit;
+		cparse_unit_find_edit(&edit, *unit, old_data ? old_data : "", old_size, data, size);
+		if (cparse_unit_splice(&state, *unit, &edit, old_size, data, size, filename, info, &result))
+			return result;
+	}
+
+	cparse_unit_release(*unit, info);
+	*unit = NULL;
+	return cparse_run(&state, filename, data, size, 0, info, unit);
 }
 
-static void cparse_expect(struct cparse_state* s, cparse_token_t tok)
+CPARSE_API struct cparse_decl* cparse_unit_find(struct cparse_unit const* unit, const char* spelling, int length)
 {
-	cparse_check(s, tok);
-	cparse_lex(s);
+	return cparse_symbol_table_find(&unit->symbols, spelling, length);
 }
 
-static const char* cparse_scan_token_string(struct cparse_state* s)
+CPARSE_API struct cparse_decl_typedef* cparse_unit_find_typedef(struct cparse_unit const* unit, const char* spelling, int length)
 {
-	char* tok = cparse_alloc(s, s->lex.token_size + 1, 1);
-	memcpy(tok, s->lex.token_buffer, s->lex.token_size + 1);
-	cparse_lex(s);
-	return tok;
+	struct cparse_decl* decl = cparse_symbol_table_find(&unit->typedefs, spelling, length);
+	assert(!decl || decl->kind == CPARSE_DECL_TYPEDEF);
+	return (struct cparse_decl_typedef*)decl;
 }
 
-/* initialize functions */
-static void cparse_decl_init(struct cparse_decl* decl, enum cparse_decl_kind type, const char* spelling)
+CPARSE_API struct cparse_decl_variable_field* cparse_struct_find_field(struct cparse_decl_struct const* struct_decl, const char* spelling, int length)
 {
-	decl->kind = type;
-	decl->spelling = spelling;
-	decl->next = NULL;
+	struct cparse_decl* decl = cparse_symbol_table_find(&struct_decl->symbols, spelling, length);
+	assert(!decl || decl->kind == CPARSE_DECL_FIELD);
+	return (struct cparse_decl_variable_field*)decl;
 }
 
-/* parsing functions */
+CPARSE_API struct cparse_decl_enum_constant* cparse_enum_find_constant(struct cparse_decl_enum const* enum_decl, const char* spelling, int length)
+{
+	struct cparse_decl* decl = cparse_symbol_table_find(&enum_decl->symbols, spelling, length);
+	assert(!decl || decl->kind == CPARSE_DECL_ENUM_CONSTANT);
+	return (struct cparse_decl_enum_constant*)decl;
+}
 
-static enum cparse_type_qualifier cparse_parse_type_qualifiers(struct cparse_state* s)
+/* compact units */
+
+struct cparse_compact_writer {
+	struct cparse_compact_unit* compact;
+	struct cparse_cache_writer indices; /* index of each decl and type by address, only the objects are used */
+	char* strings;
+};
+
+static unsigned cparse_compact_spelling(struct cparse_compact_writer* w, struct cparse_decl const* decl)
+{
+	if (!decl->spelling)
+		return 0;
+	const unsigned offset = (unsigned)w->compact->strings_size;
+	memcpy(w->strings + offset, decl->spelling, decl->spelling_length);
+	w->strings[offset + decl->spelling_length] = 0;
+	w->compact->strings_size += decl->spelling_length + 1;
+	return offset;
+}
+
+static unsigned cparse_compact_index(struct cparse_compact_writer const* w, const void* ptr)
+{
+	size_t index;
+	return cparse_cache_find(&w->indices, ptr, &index) ? (unsigned)index : CPARSE_COMPACT_NONE;
+}
+
+/* numbers the types not seen yet, each after the type it targets. types are interned, so this mostly finds them */
+static unsigned cparse_compact_number_type(struct cparse_compact_writer* w, struct cparse_type const* type)
+{
+	size_t index;
+	if (cparse_cache_find(&w->indices, type, &index))
+		return (unsigned)index;
+
+	if (type->kind == CPARSE_TYPE_POINTER)
+		cparse_compact_number_type(w, ((struct cparse_type_pointer const*)type)->pointee_type);
+	else if (type->kind == CPARSE_TYPE_ARRAY)
+		cparse_compact_number_type(w, ((struct cparse_type_array const*)type)->element_type);
+
+	index = w->compact->num_types++;
+	cparse_cache_insert(&w->indices, type, index);
+	return (unsigned)index;
+}
+
+/* writes type and the types it targets, down to the first one already written */
+static void cparse_compact_type(struct cparse_compact_writer* w, struct cparse_type const* type)
 {
-	enum cparse_type_qualifier qualifiers = CPARSE_TYPE_QUAL_NONE;
 	for (;;) {
-		switch (s->lex.lookahead) {
-			case CPARSE_KW_CONST: qualifiers |= CPARSE_TYPE_QUAL_CONST; break;
-			case CPARSE_KW_VOLATILE: qualifiers |= CPARSE_TYPE_QUAL_VOLATILE; break;
-			default: return qualifiers;
+		struct cparse_compact_type* node = w->compact->types + cparse_compact_index(w, type);
+		if (node->kind != 0xff)
+			return;
+
+		node->kind = (unsigned char)type->kind;
+		node->qualifiers = (unsigned char)type->qualifiers;
+		node->primitive = 0;
+		node->extent = 0;
+		node->size = type->size;
+		node->alignment = type->alignment;
+
+		switch (type->kind) {
+			case CPARSE_TYPE_POINTER:
+				type = ((struct cparse_type_pointer const*)type)->pointee_type;
+				node->target = cparse_compact_index(w, type);
+				continue;
+
+			case CPARSE_TYPE_ARRAY:
+				node->extent = ((struct cparse_type_array const*)type)->extent;
+				type = ((struct cparse_type_array const*)type)->element_type;
+				node->target = cparse_compact_index(w, type);
+				continue;
+
+			case CPARSE_TYPE_PRIMITIVE:
+				node->primitive = (unsigned char)((struct cparse_type_primitive const*)type)->kind;
+				node->target = CPARSE_COMPACT_NONE;
+				return;
+
+			case CPARSE_TYPE_STRUCT:
+				node->target = cparse_compact_index(w, ((struct cparse_type_struct const*)type)->struct_type);
+				return;
+
+			case CPARSE_TYPE_ENUM:
+				node->target = cparse_compact_index(w, ((struct cparse_type_enum const*)type)->enum_type);
+				return;
 		}
-		cparse_lex(s);
+		return;
 	}
 }
 
-static struct cparse_type* cparse_parse_type(struct cparse_state* s)
+CPARSE_API enum cparse_result cparse_unit_compact(struct cparse_unit const* unit, struct cparse_info const* info, struct cparse_compact_unit** out)
 {
-	bool primitive_signed = true;
-	enum cparse_type_primitive_kind primitive_kind = 0;
-	enum cparse_parse_type_qualifiers qualifier = cparse_parse_type_qualifiers(s);
+	struct cparse_compact_unit counts;
+	memset(&counts, 0, sizeof(counts));
+	counts.strings_size = 1;
 
-	switch (s->lex.lookahead)
+	struct cparse_compact_writer w;
+	memset(&w, 0, sizeof(w));
+	w.compact = &counts;
+
+	/* sizes first, the whole copy goes in one block. types can refer to decls that come later. */
+	for (struct cparse_decl const* decl = unit->decls; decl; decl = decl->next)
+		cparse_cache_insert(&w.indices, decl, counts.num_decls++);
+
+	for (struct cparse_decl const* decl = unit->decls; decl; decl = decl->next) {
+		counts.strings_size += decl->spelling ? decl->spelling_length + 1 : 0;
+
+		if (decl->kind == CPARSE_DECL_ENUM) {
+			for (struct cparse_decl const* constant = (struct cparse_decl const*)((struct cparse_decl_enum const*)decl)->constants; constant; constant = constant->next) {
+				++counts.num_constants;
+				counts.strings_size += constant->spelling_length + 1;
+			}
+		}
+		else if (decl->kind == CPARSE_DECL_TYPEDEF)
+			cparse_compact_number_type(&w, ((struct cparse_decl_typedef const*)decl)->type);
+		else if (decl->kind == CPARSE_DECL_FUNCTION)
+			cparse_compact_number_type(&w, ((struct cparse_decl_function const*)decl)->return_type);
+		else if (decl->kind == CPARSE_DECL_VARIABLE)
+			cparse_compact_number_type(&w, ((struct cparse_decl_variable const*)decl)->type);
+		else {
+			for (struct cparse_decl const* field = (struct cparse_decl const*)((struct cparse_decl_struct const*)decl)->fields; field; field = field->next) {
+				++counts.num_fields;
+				cparse_compact_number_type(&w, ((struct cparse_decl_variable const*)field)->type);
+				counts.strings_size += field->spelling_length + 1;
+			}
+		}
+	}
+
+	size_t size = sizeof(struct cparse_compact_unit);
+	const size_t constants_offset = size;
+	size += counts.num_constants * sizeof(struct cparse_compact_constant);
+	const size_t decls_offset = size;
+	size += counts.num_decls * sizeof(struct cparse_compact_decl);
+	const size_t fields_offset = size;
+	size += counts.num_fields * sizeof(struct cparse_compact_field);
+	const size_t types_offset = size;
+	size += counts.num_types * sizeof(struct cparse_compact_type);
+	const size_t strings_offset = size;
+	size += (size_t)counts.strings_size;
+
+	char* block = NULL;
+	if (!w.indices.failed && counts.strings_size <= 0xffffffffu)
+		block = info->allocate ? info->allocate(info->allocator_user_data, size) : cparse_default_allocate(NULL, size);
+	if (!block) {
+		free(w.indices.objects);
+		return CPARSE_RESULT_OUT_OF_MEMORY;
+	}
+
+	struct cparse_compact_unit* compact = (struct cparse_compact_unit*)block;
+	compact->constants = (struct cparse_compact_constant*)(block + constants_offset);
+	compact->decls = (struct cparse_compact_decl*)(block + decls_offset);
+	compact->fields = (struct cparse_compact_field*)(block + fields_offset);
+	compact->types = (struct cparse_compact_type*)(block + types_offset);
+	compact->strings = block + strings_offset;
+	compact->num_decls = counts.num_decls;
+	compact->num_fields = 0;
+	compact->num_constants = 0;
+	compact->num_types = counts.num_types;
+	compact->strings_size = 1;
+	w.compact = compact;
+	w.strings = block + strings_offset;
+	w.strings[0] = 0;
+
+	/* a kind no type has marks the nodes not written yet */
+	memset(compact->types, 0xff, counts.num_types * sizeof(struct cparse_compact_type));
+
+	struct cparse_compact_decl* node = compact->decls;
+	for (struct cparse_decl const* decl = unit->decls; decl; decl = decl->next, ++node) {
+		node->kind = (unsigned char)decl->kind;
+		node->storage_class = 0;
+		node->defined = 0;
+		node->spelling = cparse_compact_spelling(&w, decl);
+		node->spelling_length = (unsigned)decl->spelling_length;
+		node->type = CPARSE_COMPACT_NONE;
+		node->first = 0;
+		node->count = 0;
+		node->size = 0;
+		node->alignment = 0;
+		node->body_begin = 0;
+		node->body_end = 0;
+
+		if (decl->kind == CPARSE_DECL_ENUM) {
+			node->first = compact->num_constants;
+			for (struct cparse_decl const* constant = (struct cparse_decl const*)((struct cparse_decl_enum const*)decl)->constants; constant; constant = constant->next) {
+				struct cparse_compact_constant* compact_constant = compact->constants + compact->num_constants++;
+				compact_constant->value = ((struct cparse_decl_enum_constant const*)constant)->value;
+				compact_constant->spelling = cparse_compact_spelling(&w, constant);
+				compact_constant->spelling_length = (unsigned)constant->spelling_length;
+			}
+			node->count = compact->num_constants - node->first;
+		}
+		else if (decl->kind == CPARSE_DECL_TYPEDEF) {
+			struct cparse_type const* type = ((struct cparse_decl_typedef const*)decl)->type;
+			node->type = cparse_compact_index(&w, type);
+			cparse_compact_type(&w, type);
+		}
+		else if (decl->kind == CPARSE_DECL_FUNCTION) {
+			struct cparse_decl_function const* function = (struct cparse_decl_function const*)decl;
+			node->storage_class = (unsigned char)function->storage_class;
+			node->defined = (unsigned char)function->defined;
+			node->body_begin = function->body_begin;
+			node->body_end = function->body_end;
+			node->type = cparse_compact_index(&w, function->return_type);
+			cparse_compact_type(&w, function->return_type);
+		}
+		else if (decl->kind == CPARSE_DECL_VARIABLE) {
+			struct cparse_decl_variable_global const* variable = (struct cparse_decl_variable_global const*)decl;
+			node->storage_class = (unsigned char)variable->storage_class;
+			node->defined = (unsigned char)variable->initialized;
+			node->body_begin = variable->initializer_begin;
+			node->body_end = variable->initializer_end;
+			node->type = cparse_compact_index(&w, variable->variable.type);
+			cparse_compact_type(&w, variable->variable.type);
+		}
+		else {
+			struct cparse_decl_struct const* struct_decl = (struct cparse_decl_struct const*)decl;
+			node->size = struct_decl->size;
+			node->alignment = struct_decl->alignment;
+			node->first = compact->num_fields;
+			for (struct cparse_decl const* field = (struct cparse_decl const*)struct_decl->fields; field; field = field->next) {
+				struct cparse_type const* type = ((struct cparse_decl_variable const*)field)->type;
+				struct cparse_compact_field* compact_field = compact->fields + compact->num_fields++;
+				compact_field->spelling = cparse_compact_spelling(&w, field);
+				compact_field->spelling_length = (unsigned)field->spelling_length;
+				compact_field->type = cparse_compact_index(&w, type);
+				compact_field->offset = ((struct cparse_decl_variable_field const*)field)->offset;
+				cparse_compact_type(&w, type);
+			}
+			node->count = compact->num_fields - node->first;
+		}
+	}
+
+	free(w.indices.objects);
+	*out = compact;
+	return CPARSE_RESULT_OK;
+}
+
+CPARSE_API void cparse_compact_release(struct cparse_compact_unit* compact, struct cparse_info const* info)
+{
+	if (info->allocate)
+		info->deallocate(info->allocator_user_data, compact);
+	else
+		cparse_default_deallocate(NULL, compact);
+}
+
+#ifndef CPARSE_NO_DUMP
+
+/* dump */
+
+struct cparse_dump {
+	struct cparse_dump_writer const* writer;
+	char* cursor;
+	char* end;
+	bool failed;
+};
+
+#define CPARSE_DUMP_LITERAL(d, literal) cparse_dump_write(d, literal, sizeof(literal) - 1)
+
+static void cparse_dump_flush(struct cparse_dump* d)
+{
+	const cparse_size_t size = (cparse_size_t)(d->cursor - d->writer->buffer);
+	if (size && !d->failed)
+		d->failed = !d->writer->flush(d->writer->user_data, d->writer->buffer, size);
+	d->cursor = d->writer->buffer;
+}
+
+static void cparse_dump_write(struct cparse_dump* d, const void* data, cparse_size_t size)
+{
+	const char* p = (const char*)data;
+	while (size > (cparse_size_t)(d->end - d->cursor)) {
+		const cparse_size_t available = (cparse_size_t)(d->end - d->cursor);
+		if (available) {
+			memcpy(d->cursor, p, available);
+			d->cursor += available;
+			p += available;
+			size -= available;
+		}
+		cparse_dump_flush(d);
+
+		/* no buffer, everything goes straight to flush */
+		if (d->cursor == d->end) {
+			if (!d->failed)
+				d->failed = !d->writer->flush(d->writer->user_data, p, size);
+			return;
+		}
+	}
+	if (size) {
+		memcpy(d->cursor, p, size);
+		d->cursor += size;
+	}
+}
+
+static void cparse_dump_char(struct cparse_dump* d, char c)
+{
+	if (d->cursor == d->end)
+		cparse_dump_flush(d);
+	if (d->cursor == d->end)
+		cparse_dump_write(d, &c, 1);
+	else
+		*d->cursor++ = c;
+}
+
+static void cparse_dump_int(struct cparse_dump* d, long long value)
+{
+	char digits[24];
+	char* p = digits + sizeof(digits);
+	unsigned long long magnitude = value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value;
+	do {
+		*--p = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude);
+	if (value < 0)
+		*--p = '-';
+	cparse_dump_write(d, p, (cparse_size_t)(digits + sizeof(digits) - p));
+}
+
+static void cparse_dump_u32(struct cparse_dump* d, uint32_t value)
+{
+	const unsigned char bytes[4] = { (unsigned char)value, (unsigned char)(value >> 8), (unsigned char)(value >> 16), (unsigned char)(value >> 24) };
+	cparse_dump_write(d, bytes, sizeof(bytes));
+}
+
+static void cparse_dump_u64(struct cparse_dump* d, uint64_t value)
+{
+	cparse_dump_u32(d, (uint32_t)value);
+	cparse_dump_u32(d, (uint32_t)(value >> 32));
+}
+
+static void cparse_dump_string(struct cparse_dump* d, const char* string, int length)
+{
+	cparse_dump_u32(d, (uint32_t)length);
+	cparse_dump_write(d, string, (cparse_size_t)length);
+}
+
+static void cparse_dump_primitive(struct cparse_dump* d, struct cparse_type const* type)
+{
+	const char* spelling = cparse_primitive_type_spelling(((struct cparse_type_primitive const*)type)->kind);
+	cparse_dump_write(d, spelling, strlen(spelling));
+}
+
+/* the keywords of a storage class, by bit */
+static const char* const cparse_dump_storage_classes[] = { "extern", "static", "inline", "_Noreturn", "_Thread_local" };
+
+/* text */
+
+static void cparse_dump_text_type(struct cparse_dump* d, struct cparse_type const* type)
+{
+	switch (type->kind)
 	{
-		case CPARSE_KW_CHAR:
-			cparse_lex(s);
-			primitive_kind = CPARSE_PRIMITIVE_TYPE_CHAR;
-			goto set_primitive_type;
+		case CPARSE_TYPE_PRIMITIVE:
+			cparse_dump_primitive(d, type);
+			break;
 
-		case CPARSE_KW_SIGNED:
-			cparse_lex(s);
-			goto parse_integral_primitive_type;
+		case CPARSE_TYPE_POINTER:
+			cparse_dump_text_type(d, ((struct cparse_type_pointer const*)type)->pointee_type);
+			CPARSE_DUMP_LITERAL(d, " *");
+			break;
+
+		case CPARSE_TYPE_ARRAY:
+			cparse_dump_text_type(d, ((struct cparse_type_array const*)type)->element_type);
+			CPARSE_DUMP_LITERAL(d, " [");
+			cparse_dump_int(d, ((struct cparse_type_array const*)type)->extent);
+			cparse_dump_char(d, ']');
+			break;
+
+		case CPARSE_TYPE_STRUCT: {
+			struct cparse_decl_struct const* struct_decl = ((struct cparse_type_struct const*)type)->struct_type;
+			CPARSE_DUMP_LITERAL(d, "struct ");
+			cparse_dump_write(d, struct_decl->decl.spelling, (cparse_size_t)struct_decl->decl.spelling_length);
+			break;
+		}
+
+		case CPARSE_TYPE_ENUM: {
+			struct cparse_decl_enum const* enum_decl = ((struct cparse_type_enum const*)type)->enum_type;
+			CPARSE_DUMP_LITERAL(d, "enum ");
+			cparse_dump_write(d, enum_decl->decl.spelling, (cparse_size_t)enum_decl->decl.spelling_length);
+			break;
+		}
+
+		default:
+			CPARSE_DUMP_LITERAL(d, "???");
+			break;
+	}
+
+	if (type->qualifiers & CPARSE_TYPE_QUAL_CONST)
+		CPARSE_DUMP_LITERAL(d, " const");
+	if (type->qualifiers & CPARSE_TYPE_QUAL_VOLATILE)
+		CPARSE_DUMP_LITERAL(d, " volatile");
+	if (type->qualifiers & CPARSE_TYPE_QUAL_RESTRICT)
+		CPARSE_DUMP_LITERAL(d, " restrict");
+}
+
+static void cparse_dump_text_enum(struct cparse_dump* d, struct cparse_decl_enum const* enum_decl)
+{
+	CPARSE_DUMP_LITERAL(d, "enum (spelling=");
+	cparse_dump_write(d, enum_decl->decl.spelling, (cparse_size_t)enum_decl->decl.spelling_length);
+	CPARSE_DUMP_LITERAL(d, ")\n");
+	for (struct cparse_decl_enum_constant const* constant = enum_decl->constants; constant; constant = (struct cparse_decl_enum_constant const*)constant->decl.next)
+	{
+		CPARSE_DUMP_LITERAL(d, "\tconstant (spelling=\"");
+		cparse_dump_write(d, constant->decl.spelling, (cparse_size_t)constant->decl.spelling_length);
+		CPARSE_DUMP_LITERAL(d, "\", value=\"");
+		cparse_dump_int(d, constant->value);
+		CPARSE_DUMP_LITERAL(d, "\")\n");
+	}
+}
+
+static void cparse_dump_text_struct(struct cparse_dump* d, struct cparse_decl_struct const* struct_decl)
+{
+	CPARSE_DUMP_LITERAL(d, "struct (spelling=");
+	cparse_dump_write(d, struct_decl->decl.spelling, (cparse_size_t)struct_decl->decl.spelling_length);
+	CPARSE_DUMP_LITERAL(d, ", size=");
+	cparse_dump_int(d, struct_decl->size);
+	CPARSE_DUMP_LITERAL(d, ", alignment=");
+	cparse_dump_int(d, struct_decl->alignment);
+	CPARSE_DUMP_LITERAL(d, ")\n");
+	for (struct cparse_decl_variable_field const* field = struct_decl->fields; field; field = (struct cparse_decl_variable_field const*)field->variable.decl.next)
+	{
+		CPARSE_DUMP_LITERAL(d, "\tfield (offset=");
+		cparse_dump_int(d, field->offset);
+		CPARSE_DUMP_LITERAL(d, ", spelling=\"");
+		cparse_dump_write(d, field->variable.decl.spelling, (cparse_size_t)field->variable.decl.spelling_length);
+		CPARSE_DUMP_LITERAL(d, "\", type=\"");
+		cparse_dump_text_type(d, field->variable.type);
+		CPARSE_DUMP_LITERAL(d, "\")\n");
+	}
+}
+
+static void cparse_dump_text_typedef(struct cparse_dump* d, struct cparse_decl_typedef const* typedef_decl)
+{
+	CPARSE_DUMP_LITERAL(d, "typedef (spelling=");
+	cparse_dump_write(d, typedef_decl->decl.spelling, (cparse_size_t)typedef_decl->decl.spelling_length);
+	CPARSE_DUMP_LITERAL(d, ", type=\"");
+	cparse_dump_text_type(d, typedef_decl->type);
+	CPARSE_DUMP_LITERAL(d, "\")\n");
+}
+
+static void cparse_dump_text_storage_class(struct cparse_dump* d, enum cparse_storage_class storage_class)
+{
+	CPARSE_DUMP_LITERAL(d, "storage_class=\"");
+	const char* separator = "";
+	for (int i = 0; i < 5; ++i) {
+		if (storage_class & (1 << i)) {
+			cparse_dump_write(d, separator, strlen(separator));
+			cparse_dump_write(d, cparse_dump_storage_classes[i], strlen(cparse_dump_storage_classes[i]));
+			separator = " ";
+		}
+	}
+	cparse_dump_char(d, '"');
+}
+
+static void cparse_dump_text_function(struct cparse_dump* d, struct cparse_decl_function const* function)
+{
+	CPARSE_DUMP_LITERAL(d, "function (spelling=");
+	cparse_dump_write(d, function->decl.spelling, (cparse_size_t)function->decl.spelling_length);
+	CPARSE_DUMP_LITERAL(d, ", ");
+	cparse_dump_text_storage_class(d, function->storage_class);
+	CPARSE_DUMP_LITERAL(d, ", return_type=\"");
+	cparse_dump_text_type(d, function->return_type);
+	CPARSE_DUMP_LITERAL(d, "\", defined=");
+	cparse_dump_int(d, function->defined);
+	CPARSE_DUMP_LITERAL(d, ", body_begin=");
+	cparse_dump_int(d, (long long)function->body_begin);
+	CPARSE_DUMP_LITERAL(d, ", body_end=");
+	cparse_dump_int(d, (long long)function->body_end);
+	CPARSE_DUMP_LITERAL(d, ")\n");
+}
 
-		case CPARSE_KW_UNSIGNED:
-			cparse_lex(s);
-			primitive_signed = false;
-			goto parse_integral_primitive_type;
+static void cparse_dump_text_variable(struct cparse_dump* d, struct cparse_decl_variable_global const* variable)
+{
+	CPARSE_DUMP_LITERAL(d, "variable (spelling=");
+	cparse_dump_write(d, variable->variable.decl.spelling, (cparse_size_t)variable->variable.decl.spelling_length);
+	CPARSE_DUMP_LITERAL(d, ", ");
+	cparse_dump_text_storage_class(d, variable->storage_class);
+	CPARSE_DUMP_LITERAL(d, ", type=\"");
+	cparse_dump_text_type(d, variable->variable.type);
+	CPARSE_DUMP_LITERAL(d, "\", initialized=");
+	cparse_dump_int(d, variable->initialized);
+	CPARSE_DUMP_LITERAL(d, ", initializer_begin=");
+	cparse_dump_int(d, (long long)variable->initializer_begin);
+	CPARSE_DUMP_LITERAL(d, ", initializer_end=");
+	cparse_dump_int(d, (long long)variable->initializer_end);
+	CPARSE_DUMP_LITERAL(d, ")\n");
+}
 
-		case CPARSE_KW_FLOAT:
-			cparse_lex(s);
-			primitive_kind = CPARSE_PRIMITIVE_TYPE_FLOAT;
-			goto set_primitive_type;
+/* json, spellings are identifiers and need no escaping */
 
-		case CPARSE_KW_DOUBLE:
-			cparse_lex(s);
-			primitive_kind = CPARSE_PRIMITIVE_TYPE_DOUBLE;
-			goto set_primitive_type;
+static void cparse_dump_json_spelling(struct cparse_dump* d, struct cparse_decl const* decl)
+{
+	CPARSE_DUMP_LITERAL(d, "\"spelling\":\"");
+	cparse_dump_write(d, decl->spelling, (cparse_size_t)decl->spelling_length);
+	cparse_dump_char(d, '"');
+}
 
-		case CPARSE_KW_LONG:
-			cparse_lex(s);
-			if (cparse_accept(s, CPARSE_KW_DOUBLE)) {
-				cparse_lex(s);
-				primitive_kind = CPARSE_PRIMITIVE_TYPE_LONG_DOUBLE;
-				goto set_primitive_type;
+static void cparse_dump_json_type(struct cparse_dump* d, struct cparse_type const* type)
+{
+	static const char* const kinds[] = { "primitive", "pointer", "array", "struct", "enum" };
+	CPARSE_DUMP_LITERAL(d, "{\"kind\":\"");
+	if ((unsigned)type->kind < sizeof(kinds) / sizeof(kinds[0]))
+		cparse_dump_write(d, kinds[type->kind], strlen(kinds[type->kind]));
+	cparse_dump_char(d, '"');
+
+	if (type->qualifiers) {
+		static const char* const qualifiers[] = { "\"const\"", "\"volatile\"", "\"restrict\"" };
+		char separator = '[';
+		CPARSE_DUMP_LITERAL(d, ",\"qualifiers\":");
+		for (int i = 0; i < 3; ++i) {
+			if (type->qualifiers & (1 << i)) {
+				cparse_dump_char(d, separator);
+				cparse_dump_write(d, qualifiers[i], strlen(qualifiers[i]));
+				separator = ',';
 			}
-			goto long_keyword_parsed;
-
-		default:
-			break;
+		}
+		cparse_dump_char(d, ']');
 	}
 
-parse_integral_primitive_type:
-	switch (s->lex.lookahead)
+	switch (type->kind)
 	{
-		case CPARSE_KW_CHAR:
-			cparse_lex(s);
-			primitive_kind = primitive_signed ? CPARSE_PRIMITIVE_TYPE_SIGNED_CHAR : CPARSE_PRIMITIVE_TYPE_UNSIGNED_CHAR;
-			goto set_primitive_type;
-
-		case CPARSE_KW_SHORT:
-			cparse_lex(s);
-			primitive_kind = primitive_signed ? CPARSE_PRIMITIVE_TYPE_SIGNED_SHORT : CPARSE_PRIMITIVE_TYPE_UNSIGNED_SHORT;
-			cparse_accept(s, CPARSE_KW_INT);
-			goto set_primitive_type;
+		case CPARSE_TYPE_PRIMITIVE:
+			CPARSE_DUMP_LITERAL(d, ",\"name\":\"");
+			cparse_dump_primitive(d, type);
+			cparse_dump_char(d, '"');
+			break;
 
-		case CPARSE_KW_INT:
-			cparse_lex(s);
-			primitive_kind = primitive_signed ? CPARSE_PRIMITIVE_TYPE_SIGNED_INT : CPARSE_PRIMITIVE_TYPE_UNSIGNED_INT;
-			goto set_primitive_type;
+		case CPARSE_TYPE_POINTER:
+			CPARSE_DUMP_LITERAL(d, ",\"pointee\":");
+			cparse_dump_json_type(d, ((struct cparse_type_pointer const*)type)->pointee_type);
+			break;
 
-		case CPARSE_KW_LONG:
-			cparse_lex(s);
-		long_keyword_parsed:
-			primitive_kind = primitive_signed ? CPARSE_PRIMITIVE_TYPE_SIGNED_LONG : CPARSE_PRIMITIVE_TYPE_UNSIGNED_LONG;
-			if (cparse_accept(s, CPARSE_KW_LONG))
-				primitive_kind = primitive_signed ? CPARSE_PRIMITIVE_TYPE_SIGNED_LONG_LONG : CPARSE_PRIMITIVE_TYPE_UNSIGNED_LONG_LONG;
-			cparse_accept(s, CPARSE_KW_INT);
-			goto set_primitive_type;
+		case CPARSE_TYPE_ARRAY:
+			CPARSE_DUMP_LITERAL(d, ",\"extent\":");
+			cparse_dump_int(d, ((struct cparse_type_array const*)type)->extent);
+			CPARSE_DUMP_LITERAL(d, ",\"element\":");
+			cparse_dump_json_type(d, ((struct cparse_type_array const*)type)->element_type);
+			break;
 
-		set_primitive_type: {
-			struct cparse_type_primitive* primitive_type = cparse_alloc_type(s, struct cparse_type_primitive);
-			primitive_type->type.kind = CPARSE_TYPE_PRIMITIVE;
-			primitive_type->type.qualifiers = qualifier | cparse_parse_type_qualifiers(s);
-			primitive_type->kind = primitive_kind;
-			return (struct cparse_type*)primitive_type;
+		case CPARSE_TYPE_STRUCT:
+		case CPARSE_TYPE_ENUM: {
+			struct cparse_decl const* decl = type->kind == CPARSE_TYPE_STRUCT ? (struct cparse_decl const*)((struct cparse_type_struct const*)type)->struct_type :
+				(struct cparse_decl const*)((struct cparse_type_enum const*)type)->enum_type;
+			CPARSE_DUMP_LITERAL(d, ",\"tag\":\"");
+			cparse_dump_write(d, decl->spelling, (cparse_size_t)decl->spelling_length);
+			cparse_dump_char(d, '"');
+			break;
 		}
 	}
-
-	cparse_error_syntax(s);
-	return NULL;
+	cparse_dump_char(d, '}');
 }
 
-static struct cparse_type* cparse_parse_type_ptr(struct cparse_state* s, struct cparse_type* type)
+static void cparse_dump_json_enum(struct cparse_dump* d, struct cparse_decl_enum const* enum_decl)
 {
-	while (cparse_accept(s, '*')) {
-		struct cparse_type_pointer* ptr_type = cparse_alloc_type(s, struct cparse_type_pointer);
-		ptr_type->type.kind = CPARSE_TYPE_POINTER;
-		ptr_type->type.qualifiers = cparse_parse_type_qualifiers(s);
-		ptr_type->pointee_type = type;
-		type = (struct cparse_type*)ptr_type;
+	CPARSE_DUMP_LITERAL(d, "{\"kind\":\"enum\",");
+	cparse_dump_json_spelling(d, &enum_decl->decl);
+	CPARSE_DUMP_LITERAL(d, ",\"constants\":[");
+	for (struct cparse_decl_enum_constant const* constant = enum_decl->constants; constant; constant = (struct cparse_decl_enum_constant const*)constant->decl.next)
+	{
+		if (constant != enum_decl->constants)
+			cparse_dump_char(d, ',');
+		cparse_dump_char(d, '{');
+		cparse_dump_json_spelling(d, &constant->decl);
+		CPARSE_DUMP_LITERAL(d, ",\"value\":");
+		cparse_dump_int(d, constant->value);
+		cparse_dump_char(d, '}');
 	}
-
-	return type;
+	CPARSE_DUMP_LITERAL(d, "]}");
 }
 
-static struct cparse_type* cparse_parse_type_array(struct cparse_state* s, struct cparse_type* type)
+static void cparse_dump_json_struct(struct cparse_dump* d, struct cparse_decl_struct const* struct_decl)
 {
-	while (cparse_accept(s, '['))
+	CPARSE_DUMP_LITERAL(d, "{\"kind\":\"struct\",");
+	cparse_dump_json_spelling(d, &struct_decl->decl);
+	CPARSE_DUMP_LITERAL(d, ",\"size\":");
+	cparse_dump_int(d, struct_decl->size);
+	CPARSE_DUMP_LITERAL(d, ",\"alignment\":");
+	cparse_dump_int(d, struct_decl->alignment);
+	CPARSE_DUMP_LITERAL(d, ",\"fields\":[");
+	for (struct cparse_decl_variable_field const* field = struct_decl->fields; field; field = (struct cparse_decl_variable_field const*)field->variable.decl.next)
 	{
-		/* todo: this should be any static expression */
-		cparse_check(s, CPARSE_TOK_INTEGER);
-
-		struct cparse_type_array* array_type = cparse_alloc_type(s, struct cparse_type_array);
-		array_type->type.kind = CPARSE_TYPE_ARRAY;
-		array_type->type.qualifiers = CPARSE_TYPE_QUAL_NONE;
-		array_type->element_type = type;
-		array_type->extent = atoi(s->lex.token_buffer);
+		if (field != struct_decl->fields)
+			cparse_dump_char(d, ',');
+		cparse_dump_char(d, '{');
+		cparse_dump_json_spelling(d, &field->variable.decl);
+		CPARSE_DUMP_LITERAL(d, ",\"offset\":");
+		cparse_dump_int(d, field->offset);
+		CPARSE_DUMP_LITERAL(d, ",\"type\":");
+		cparse_dump_json_type(d, field->variable.type);
+		cparse_dump_char(d, '}');
+	}
+	CPARSE_DUMP_LITERAL(d, "]}");
+}
 
-		cparse_lex(s); /* eat the extent */
-		cparse_expect(s, ']');
+static void cparse_dump_json_typedef(struct cparse_dump* d, struct cparse_decl_typedef const* typedef_decl)
+{
+	CPARSE_DUMP_LITERAL(d, "{\"kind\":\"typedef\",");
+	cparse_dump_json_spelling(d, &typedef_decl->decl);
+	CPARSE_DUMP_LITERAL(d, ",\"type\":");
+	cparse_dump_json_type(d, typedef_decl->type);
+	cparse_dump_char(d, '}');
+}
 
-		type = (struct cparse_type*)array_type;
+static void cparse_dump_json_storage_class(struct cparse_dump* d, enum cparse_storage_class storage_class)
+{
+	if (!storage_class)
+		return;
+
+	char separator = '[';
+	CPARSE_DUMP_LITERAL(d, ",\"storage_class\":");
+	for (int i = 0; i < 5; ++i) {
+		if (storage_class & (1 << i)) {
+			cparse_dump_char(d, separator);
+			cparse_dump_char(d, '"');
+			cparse_dump_write(d, cparse_dump_storage_classes[i], strlen(cparse_dump_storage_classes[i]));
+			cparse_dump_char(d, '"');
+			separator = ',';
+		}
 	}
+	cparse_dump_char(d, ']');
+}
 
-	return type;
+/* [begin, end] or null if not in the source */
+static void cparse_dump_json_range(struct cparse_dump* d, const char* name, cparse_size_t begin, cparse_size_t end)
+{
+	CPARSE_DUMP_LITERAL(d, ",\"");
+	cparse_dump_write(d, name, strlen(name));
+	CPARSE_DUMP_LITERAL(d, "\":");
+	if (!end) {
+		CPARSE_DUMP_LITERAL(d, "null");
+		return;
+	}
+	cparse_dump_char(d, '[');
+	cparse_dump_int(d, (long long)begin);
+	cparse_dump_char(d, ',');
+	cparse_dump_int(d, (long long)end);
+	cparse_dump_char(d, ']');
 }
 
-static struct cparse_decl_enum* cpase_parse_enum(struct cparse_state* s, struct cparse_decl*** parent_decls)
+static void cparse_dump_json_function(struct cparse_dump* d, struct cparse_decl_function const* function)
 {
-	cparse_expect(s, CPARSE_KW_ENUM);
+	CPARSE_DUMP_LITERAL(d, "{\"kind\":\"function\",");
+	cparse_dump_json_spelling(d, &function->decl);
+	CPARSE_DUMP_LITERAL(d, ",\"return_type\":");
+	cparse_dump_json_type(d, function->return_type);
+	cparse_dump_json_storage_class(d, function->storage_class);
+	if (function->defined)
+		CPARSE_DUMP_LITERAL(d, ",\"defined\":true");
+	else
+		CPARSE_DUMP_LITERAL(d, ",\"defined\":false");
+	cparse_dump_json_range(d, "parameters", function->parameters_begin, function->parameters_end);
+	cparse_dump_json_range(d, "body", function->body_begin, function->body_end);
+	cparse_dump_char(d, '}');
+}
 
-	struct cparse_decl_enum* enum_decl = cparse_alloc_type(s, struct cparse_decl_enum);
-	cparse_decl_init(&enum_decl->decl, CPARSE_DECL_ENUM, NULL);
-	enum_decl->constants = NULL;
-	enum_decl->num_constants = 0;
+static void cparse_dump_json_variable(struct cparse_dump* d, struct cparse_decl_variable_global const* variable)
+{
+	CPARSE_DUMP_LITERAL(d, "{\"kind\":\"variable\",");
+	cparse_dump_json_spelling(d, &variable->variable.decl);
+	CPARSE_DUMP_LITERAL(d, ",\"type\":");
+	cparse_dump_json_type(d, variable->variable.type);
+	cparse_dump_json_storage_class(d, variable->storage_class);
+	if (variable->initialized)
+		CPARSE_DUMP_LITERAL(d, ",\"initialized\":true");
+	else
+		CPARSE_DUMP_LITERAL(d, ",\"initialized\":false");
+	cparse_dump_json_range(d, "initializer", variable->initializer_begin, variable->initializer_end);
+	cparse_dump_char(d, '}');
+}
 
-	if (cparse_peek(s, CPARSE_TOK_IDENTIFIER)) {
-		enum_decl->decl.spelling = cparse_scan_token_string(s);
-		**parent_decls = (struct cparse_decl*)enum_decl;
-		*parent_decls = &enum_decl->decl.next;
-	}
+/* binary */
 
-	cparse_expect(s, '{');
+static void cparse_dump_binary_type(struct cparse_dump* d, struct cparse_type const* type)
+{
+	cparse_dump_char(d, (char)type->kind);
+	cparse_dump_char(d, (char)type->qualifiers);
+	switch (type->kind)
+	{
+		case CPARSE_TYPE_PRIMITIVE:
+			cparse_dump_char(d, (char)((struct cparse_type_primitive const*)type)->kind);
+			break;
 
-	long long int value = 0;
+		case CPARSE_TYPE_POINTER:
+			cparse_dump_binary_type(d, ((struct cparse_type_pointer const*)type)->pointee_type);
+			break;
 
-	struct cparse_decl_enum_constant** next_constant = &enum_decl->constants;
-	while (!cparse_accept(s, '}')) {
-		cparse_check(s, CPARSE_TOK_IDENTIFIER);
-		struct cparse_decl_enum_constant* constant = cparse_alloc_type(s, struct cparse_decl_enum_constant);
-		cparse_decl_init(&constant->decl, CPARSE_DECL_ENUM_CONSTANT, cparse_scan_token_string(s));
+		case CPARSE_TYPE_ARRAY:
+			cparse_dump_u32(d, (uint32_t)((struct cparse_type_array const*)type)->extent);
+			cparse_dump_binary_type(d, ((struct cparse_type_array const*)type)->element_type);
+			break;
 
-		if (cparse_decl_find((struct cparse_decl*)enum_decl->constants, constant->decl.spelling))
-			cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "duplicate enum constant '%s'.", constant->decl.spelling);
+		case CPARSE_TYPE_STRUCT: {
+			struct cparse_decl_struct const* struct_decl = ((struct cparse_type_struct const*)type)->struct_type;
+			cparse_dump_string(d, struct_decl->decl.spelling, struct_decl->decl.spelling_length);
+			break;
+		}
 
-		if (cparse_accept(s, '=')) {
-			cparse_check(s, CPARSE_TOK_INTEGER);
-			value = atoi(s->lex.token_buffer);
+		case CPARSE_TYPE_ENUM: {
+			struct cparse_decl_enum const* enum_decl = ((struct cparse_type_enum const*)type)->enum_type;
+			cparse_dump_string(d, enum_decl->decl.spelling, enum_decl->decl.spelling_length);
+			break;
 		}
+	}
+}
 
-		constant->value = value++;
-		++enum_decl->num_constants;
+static uint32_t cparse_dump_count(struct cparse_decl const* decl)
+{
+	uint32_t count = 0;
+	for (; decl; decl = decl->next)
+		++count;
+	return count;
+}
 
-		cparse_accept(s, ',');
+static void cparse_dump_binary_enum(struct cparse_dump* d, struct cparse_decl_enum const* enum_decl)
+{
+	cparse_dump_u32(d, cparse_dump_count((struct cparse_decl const*)enum_decl->constants));
+	for (struct cparse_decl_enum_constant const* constant = enum_decl->constants; constant; constant = (struct cparse_decl_enum_constant const*)constant->decl.next)
+	{
+		cparse_dump_string(d, constant->decl.spelling, constant->decl.spelling_length);
+		cparse_dump_u64(d, (uint64_t)constant->value);
+	}
+}
 
-		*next_constant = constant;
-		next_constant = (struct cparse_decl_enum_constant**)&constant->decl.next;
+static void cparse_dump_binary_struct(struct cparse_dump* d, struct cparse_decl_struct const* struct_decl)
+{
+	cparse_dump_u32(d, (uint32_t)struct_decl->size);
+	cparse_dump_u32(d, (uint32_t)struct_decl->alignment);
+	cparse_dump_u32(d, cparse_dump_count((struct cparse_decl const*)struct_decl->fields));
+	for (struct cparse_decl_variable_field const* field = struct_decl->fields; field; field = (struct cparse_decl_variable_field const*)field->variable.decl.next)
+	{
+		cparse_dump_string(d, field->variable.decl.spelling, field->variable.decl.spelling_length);
+		cparse_dump_u32(d, (uint32_t)field->offset);
+		cparse_dump_binary_type(d, field->variable.type);
 	}
+}
 
-	return enum_decl;
+static void cparse_dump_binary_function(struct cparse_dump* d, struct cparse_decl_function const* function)
+{
+	cparse_dump_char(d, (char)function->storage_class);
+	cparse_dump_char(d, (char)function->defined);
+	cparse_dump_u64(d, (uint64_t)function->parameters_begin);
+	cparse_dump_u64(d, (uint64_t)function->parameters_end);
+	cparse_dump_u64(d, (uint64_t)function->body_begin);
+	cparse_dump_u64(d, (uint64_t)function->body_end);
+	cparse_dump_binary_type(d, function->return_type);
 }
 
-static struct cparse_decl_struct* cparse_parse_struct(struct cparse_state* s, struct cparse_decl*** parent_decls)
+static void cparse_dump_binary_variable(struct cparse_dump* d, struct cparse_decl_variable_global const* variable)
 {
-	cparse_expect(s, CPARSE_KW_STRUCT);
-	
-	struct cparse_decl_struct* struct_decl = cparse_alloc_type(s, struct cparse_decl_struct);
-	cparse_decl_init(&struct_decl->decl, CPARSE_DECL_STRUCT, NULL);
-	struct_decl->fields = NULL;
-	struct_decl->num_fields = 0;
+	cparse_dump_char(d, (char)variable->storage_class);
+	cparse_dump_char(d, (char)variable->initialized);
+	cparse_dump_u64(d, (uint64_t)variable->initializer_begin);
+	cparse_dump_u64(d, (uint64_t)variable->initializer_end);
+	cparse_dump_binary_type(d, variable->variable.type);
+}
 
-	if (cparse_peek(s, CPARSE_TOK_IDENTIFIER)) {
-		struct_decl->decl.spelling = cparse_scan_token_string(s);
-		**parent_decls = (struct cparse_decl*)struct_decl;
-		*parent_decls = &struct_decl->decl.next;
+CPARSE_API int cparse_unit_write(struct cparse_unit const* unit, enum cparse_dump_format format, struct cparse_dump_writer const* writer)
+{
+	struct cparse_dump d;
+	d.writer = writer;
+	d.cursor = writer->buffer;
+	d.end = writer->buffer + writer->buffer_size;
+	d.failed = false;
+
+	if (format == CPARSE_DUMP_JSON)
+		CPARSE_DUMP_LITERAL(&d, "[");
+	else if (format == CPARSE_DUMP_BINARY) {
+		cparse_dump_u32(&d, 0x75647063u);
+		cparse_dump_u32(&d, 3);
+		cparse_dump_u32(&d, cparse_dump_count(unit->decls));
 	}
-	
-	cparse_expect(s, '{');
 
-	struct cparse_decl_variable_field** next_field = &struct_decl->fields;
-	while (!cparse_peek(s, '}')) {
-		struct cparse_type* base_type = cparse_parse_type(s);
-		do
+	for (struct cparse_decl const* decl = unit->decls; decl && !d.failed; decl = decl->next)
+	{
+		switch (format)
 		{
-			struct cparse_decl_variable_field* field = cparse_alloc_type(s, struct cparse_decl_variable_field);
-			field->variable.type = cparse_parse_type_ptr(s, base_type);
-			cparse_check(s, CPARSE_TOK_IDENTIFIER);
-			cparse_decl_init(&field->variable.decl, CPARSE_DECL_FIELD, cparse_scan_token_string(s));
-
-			if (cparse_struct_find_field(struct_decl, field->variable.decl.spelling))
-				cparse_error(s, CPARSE_RESULT_SEMANTIC_ERROR, "duplicate struct field '%s'.", field->variable.decl.spelling);
+			case CPARSE_DUMP_TEXT:
+				if (decl->kind == CPARSE_DECL_ENUM)
+					cparse_dump_text_enum(&d, (struct cparse_decl_enum const*)decl);
+				else if (decl->kind == CPARSE_DECL_TYPEDEF)
+					cparse_dump_text_typedef(&d, (struct cparse_decl_typedef const*)decl);
+				else if (decl->kind == CPARSE_DECL_FUNCTION)
+					cparse_dump_text_function(&d, (struct cparse_decl_function const*)decl);
+				else if (decl->kind == CPARSE_DECL_VARIABLE)
+					cparse_dump_text_variable(&d, (struct cparse_decl_variable_global const*)decl);
+				else
+					cparse_dump_text_struct(&d, (struct cparse_decl_struct const*)decl);
+				break;
 
-			field->variable.type = cparse_parse_type_array(s, field->variable.type);
-			field->offset = 0;
-			++struct_decl->num_fields;
-			cparse_expect(s, ';');
+			case CPARSE_DUMP_JSON:
+				if (decl != unit->decls)
+					cparse_dump_char(&d, ',');
+				cparse_dump_char(&d, '\n');
+				if (decl->kind == CPARSE_DECL_ENUM)
+					cparse_dump_json_enum(&d, (struct cparse_decl_enum const*)decl);
+				else if (decl->kind == CPARSE_DECL_TYPEDEF)
+					cparse_dump_json_typedef(&d, (struct cparse_decl_typedef const*)decl);
+				else if (decl->kind == CPARSE_DECL_FUNCTION)
+					cparse_dump_json_function(&d, (struct cparse_decl_function const*)decl);
+				else if (decl->kind == CPARSE_DECL_VARIABLE)
+					cparse_dump_json_variable(&d, (struct cparse_decl_variable_global const*)decl);
+				else
+					cparse_dump_json_struct(&d, (struct cparse_decl_struct const*)decl);
+				break;
 
-			*next_field = field;
-			next_field = (struct cparse_decl_variable_field**)&field->variable.decl.next;
-		} while (cparse_accept(s, ','));
+			case CPARSE_DUMP_BINARY:
+				cparse_dump_char(&d, (char)decl->kind);
+				cparse_dump_string(&d, decl->spelling, decl->spelling_length);
+				if (decl->kind == CPARSE_DECL_ENUM)
+					cparse_dump_binary_enum(&d, (struct cparse_decl_enum const*)decl);
+				else if (decl->kind == CPARSE_DECL_TYPEDEF)
+					cparse_dump_binary_type(&d, ((struct cparse_decl_typedef const*)decl)->type);
+				else if (decl->kind == CPARSE_DECL_FUNCTION)
+					cparse_dump_binary_function(&d, (struct cparse_decl_function const*)decl);
+				else if (decl->kind == CPARSE_DECL_VARIABLE)
+					cparse_dump_binary_variable(&d, (struct cparse_decl_variable_global const*)decl);
+				else
+					cparse_dump_binary_struct(&d, (struct cparse_decl_struct const*)decl);
+				break;
+		}
 	}
 
-	cparse_expect(s, '}');
+	if (format == CPARSE_DUMP_JSON)
+		CPARSE_DUMP_LITERAL(&d, "\n]\n");
+	cparse_dump_flush(&d);
+	return !d.failed;
+}
 
-	return struct_decl;
+static int cparse_dump_fwrite(void* output, const char* data, cparse_size_t size)
+{
+	return fwrite(data, 1, size, (FILE*)output) == size;
 }
 
-static struct cparse_unit* cparse_parse_unit(struct cparse_state* s)
+CPARSE_API void cparse_unit_dump(struct cparse_unit* unit, FILE* output)
 {
-	struct cparse_unit* unit = cparse_alloc_type(s, struct cparse_unit);
-	struct cparse_decl** last_next = &unit->decls;
+	char buffer[8192];
+	struct cparse_dump_writer writer = { buffer, sizeof(buffer), cparse_dump_fwrite, output };
+	cparse_unit_write(unit, CPARSE_DUMP_TEXT, &writer);
+}
 
-	while (!cparse_peek(s, CPARSE_TOK_EOF))
+/* serializers */
+
+static const char cparse_serializer_prelude[] =
+	"#ifndef CPARSE_SERIALIZERS_\n"
+	"#define CPARSE_SERIALIZERS_\n"
+	"#include <stddef.h>\n"
+	"#include <string.h>\n"
+	"\n"
+	"struct cparse_reader {\n"
+	"\tunsigned char const* data;\n"
+	"\tsize_t size;\n"
+	"\tsize_t offset;\n"
+	"\tvoid* (*allocate)(void* user_data, size_t size);\n"
+	"\tvoid* user_data;\n"
+	"};\n"
+	"\n"
+	"static size_t cparse_serial_write(unsigned char* out, size_t size, void const* data, size_t n)\n"
+	"{\n"
+	"\tif (out)\n"
+	"\t\tmemcpy(out + size, data, n);\n"
+	"\treturn size + n;\n"
+	"}\n"
+	"\n"
+	"static size_t cparse_serial_flag(unsigned char* out, size_t size, int flag)\n"
+	"{\n"
+	"\tif (out)\n"
+	"\t\tout[size] = (unsigned char)(flag != 0);\n"
+	"\treturn size + 1;\n"
+	"}\n"
+	"\n"
+	"static int cparse_serial_read(struct cparse_reader* reader, void* data, size_t n)\n"
+	"{\n"
+	"\tif (reader->size - reader->offset < n)\n"
+	"\t\treturn 0;\n"
+	"\tmemcpy(data, reader->data + reader->offset, n);\n"
+	"\treader->offset += n;\n"
+	"\treturn 1;\n"
+	"}\n"
+	"\n"
+	"static void* cparse_serial_allocate(struct cparse_reader* reader, size_t n)\n"
+	"{\n"
+	"\treturn reader->allocate(reader->user_data, n);\n"
+	"}\n"
+	"\n"
+	"static void* cparse_serial_read_string(struct cparse_reader* reader)\n"
+	"{\n"
+	"\tunsigned char const* begin = reader->data + reader->offset;\n"
+	"\tunsigned char const* end = memchr(begin, 0, reader->size - reader->offset);\n"
+	"\tif (!end)\n"
+	"\t\treturn NULL;\n"
+	"\tchar* string = reader->allocate(reader->user_data, (size_t)(end - begin) + 1);\n"
+	"\tif (string) {\n"
+	"\t\tmemcpy(string, begin, (size_t)(end - begin) + 1);\n"
+	"\t\treader->offset += (size_t)(end - begin) + 1;\n"
+	"\t}\n"
+	"\treturn string;\n"
+	"}\n"
+	"#endif\n";
+
+/* true if copying a value of the type would copy pointers */
+static bool cparse_type_has_pointers(struct cparse_type const* type)
+{
+	switch (type->kind)
 	{
-		switch (s->lex.lookahead)
-		{
-			case CPARSE_KW_ENUM:
-				cpase_parse_enum(s, &last_next);
-				cparse_expect(s, ';');
-				break;
+		case CPARSE_TYPE_POINTER:
+			return true;
 
-			case CPARSE_KW_STRUCT:
-				cparse_parse_struct(s, &last_next);
-				cparse_expect(s, ';');
-				break;
+		case CPARSE_TYPE_ARRAY:
+			return cparse_type_has_pointers(((struct cparse_type_array const*)type)->element_type);
 
-			default:
-				cparse_error_syntax(s);
+		case CPARSE_TYPE_STRUCT: {
+			struct cparse_decl_struct const* struct_decl = ((struct cparse_type_struct const*)type)->struct_type;
+			for (struct cparse_decl_variable_field* field = struct_decl->fields; field; field = (struct cparse_decl_variable_field*)field->variable.decl.next) {
+				if (cparse_type_has_pointers(field->variable.type))
+					return true;
+			}
+			return false;
 		}
+
+		default:
+			return false;
 	}
+}
 
-	return unit;
+static void cparse_emit_indent(FILE* output, int indent)
+{
+	for (int i = 0; i < indent; ++i)
+		fputc('\t', output);
 }
 
-CPARSE_API const char* cparse_primitive_type_spelling(enum cparse_type_primitive_kind kind)
+/* emits the code that reads or writes the value of type at lvalue, which has pointers */
+static void cparse_emit_serialize_value(FILE* output, struct cparse_type const* type, const char* lvalue, int indent, bool read)
 {
-	#define CPARSE_PRIMITIVE_TYPE_STR(id, spelling)\
-		case CPARSE_PRIMITIVE_TYPE_##id: return spelling;
+	char dummy;
+
+	if (type->kind == CPARSE_TYPE_ARRAY) {
+		struct cparse_type_array const* array_type = (struct cparse_type_array const*)type;
+		size_t length = cparse_format(&dummy, 1, "%s[i%u]", lvalue, (uint)indent);
+		char* element = alloca(length + 1);
+		cparse_format(element, length + 1, "%s[i%u]", lvalue, (uint)indent);
+
+		cparse_emit_indent(output, indent);
+		fprintf(output, "for (size_t i%d = 0; i%d < %d; ++i%d) {\n", indent, indent, array_type->extent, indent);
+		cparse_emit_serialize_value(output, array_type->element_type, element, indent + 1, read);
+		cparse_emit_indent(output, indent);
+		fprintf(output, "}\n");
+		return;
+	}
 
-	switch (kind) {
-		CPARSE_PRIMITIVE_TYPE_STR(CHAR, "char");
-		CPARSE_PRIMITIVE_TYPE_STR(SIGNED_CHAR, "signed char");
-		CPARSE_PRIMITIVE_TYPE_STR(UNSIGNED_CHAR, "unsigned char");
-		CPARSE_PRIMITIVE_TYPE_STR(SIGNED_SHORT, "short");
-		CPARSE_PRIMITIVE_TYPE_STR(UNSIGNED_SHORT, "unsigned short");
-		CPARSE_PRIMITIVE_TYPE_STR(SIGNED_INT, "int");
-		CPARSE_PRIMITIVE_TYPE_STR(UNSIGNED_INT, "unsigned int");
-		CPARSE_PRIMITIVE_TYPE_STR(SIGNED_LONG, "long");
-		CPARSE_PRIMITIVE_TYPE_STR(UNSIGNED_LONG, "unsigned long");
-		CPARSE_PRIMITIVE_TYPE_STR(SIGNED_LONG_LONG, "long long");
-		CPARSE_PRIMITIVE_TYPE_STR(UNSIGNED_LONG_LONG, "unsigned long long");
-		CPARSE_PRIMITIVE_TYPE_STR(FLOAT, "float");
-		CPARSE_PRIMITIVE_TYPE_STR(DOUBLE, "double");
+	if (type->kind == CPARSE_TYPE_STRUCT) {
+		struct cparse_decl const* decl = &((struct cparse_type_struct const*)type)->struct_type->decl;
+		cparse_emit_indent(output, indent);
+		if (read)
+			fprintf(output, "if (!deserialize_%.*s((void*)&%s, reader))\n", decl->spelling_length, decl->spelling, lvalue);
+		else
+			fprintf(output, "size += serialize_%.*s(&%s, out ? out + size : NULL);\n", decl->spelling_length, decl->spelling, lvalue);
+		if (read) {
+			cparse_emit_indent(output, indent + 1);
+			fprintf(output, "return 0;\n");
+		}
+		return;
 	}
 
-	#undef CPARSE_PRIMITIVE_TYPE_STR
-	return "???";
+	/* pointers are a presence byte followed by what they point to */
+	struct cparse_type const* pointee = ((struct cparse_type_pointer const*)type)->pointee_type;
+	if (pointee->kind == CPARSE_TYPE_PRIMITIVE && ((struct cparse_type_primitive const*)pointee)->kind == CPARSE_PRIMITIVE_TYPE_VOID) {
+		cparse_emit_indent(output, indent);
+		if (read)
+			fprintf(output, "%s = NULL; /* void pointers are not serialized */\n", lvalue);
+		else
+			fprintf(output, "/* %s: void pointers are not serialized */\n", lvalue);
+		return;
+	}
+
+	const bool string = pointee->kind == CPARSE_TYPE_PRIMITIVE && ((struct cparse_type_primitive const*)pointee)->kind <= CPARSE_PRIMITIVE_TYPE_UNSIGNED_CHAR;
+	size_t length = cparse_format(&dummy, 1, "(*%s)", lvalue);
+	char* target = alloca(length + 1);
+	cparse_format(target, length + 1, "(*%s)", lvalue);
+
+	cparse_emit_indent(output, indent);
+	if (!read) {
+		fprintf(output, "size = cparse_serial_flag(out, size, %s != NULL);\n", lvalue);
+		cparse_emit_indent(output, indent);
+		fprintf(output, "if (%s) {\n", lvalue);
+		if (string) {
+			cparse_emit_indent(output, indent + 1);
+			fprintf(output, "size = cparse_serial_write(out, size, %s, strlen((char const*)%s) + 1);\n", lvalue, lvalue);
+		}
+		else if (cparse_type_has_pointers(pointee)) {
+			cparse_emit_serialize_value(output, pointee, target, indent + 1, read);
+		}
+		else {
+			cparse_emit_indent(output, indent + 1);
+			fprintf(output, "size = cparse_serial_write(out, size, %s, sizeof(%s));\n", lvalue, target);
+		}
+		cparse_emit_indent(output, indent);
+		fprintf(output, "}\n");
+		return;
+	}
+
+	fprintf(output, "{\n");
+	cparse_emit_indent(output, indent + 1);
+	fprintf(output, "unsigned char present;\n");
+	cparse_emit_indent(output, indent + 1);
+	fprintf(output, "if (!cparse_serial_read(reader, &present, 1))\n");
+	cparse_emit_indent(output, indent + 2);
+	fprintf(output, "return 0;\n");
+	cparse_emit_indent(output, indent + 1);
+	fprintf(output, "%s = NULL;\n", lvalue);
+	cparse_emit_indent(output, indent + 1);
+	fprintf(output, "if (present) {\n");
+	cparse_emit_indent(output, indent + 2);
+	if (string) {
+		fprintf(output, "if (!(%s = cparse_serial_read_string(reader)))\n", lvalue);
+		cparse_emit_indent(output, indent + 3);
+		fprintf(output, "return 0;\n");
+	}
+	else {
+		fprintf(output, "if (!(%s = cparse_serial_allocate(reader, sizeof(%s))))\n", lvalue, target);
+		cparse_emit_indent(output, indent + 3);
+		fprintf(output, "return 0;\n");
+		if (cparse_type_has_pointers(pointee)) {
+			cparse_emit_serialize_value(output, pointee, target, indent + 2, read);
+		}
+		else {
+			cparse_emit_indent(output, indent + 2);
+			fprintf(output, "if (!cparse_serial_read(reader, (void*)%s, sizeof(%s)))\n", lvalue, target);
+			cparse_emit_indent(output, indent + 3);
+			fprintf(output, "return 0;\n");
+		}
+	}
+	cparse_emit_indent(output, indent + 1);
+	fprintf(output, "}\n");
+	cparse_emit_indent(output, indent);
+	fprintf(output, "}\n");
 }
 
-CPARSE_API enum cparse_result cparse_file(const char* filename, struct cparse_info const* info, struct cparse_unit** out)
+static void cparse_emit_serializer(FILE* output, struct cparse_decl_struct const* struct_decl, bool read)
 {
-	struct cparse_state state;
+	const int tag_length = struct_decl->decl.spelling_length;
+	const char* tag = struct_decl->decl.spelling;
+
+	if (read)
+		fprintf(output, "\nint deserialize_%.*s(struct %.*s* value, struct cparse_reader* reader)\n{\n", tag_length, tag, tag_length, tag);
+	else
+		fprintf(output, "\nsize_t serialize_%.*s(struct %.*s const* value, unsigned char* out)\n{\n\tsize_t size = 0;\n", tag_length, tag, tag_length, tag);
+
+	if (!struct_decl->fields)
+		fprintf(output, read ? "\t(void)value;\n\t(void)reader;\n" : "\t(void)value;\n\t(void)out;\n");
+
+	struct cparse_decl_variable_field const* field = struct_decl->fields;
+	while (field) {
+		if (cparse_type_has_pointers(field->variable.type)) {
+			size_t length = (size_t)field->variable.decl.spelling_length + 8;
+			char* lvalue = alloca(length);
+			cparse_format(lvalue, length, "value->%.*s", field->variable.decl.spelling_length, field->variable.decl.spelling);
+			cparse_emit_serialize_value(output, field->variable.type, lvalue, 1, read);
+			field = (struct cparse_decl_variable_field const*)field->variable.decl.next;
+			continue;
+		}
 
-	/* set the error handler and handle any error */
-	int result = setjmp(state.error_handler);
-	if (result) goto cleanup;
+		/* one copy for the run of fields without pointers, padding in between included */
+		struct cparse_decl_variable_field const* last = field;
+		while (last->variable.decl.next && !cparse_type_has_pointers(((struct cparse_decl_variable_field const*)last->variable.decl.next)->variable.type))
+			last = (struct cparse_decl_variable_field const*)last->variable.decl.next;
+
+		const int first_length = field->variable.decl.spelling_length, last_length = last->variable.decl.spelling_length;
+		const char* first_name = field->variable.decl.spelling;
+		const char* last_name = last->variable.decl.spelling;
+		if (read)
+			fprintf(output, "\tif (!cparse_serial_read(reader, (unsigned char*)value + offsetof(struct %.*s, %.*s), offsetof(struct %.*s, %.*s) + sizeof(value->%.*s) - offsetof(struct %.*s, %.*s)))\n\t\treturn 0;\n",
+				tag_length, tag, first_length, first_name, tag_length, tag, last_length, last_name, last_length, last_name, tag_length, tag, first_length, first_name);
+		else
+			fprintf(output, "\tsize = cparse_serial_write(out, size, (unsigned char const*)value + offsetof(struct %.*s, %.*s), offsetof(struct %.*s, %.*s) + sizeof(value->%.*s) - offsetof(struct %.*s, %.*s));\n",
+				tag_length, tag, first_length, first_name, tag_length, tag, last_length, last_name, last_length, last_name, tag_length, tag, first_length, first_name);
+
+		field = (struct cparse_decl_variable_field const*)last->variable.decl.next;
+	}
 
-	state.alloc_begin = info->buffer;
-	state.alloc_end = info->buffer + info->buffer_size;
-	state.alloc_cursor = info->buffer;
+	fprintf(output, read ? "\treturn 1;\n}\n" : "\treturn size;\n}\n");
+}
 
-	/* init lexer */
-	{
-		struct cparse_lexer* lex = &state.lex;
-		lex->file = NULL;
-		fopen_s(&lex->file, filename, "r");
-		lex->filename = filename;
-		lex->column = 0;
-		lex->line = 1;
-		lex->token_buffer_capacity = 511;
-		lex->token_buffer = cparse_alloc(&state, lex->token_buffer_capacity + 1, 1);
-		lex->token_buffer[0] = 0;
-		lex->token_size = 0;
+CPARSE_API void cparse_unit_emit_serializers(struct cparse_unit* unit, FILE* output)
+{
+	fprintf(output, "%s\n", cparse_serializer_prelude);
 
-		if (!lex->file) {
-			cparse_error(&state, CPARSE_RESULT_INVALID_INPUT_FILE, "cannot open file.");
+	/* declared up front, structs can refer to each other through pointers. anonymous ones have no name to go by. */
+	for (struct cparse_decl* decl = unit->decls; decl; decl = decl->next) {
+		if (decl->kind == CPARSE_DECL_STRUCT && decl->spelling && ((struct cparse_decl_struct*)decl)->alignment) {
+			fprintf(output, "size_t serialize_%.*s(struct %.*s const* value, unsigned char* out);\n", decl->spelling_length, decl->spelling, decl->spelling_length, decl->spelling);
+			fprintf(output, "int deserialize_%.*s(struct %.*s* value, struct cparse_reader* reader);\n", decl->spelling_length, decl->spelling, decl->spelling_length, decl->spelling);
 		}
+	}
 
-		cparse_lex_skip(&state);
-		cparse_lex(&state);
+	for (struct cparse_decl* decl = unit->decls; decl; decl = decl->next) {
+		if (decl->kind == CPARSE_DECL_STRUCT && decl->spelling && ((struct cparse_decl_struct*)decl)->alignment) {
+			cparse_emit_serializer(output, (struct cparse_decl_struct*)decl, false);
+			cparse_emit_serializer(output, (struct cparse_decl_struct*)decl, true);
+		}
 	}
+}
 
-	*out = cparse_parse_unit(&state);
+/* reflection */
+
+static const char cparse_reflection_prelude[] =
+	"#ifndef CPARSE_REFLECTION_\n"
+	"#define CPARSE_REFLECTION_\n"
+	"#include <stddef.h>\n"
+	"#include <string.h>\n"
+	"\n"
+	"enum cparse_field_kind {\n"
+	"\tCPARSE_FIELD_PRIMITIVE,\n"
+	"\tCPARSE_FIELD_POINTER,\n"
+	"\tCPARSE_FIELD_ARRAY,\n"
+	"\tCPARSE_FIELD_STRUCT,\n"
+	"\tCPARSE_FIELD_ENUM,\n"
+	"};\n"
+	"\n"
+	"struct cparse_field {\n"
+	"\tconst char* name;\n"
+	"\tint name_length;\n"
+	"\tint offset;\n"
+	"\tint size;\n"
+	"\tenum cparse_field_kind kind;\n"
+	"};\n"
+	"\n"
+	"static unsigned cparse_field_hash(unsigned hash, const char* name, size_t length)\n"
+	"{\n"
+	"\tfor (size_t i = 0; i < length; ++i)\n"
+	"\t\thash = (hash ^ (unsigned char)name[i]) * 16777619u;\n"
+	"\treturn hash ^ (hash >> 15);\n"
+	"}\n"
+	"\n"
+	"static unsigned cparse_field_slot(unsigned hash, unsigned displacement, unsigned mask)\n"
+	"{\n"
+	"\thash = (hash ^ displacement) * 2654435769u;\n"
+	"\treturn (hash ^ (hash >> 16)) & mask;\n"
+	"}\n"
+	"#endif\n";
+
+/* same as cparse_field_hash and cparse_field_slot in the prelude */
+static uint cparse_field_hash(uint seed, const char* name, uint length)
+{
+	uint hash = seed;
+	for (uint i = 0; i < length; ++i)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	return hash ^ (hash >> 15);
+}
 
-cleanup:
-	fclose(state.lex.file);
-	return result;
+static uint cparse_field_slot(uint hash, uint displacement, uint mask)
+{
+	hash = (hash ^ displacement) * 2654435769u;
+	return (hash ^ (hash >> 16)) & mask;
 }
 
-#ifndef CPARSE_NO_DUMP
+/* hash and displace perfect hash of the field names of a struct: the name hash picks a bucket of about four fields,
+   and the displacement of the bucket moves all of its fields to free slots of a power of two table */
+struct cparse_field_table {
+	uint seed;
+	uint mask;
+	uint bucket_mask;
+	int* slots; /* field indices, -1 for free slots */
+	uint* displacements;
+};
 
-static void cparse_unit_dump_type(struct cparse_type* type, FILE* output)
+/* tries to place the buckets largest first, false if some bucket found no displacement */
+static bool cparse_field_table_place(struct cparse_field_table* table, int num_fields, uint const* hashes, int* members, int* bucket_begin)
 {
-	switch (type->kind)
-	{
-		case CPARSE_TYPE_PRIMITIVE:
-			fprintf(output, "%s", cparse_primitive_type_spelling(((struct cparse_type_primitive*)type)->kind));
-			break;
+	const uint num_buckets = table->bucket_mask + 1;
+	memset(bucket_begin, 0, sizeof(int) * (num_buckets + 1));
+	for (int i = 0; i < num_fields; ++i)
+		++bucket_begin[(hashes[i] & table->bucket_mask) + 1];
+
+	int largest = 0;
+	for (uint b = 0; b < num_buckets; ++b) {
+		if (bucket_begin[b + 1] > largest)
+			largest = bucket_begin[b + 1];
+		bucket_begin[b + 1] += bucket_begin[b];
+	}
 
-		case CPARSE_TYPE_POINTER:
-			cparse_unit_dump_type(((struct cparse_type_pointer*)type)->pointee_type, output);
-			fprintf(output, " *");
-			break;
+	for (int i = 0; i < num_fields; ++i)
+		members[bucket_begin[hashes[i] & table->bucket_mask]++] = i;
+	for (uint b = num_buckets; b > 0; --b)
+		bucket_begin[b] = bucket_begin[b - 1];
+	bucket_begin[0] = 0;
 
-		case CPARSE_TYPE_ARRAY:
-			cparse_unit_dump_type(((struct cparse_type_array*)type)->element_type, output);
-			fprintf(output, " [%d]", ((struct cparse_type_array*)type)->extent);
-			break;
+	for (int size = largest; size > 0; --size) {
+		for (uint b = 0; b < num_buckets; ++b) {
+			if (bucket_begin[b + 1] - bucket_begin[b] != size)
+				continue;
 
-		default:
-			fprintf(output, "???");
-			break;
+			uint displacement = 0;
+			for (;; ++displacement) {
+				if (displacement > 0xffff)
+					return false;
+
+				int placed = bucket_begin[b];
+				for (; placed < bucket_begin[b + 1]; ++placed) {
+					uint slot = cparse_field_slot(hashes[members[placed]], displacement, table->mask);
+					if (table->slots[slot] >= 0)
+						break;
+					table->slots[slot] = members[placed];
+				}
+
+				if (placed == bucket_begin[b + 1])
+					break;
+
+				while (placed-- > bucket_begin[b])
+					table->slots[cparse_field_slot(hashes[members[placed]], displacement, table->mask)] = -1;
+			}
+			table->displacements[b] = displacement;
+		}
 	}
+	return true;
+}
 
-	if (type->qualifiers & CPARSE_TYPE_QUAL_CONST)
-		fprintf(output, " const");
-	if (type->qualifiers & CPARSE_TYPE_QUAL_VOLATILE)
-		fprintf(output, " volatile");
+/* false if out of memory, then the table holds nothing to free */
+static bool cparse_field_table_build(struct cparse_field_table* table, struct cparse_decl_struct const* struct_decl)
+{
+	const int num_fields = struct_decl->num_fields;
+	uint* hashes = malloc(sizeof(uint) * (num_fields + 1));
+	int* members = malloc(sizeof(int) * (num_fields + 1));
+	bool built = false;
+
+	table->mask = 0;
+	while ((int)table->mask + 1 < num_fields)
+		table->mask = table->mask * 2 + 1;
+	table->bucket_mask = 0;
+	while ((int)(table->bucket_mask + 1) * 4 < num_fields)
+		table->bucket_mask = table->bucket_mask * 2 + 1;
+
+	table->slots = NULL;
+	table->displacements = malloc(sizeof(uint) * (table->bucket_mask + 1));
+	int* bucket_begin = malloc(sizeof(int) * (table->bucket_mask + 2));
+	if (!hashes || !members || !table->displacements || !bucket_begin)
+		goto done;
+
+	for (uint attempt = 0;; ++attempt) {
+		/* a few seeds per table size before doubling it */
+		if (attempt % 8 == 0) {
+			if (attempt)
+				table->mask = table->mask * 2 + 1;
+			free(table->slots);
+			table->slots = malloc(sizeof(int) * (table->mask + 1));
+			if (!table->slots)
+				goto done;
+		}
+
+		table->seed = 2166136261u ^ (attempt * 0x9e3779b9u);
+		for (uint i = 0; i <= table->mask; ++i)
+			table->slots[i] = -1;
+		memset(table->displacements, 0, sizeof(uint) * (table->bucket_mask + 1));
+
+		int index = 0;
+		for (struct cparse_decl_variable_field const* field = struct_decl->fields; field; field = (struct cparse_decl_variable_field const*)field->variable.decl.next)
+			hashes[index++] = cparse_field_hash(table->seed, field->variable.decl.spelling, (uint)field->variable.decl.spelling_length);
+
+		if (cparse_field_table_place(table, num_fields, hashes, members, bucket_begin))
+			break;
+	}
+	built = true;
+
+done:
+	if (!built) {
+		free(table->displacements);
+		free(table->slots);
+		table->displacements = NULL;
+		table->slots = NULL;
+	}
+	free(bucket_begin);
+	free(members);
+	free(hashes);
+	return built;
 }
 
-static void cparse_unit_dump_enum(struct cparse_decl_enum* enum_decl, FILE* output)
+static void cparse_emit_table(FILE* output, const char* type, const char* name, void const* values, bool is_signed, uint count)
 {
-	fprintf(output, "enum (spelling=%s)\n", enum_decl->decl.spelling);
-	for (struct cparse_decl_enum_constant* constant = enum_decl->constants; constant; constant = (struct cparse_decl_enum_constant*)constant->decl.next)
-	{
-		fprintf(output, "\tconstant (spelling=\"%s\", value=\"%lld\")\n", constant->decl.spelling, constant->value);
+	fprintf(output, "\tstatic const %s %s[%u] = {", type, name, count);
+	for (uint i = 0; i < count; ++i) {
+		if (is_signed)
+			fprintf(output, i % 16 ? " %d," : "\n\t\t%d,", ((int const*)values)[i]);
+		else
+			fprintf(output, i % 16 ? " %u," : "\n\t\t%u,", ((uint const*)values)[i]);
 	}
+	fprintf(output, "\n\t};\n");
 }
 
-static void cparse_unit_dump_struct(struct cparse_decl_struct* struct_decl, FILE* output)
+/* false if out of memory, then nothing of the struct was written */
+static bool cparse_emit_reflection(FILE* output, struct cparse_decl_struct const* struct_decl)
 {
-	fprintf(output, "struct (spelling=%s)\n", struct_decl->decl.spelling);
-	for (struct cparse_decl_variable_field* field = struct_decl->fields; field; field = (struct cparse_decl_variable_field*)field->variable.decl.next)
-	{
-		fprintf(output, "\tfield (offset=%d, spelling=\"%s\", type=\"", field->offset, field->variable.decl.spelling);
-		cparse_unit_dump_type(field->variable.type, output);
-		fprintf(output, "\")\n");
+	static const char* const kinds[] = { "CPARSE_FIELD_PRIMITIVE", "CPARSE_FIELD_POINTER", "CPARSE_FIELD_ARRAY", "CPARSE_FIELD_STRUCT", "CPARSE_FIELD_ENUM" };
+	const int tag_length = struct_decl->decl.spelling_length;
+	const char* tag = struct_decl->decl.spelling;
+
+	struct cparse_field_table table;
+	if (!cparse_field_table_build(&table, struct_decl))
+		return false;
+
+	fprintf(output, "\nstatic const struct cparse_field fields_%.*s[] = {\n", tag_length, tag);
+	for (struct cparse_decl_variable_field const* field = struct_decl->fields; field; field = (struct cparse_decl_variable_field const*)field->variable.decl.next) {
+		struct cparse_decl const* decl = &field->variable.decl;
+		fprintf(output, "\t{ \"%.*s\", %d, %d, %d, %s },\n", decl->spelling_length, decl->spelling, decl->spelling_length,
+			field->offset, field->variable.type->size, kinds[field->variable.type->kind]);
 	}
+	fprintf(output, "\t{ NULL, 0, 0, 0, CPARSE_FIELD_PRIMITIVE },\n};\n");
+
+	fprintf(output, "\nint find_field_%.*s(const char* name, size_t length)\n{\n", tag_length, tag);
+	cparse_emit_table(output, "unsigned short", "displacements", table.displacements, false, table.bucket_mask + 1);
+	cparse_emit_table(output, struct_decl->num_fields <= 0x7f ? "signed char" : struct_decl->num_fields <= 0x7fff ? "short" : "int", "slots", table.slots, true, table.mask + 1);
+	fprintf(output, "\tconst unsigned hash = cparse_field_hash(%uu, name, length);\n", table.seed);
+	fprintf(output, "\tconst int index = slots[cparse_field_slot(hash, displacements[hash & %uu], %uu)];\n", table.bucket_mask, table.mask);
+	fprintf(output, "\treturn index >= 0 && (size_t)fields_%.*s[index].name_length == length && memcmp(fields_%.*s[index].name, name, length) == 0 ? index : -1;\n}\n",
+		tag_length, tag, tag_length, tag);
+
+	free(table.displacements);
+	free(table.slots);
+	return true;
 }
 
-CPARSE_API void cparse_unit_dump(struct cparse_unit* unit, FILE* output)
+CPARSE_API int cparse_unit_emit_reflection(struct cparse_unit* unit, FILE* output)
 {
-	for (struct cparse_decl* decl = unit->decls; decl; decl = decl->next)
-	{
-		switch (decl->kind)
-		{
-			case CPARSE_DECL_ENUM: cparse_unit_dump_enum((struct cparse_decl_enum*)decl, output); break;
-			case CPARSE_DECL_STRUCT: cparse_unit_dump_struct((struct cparse_decl_struct*)decl, output); break;
+	fprintf(output, "%s", cparse_reflection_prelude);
+	for (struct cparse_decl* decl = unit->decls; decl; decl = decl->next) {
+		if (decl->kind == CPARSE_DECL_STRUCT && decl->spelling && ((struct cparse_decl_struct*)decl)->alignment) {
+			if (!cparse_emit_reflection(output, (struct cparse_decl_struct*)decl))
+				return 0;
 		}
 	}
+	return 1;
 }
 
 #endif
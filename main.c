@@ -2,27 +2,33 @@
 #include <malloc.h>
 #include <stdio.h>
 
+static void* sample_allocate(void* user_data, cparse_size_t size)
+{
+	(void)user_data;
+	return malloc(size);
+}
+
+static void sample_deallocate(void* user_data, void* block)
+{
+	(void)user_data;
+	free(block);
+}
+
 int main()
 {
-	struct cparse_info info;
+	struct cparse_info info = { 0 };
 	info.buffer_size = 1024;
-	info.buffer = realloc(0, info.buffer_size);
+	info.buffer = malloc(info.buffer_size);
+	info.allocate = sample_allocate;
+	info.deallocate = sample_deallocate;
 
 	struct cparse_unit* unit = NULL;
-	enum cparse_result result;
-
-repeat:
-	result = cparse_file("sample.h", &info, &unit);
+	enum cparse_result result = cparse_file("sample.h", &info, &unit);
 
 	if (result == CPARSE_RESULT_OK)
 	{
 		cparse_unit_dump(unit, stdout);
-	}
-	else if (result == CPARSE_RESULT_OUT_OF_MEMORY)
-	{
-		info.buffer_size *= 2;
-		info.buffer = realloc(info.buffer, info.buffer_size);
-		goto repeat;
+		cparse_unit_release(unit, &info);
 	}
 	else {
 		printf("%s\n", info.buffer);
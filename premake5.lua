@@ -15,6 +15,13 @@ solution "cparse"
 	configuration "Release"
 		optimize "Speed"
 
+	configuration "linux"
+		links { "pthread" }
+
 	project "cparse_sample"
 		kind "ConsoleApp"
-		files { "*.h", "*.c" }
+		files { "cparse.h", "sample.h", "main.c" }
+
+	project "cparse_bench"
+		kind "ConsoleApp"
+		files { "cparse.h", "bench/*.c" }